@@ -0,0 +1,165 @@
+// Runs the host benchmarks, Google Benchmark style: each is run with more and
+// more iterations until it takes at least --min-time seconds, then the time and
+// rate per iteration are reported.
+//
+//   bench_host [--filter=TEXT] [--min-time=SECONDS] [-v]
+//   bench_host --baseline=FILE [--tolerance=RATIO]
+//
+// The output can be used as a baseline. With --baseline, results are compared
+// against it and the run fails if any are more than --tolerance times slower.
+// Baselines are only comparable on the same machine and build type, so
+// regenerate bench/baseline.txt when comparing on another.
+
+#include "bench.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host.h"
+
+#define BENCH_MAX_BASELINE 128
+
+#ifdef __clang__
+#define BENCH_COMPILER "clang " __clang_version__
+#else
+#define BENCH_COMPILER "gcc " __VERSION__
+#endif
+
+static const bench_t* bench_groups[] = {
+    bench_core,
+    bench_card_number,
+    bench_led,
+};
+
+static volatile uintptr_t bench_sink = 0;
+
+void bench_keep(uintptr_t value) {
+    bench_sink += value;
+}
+
+static double bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// =============================================================================
+// Baseline
+// =============================================================================
+
+typedef struct bench_baseline {
+    char name[64];
+    double ns;
+} bench_baseline_t;
+
+static bench_baseline_t bench_baseline[BENCH_MAX_BASELINE];
+static size_t bench_baseline_count = 0;
+
+// Reads "name ns iterations" lines, skipping # comments
+static bool bench_load_baseline(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (NULL == file) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return false;
+    }
+    char line[256];
+    while (NULL != fgets(line, sizeof(line), file) && bench_baseline_count < BENCH_MAX_BASELINE) {
+        bench_baseline_t* entry = &bench_baseline[bench_baseline_count];
+        if ('#' != line[0] && 2 == sscanf(line, "%63s %lf", entry->name, &entry->ns)) {
+            bench_baseline_count++;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+static const bench_baseline_t* bench_find_baseline(const char* name) {
+    for (size_t i = 0; i < bench_baseline_count; i++) {
+        if (0 == strcmp(bench_baseline[i].name, name)) {
+            return &bench_baseline[i];
+        }
+    }
+    return NULL;
+}
+
+// =============================================================================
+// Main
+// =============================================================================
+
+int main(int argc, char** argv) {
+    const char* filter = NULL;
+    const char* baseline_path = NULL;
+    double min_time = 0.5;
+    double tolerance = 1.5;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strncmp(argv[i], "--filter=", 9)) {
+            filter = argv[i] + 9;
+        } else if (0 == strncmp(argv[i], "--min-time=", 11)) {
+            min_time = strtod(argv[i] + 11, NULL);
+        } else if (0 == strncmp(argv[i], "--baseline=", 11)) {
+            baseline_path = argv[i] + 11;
+        } else if (0 == strncmp(argv[i], "--tolerance=", 12)) {
+            tolerance = strtod(argv[i] + 12, NULL);
+        } else if (0 == strcmp(argv[i], "-v")) {
+            host_log_enabled = 1;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (NULL != baseline_path && !bench_load_baseline(baseline_path)) {
+        return 1;
+    }
+    if (!host_flash_load(HOST_IMAGE)) {
+        fprintf(stderr, "Unable to load %s\n", HOST_IMAGE);
+        return 1;
+    }
+
+    printf("# Built with %s\n", BENCH_COMPILER);
+    printf("# %-46s %12s %12s %12s%s\n", "Benchmark", "Time (ns)", "Iterations", "Per second",
+           NULL != baseline_path ? "  Baseline" : "");
+    int slower = 0;
+    for (size_t g = 0; g < sizeof(bench_groups) / sizeof(bench_groups[0]); g++) {
+        for (const bench_t* bench = bench_groups[g]; NULL != bench->name; bench++) {
+            if (NULL != filter && NULL == strstr(bench->name, filter)) {
+                continue;
+            }
+
+            uint64_t iterations = 1;
+            double elapsed;
+            while (true) {
+                const double start = bench_now();
+                bench->run(iterations);
+                elapsed = bench_now() - start;
+                if (elapsed >= min_time || iterations >= UINT64_MAX / 10) {
+                    break;
+                }
+                // Aim a little past min_time, growing at most 10x a step
+                const double scale = elapsed > 0 ? 1.4 * min_time / elapsed : 10;
+                iterations = (uint64_t)(iterations * (scale < 10 ? (scale > 2 ? scale : 2) : 10));
+            }
+
+            const double ns = elapsed * 1e9 / iterations;
+            printf("  %-46s %12.1f %12llu %12.0f", bench->name, ns, (unsigned long long)iterations, 1e9 / ns);
+            const bench_baseline_t* baseline = bench_find_baseline(bench->name);
+            if (NULL != baseline_path && NULL == baseline) {
+                printf("  (new)");
+            } else if (NULL != baseline) {
+                const double ratio = ns / baseline->ns;
+                printf("  %.2fx%s", ratio, ratio > tolerance ? "  SLOWER" : "");
+                slower += ratio > tolerance;
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+
+    if (0 != slower) {
+        fprintf(stderr, "%d benchmarks more than %.2fx slower than the baseline\n", slower, tolerance);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// =============================================================================
+// Benchmarks
+// =============================================================================
+
+// A benchmark runs its operation `iterations` times. Anything it sets up is
+// timed too, so keep set up out of the loop or make it cheap.
+typedef struct bench {
+    const char* name;
+    void (*run)(uint64_t iterations);
+} bench_t;
+
+// Benchmarks in each bench_*.c, terminated by an entry with a NULL name
+extern const bench_t bench_core[];
+extern const bench_t bench_card_number[];
+extern const bench_t bench_led[];
+
+// Results passed here can't be optimised away
+void bench_keep(uintptr_t value);
@@ -0,0 +1,103 @@
+// Benchmarks for the card number decoders, against strtol_easy() which they
+// replaced on the card path. On the host a long is 64 bits, so strtol_easy()
+// gets the right answer here. On the device it is 32 bits and overflows past
+// ten digits.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "core.h"
+
+// An RF125PS frame's data, and a typical decimal card number
+#define BENCH_CARD_HEX "0A1B2C3D4E"
+#define BENCH_CARD_DEC "0043837042"
+
+// The longest decimal numbers each can hold
+#define BENCH_LONG_DEC "9223372036854775807"
+#define BENCH_U64_DEC "18446744073709551615"
+
+static void bench_card_number_dec(const char* str, uint64_t iterations) {
+    const size_t len = strlen(str);
+    rfid_number_t card = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(rfid_number_from_dec(str, len, &card));
+    }
+    bench_keep(card);
+}
+
+static void bench_card_number_strtol_easy(const char* str, uint64_t iterations) {
+    long value = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(strtol_easy(str, &value));
+    }
+    bench_keep(value);
+}
+
+static void bench_card_number_strtoull(const char* str, uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(strtoull(str, NULL, 10));
+    }
+}
+
+static void bench_dec_10(uint64_t iterations) {
+    bench_card_number_dec(BENCH_CARD_DEC, iterations);
+}
+
+static void bench_dec_19(uint64_t iterations) {
+    bench_card_number_dec(BENCH_LONG_DEC, iterations);
+}
+
+static void bench_dec_20(uint64_t iterations) {
+    bench_card_number_dec(BENCH_U64_DEC, iterations);
+}
+
+static void bench_strtol_easy_10(uint64_t iterations) {
+    bench_card_number_strtol_easy(BENCH_CARD_DEC, iterations);
+}
+
+static void bench_strtol_easy_19(uint64_t iterations) {
+    bench_card_number_strtol_easy(BENCH_LONG_DEC, iterations);
+}
+
+static void bench_strtoull_10(uint64_t iterations) {
+    bench_card_number_strtoull(BENCH_CARD_DEC, iterations);
+}
+
+static void bench_hex_10(uint64_t iterations) {
+    rfid_number_t card = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(rfid_number_from_hex(BENCH_CARD_HEX, sizeof(BENCH_CARD_HEX) - 1, &card));
+    }
+    bench_keep(card);
+}
+
+// Rejected at the first character, as a corrupt frame would mostly be
+static void bench_dec_invalid(uint64_t iterations) {
+    rfid_number_t card = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(rfid_number_from_dec("x043837042", 10, &card));
+    }
+}
+
+static void bench_str_skeleton(uint64_t iterations) {
+    rfid_number_t card = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(rfid_number_from_str("0x" BENCH_CARD_HEX, &card));
+    }
+    bench_keep(card);
+}
+
+const bench_t bench_card_number[] = {
+    {"rfid_number_from_dec/10_digits", bench_dec_10},
+    {"strtol_easy/10_digits", bench_strtol_easy_10},
+    {"libc_strtoull/10_digits", bench_strtoull_10},
+    {"rfid_number_from_dec/19_digits", bench_dec_19},
+    {"strtol_easy/19_digits", bench_strtol_easy_19},
+    {"rfid_number_from_dec/20_digits", bench_dec_20},
+    {"rfid_number_from_dec/invalid", bench_dec_invalid},
+    {"rfid_number_from_hex/10_digits", bench_hex_10},
+    {"rfid_number_from_str/0x_10_digits", bench_str_skeleton},
+    {NULL, NULL},
+};
@@ -0,0 +1,89 @@
+// Benchmarks for core.c helpers and loading the config
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bench.h"
+#include "config.h"
+#include "core.h"
+#include "host.h"
+
+// =============================================================================
+// Helpers
+// =============================================================================
+
+static void bench_strcmp_icase_match(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(strcmp_icase("RFID_SKELETON_CARD", "rfid_skeleton_card"));
+    }
+}
+
+static void bench_strcmp_icase_mismatch(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(strcmp_icase("RFID_SKELETON_CARD", "RFID_READER_TYPE"));
+    }
+}
+
+static void bench_strtol_easy(uint64_t iterations) {
+    long value = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(strtol_easy("65535", &value));
+    }
+    bench_keep(value);
+}
+
+static void bench_strlcpy(uint64_t iterations) {
+    static const char value[] = "A config value about as long as a portal address or API key";
+    char buffer[128];
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(strlcpy(buffer, value, sizeof(buffer)));
+    }
+}
+
+static void bench_crc32(uint64_t iterations) {
+    static uint8_t data[4096];
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(crc32_update(0, data, sizeof(data)));
+    }
+}
+
+static void bench_u64_to_dec(uint64_t iterations) {
+    char buffer[DEC64_SIZE];
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep((uintptr_t)u64_to_dec(UINT64_MAX - i, buffer));
+    }
+}
+
+// =============================================================================
+// Config
+// =============================================================================
+
+// The stock config, with the file system already mounted, as at boot
+static void bench_config_init(uint64_t iterations) {
+    host_fs_boot();
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(config_init());
+    }
+}
+
+static void bench_config_snapshot(uint64_t iterations) {
+    static uint8_t snapshot[1024];
+    host_fs_boot();
+    config_init();
+    for (uint64_t i = 0; i < iterations; i++) {
+        const size_t size = config_snapshot_save(snapshot, sizeof(snapshot));
+        bench_keep(config_snapshot_restore(snapshot, size));
+    }
+}
+
+const bench_t bench_core[] = {
+    {"strcmp_icase/match", bench_strcmp_icase_match},
+    {"strcmp_icase/mismatch", bench_strcmp_icase_mismatch},
+    {"strtol_easy/5_digits", bench_strtol_easy},
+    {"strlcpy/60_chars", bench_strlcpy},
+    {"crc32_update/4096_bytes", bench_crc32},
+    {"u64_to_dec/20_digits", bench_u64_to_dec},
+    {"config_init/stock", bench_config_init},
+    {"config_snapshot/save_restore", bench_config_snapshot},
+    {NULL, NULL},
+};
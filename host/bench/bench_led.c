@@ -0,0 +1,97 @@
+// Benchmarks for the LED driver (main/led.c), which is built in so each
+// benchmark can set up its own LED count. The per second column of led_show is
+// frames per second.
+//
+// The UART stand-ins return at once, so this is the CPU side of a frame:
+// encoding through the lookup tables. On a device the frame must also go out
+// on the wire, 16 bytes of 8 bit periods per LED at 3.2 Mbaud plus the 80 us
+// latch, so 300 LEDs can't go faster than ~80 frames per second.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include "led.c"
+
+// =============================================================================
+// SDK Stand-ins
+// =============================================================================
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t* uart_conf) {
+    return ESP_OK;
+}
+
+esp_err_t uart_set_line_inverse(uart_port_t uart_num, uint32_t inverse_mask) {
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size,
+                              void* uart_queue, int no_use) {
+    return ESP_OK;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t uart_num, TickType_t ticks_to_wait) {
+    return ESP_OK;
+}
+
+// Reads the chunk, so encoding it can't be optimised away
+int uart_write_bytes(uart_port_t uart_num, const char* src, size_t size) {
+    bench_keep(src[size - 1]);
+    return size;
+}
+
+void ets_delay_us(uint32_t us) {}
+
+// =============================================================================
+// Benchmarks
+// =============================================================================
+
+#define BENCH_LED_MAX 300
+
+static void bench_led_show(uint16_t count, led_type_t type, uint64_t iterations) {
+    static led_color_t colors[BENCH_LED_MAX];
+    for (int i = 0; i < BENCH_LED_MAX; i++) {
+        colors[i] = (led_color_t){.r = i, .g = i * 3, .b = i * 7, .w = i * 11};
+    }
+
+    led_init(count, type);
+    for (uint64_t i = 0; i < iterations; i++) {
+        bench_keep(led_show(colors));
+    }
+}
+
+#define BENCH_LED_SHOW(count, type, name)                              \
+    static void bench_led_show_##name##_##count(uint64_t iterations) { \
+        bench_led_show(count, type, iterations);                       \
+    }
+
+BENCH_LED_SHOW(1, LED_TYPE_RGBW, rgbw)
+BENCH_LED_SHOW(20, LED_TYPE_RGBW, rgbw)
+BENCH_LED_SHOW(50, LED_TYPE_RGBW, rgbw)
+BENCH_LED_SHOW(100, LED_TYPE_RGBW, rgbw)
+BENCH_LED_SHOW(150, LED_TYPE_RGBW, rgbw)
+BENCH_LED_SHOW(300, LED_TYPE_RGBW, rgbw)
+BENCH_LED_SHOW(20, LED_TYPE_BGRW, bgrw)
+BENCH_LED_SHOW(300, LED_TYPE_BGRW, bgrw)
+
+// Rebuilding the tables, as a brightness change does
+static void bench_led_set_brightness(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        led_set_brightness(i);
+    }
+    bench_keep(led_levels[UINT8_MAX]);
+}
+
+const bench_t bench_led[] = {
+    {"led_show/rgbw_1_leds", bench_led_show_rgbw_1},
+    {"led_show/rgbw_20_leds", bench_led_show_rgbw_20},
+    {"led_show/rgbw_50_leds", bench_led_show_rgbw_50},
+    {"led_show/rgbw_100_leds", bench_led_show_rgbw_100},
+    {"led_show/rgbw_150_leds", bench_led_show_rgbw_150},
+    {"led_show/rgbw_300_leds", bench_led_show_rgbw_300},
+    {"led_show/bgrw_20_leds", bench_led_show_bgrw_20},
+    {"led_show/bgrw_300_leds", bench_led_show_bgrw_300},
+    {"led_set_brightness", bench_led_set_brightness},
+    {NULL, NULL},
+};
@@ -0,0 +1,53 @@
+// Fuzzes config.c with arbitrary config files. A libFuzzer style harness, see
+// fuzz_main.c for running it without libFuzzer.
+//
+// Besides memory errors (build with INTERLOCK_HOST_SANITIZE), it checks that
+// any config that loads is what config_verify() reads back, including after a
+// migration has rewritten the file, and survives a snapshot round trip.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "host.h"
+
+// Bigger than any real config, but small enough to fit the partition
+#define FUZZ_CONFIG_MAX_SIZE 16384
+
+#define FUZZ_CHECK(cond)                                                    \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: invariant broken: %s\n", __FILE__, __LINE__, #cond); \
+            abort();                                                        \
+        }                                                                   \
+    } while (0)
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static bool loaded = false;
+    if (!loaded) {
+        FUZZ_CHECK(host_flash_load(HOST_IMAGE));
+        loaded = true;
+    }
+    if (size > FUZZ_CONFIG_MAX_SIZE) {
+        return 0;
+    }
+
+    FUZZ_CHECK(host_fs_boot());
+    FUZZ_CHECK(host_fs_write("/config.txt", data, size));
+    if (!config_init()) {
+        return 0;
+    }
+    FUZZ_CHECK(config_verify());
+
+    static uint8_t snapshot[2048];
+    const size_t snapshot_size = config_snapshot_save(snapshot, sizeof(snapshot));
+    FUZZ_CHECK(0 < snapshot_size);
+    FUZZ_CHECK(config_snapshot_restore(snapshot, snapshot_size));
+    FUZZ_CHECK(config_verify());
+
+    host_flash_stats_t stats;
+    host_flash_get_stats(&stats);
+    FUZZ_CHECK(0 == stats.bad_writes);
+    return 0;
+}
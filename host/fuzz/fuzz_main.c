@@ -0,0 +1,220 @@
+// Runs a libFuzzer style harness without libFuzzer.
+//
+//   fuzz_config FILE|DIR...             Runs each input once, e.g. for AFL:
+//                                       afl-fuzz -i config_seeds -o out -- fuzz_config @@
+//   fuzz_config -runs=N [-seed=S] DIR   Also runs N random mutations of the inputs
+//
+// The mutations are simple, but biased towards the characters config files are
+// made of, which is enough to reach most of the parser as a ctest smoke run. An
+// input that aborts is saved to ./crash-input, and can be run again as a FILE.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "host.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+#define FUZZ_MAX_INPUTS 256
+#define FUZZ_MAX_SIZE 8192
+
+typedef struct fuzz_input {
+    uint8_t* data;
+    size_t size;
+} fuzz_input_t;
+
+static fuzz_input_t fuzz_inputs[FUZZ_MAX_INPUTS];
+static size_t fuzz_input_count = 0;
+
+// =============================================================================
+// Inputs
+// =============================================================================
+
+static bool fuzz_add_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (NULL == file) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return false;
+    }
+    uint8_t* data = malloc(FUZZ_MAX_SIZE);
+    const size_t size = NULL == data ? 0 : fread(data, 1, FUZZ_MAX_SIZE, file);
+    fclose(file);
+    if (NULL == data || FUZZ_MAX_INPUTS == fuzz_input_count) {
+        free(data);
+        return false;
+    }
+    fuzz_inputs[fuzz_input_count++] = (fuzz_input_t){.data = data, .size = size};
+    return true;
+}
+
+static bool fuzz_add_path(const char* path) {
+    struct stat info;
+    if (0 != stat(path, &info)) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return false;
+    }
+    if (!S_ISDIR(info.st_mode)) {
+        return fuzz_add_file(path);
+    }
+
+    DIR* dir = opendir(path);
+    if (NULL == dir) {
+        return false;
+    }
+    bool ok = true;
+    struct dirent* entry;
+    while (ok && NULL != (entry = readdir(dir))) {
+        if ('.' == entry->d_name[0]) {
+            continue;
+        }
+        char file_path[4096];
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, entry->d_name);
+        ok = fuzz_add_file(file_path);
+    }
+    closedir(dir);
+    return ok;
+}
+
+// =============================================================================
+// Mutation
+// =============================================================================
+
+static uint64_t fuzz_rng_state = 1;
+
+static uint32_t fuzz_rand(uint32_t limit) {
+    // xorshift64*, so runs are repeatable for a given seed
+    fuzz_rng_state ^= fuzz_rng_state >> 12;
+    fuzz_rng_state ^= fuzz_rng_state << 25;
+    fuzz_rng_state ^= fuzz_rng_state >> 27;
+    return (uint32_t)((fuzz_rng_state * 0x2545F4914F6CDD1DULL) >> 32) % limit;
+}
+
+static uint8_t fuzz_rand_byte(void) {
+    static const char interesting[] = "\n\r=#;0x9-.NONEDHCP ";
+    return fuzz_rand(2) ? interesting[fuzz_rand(sizeof(interesting) - 1)] : fuzz_rand(256);
+}
+
+// Mutates `data` in place, returning the new size (at most FUZZ_MAX_SIZE).
+static size_t fuzz_mutate(uint8_t* data, size_t size) {
+    const int count = 1 + fuzz_rand(4);
+    for (int i = 0; i < count; i++) {
+        const size_t at = size ? fuzz_rand(size) : 0;
+        switch (fuzz_rand(5)) {
+            case 0:  // Flip a bit
+                if (size) {
+                    data[at] ^= 1 << fuzz_rand(8);
+                }
+                break;
+            case 1:  // Replace a byte
+                if (size) {
+                    data[at] = fuzz_rand_byte();
+                }
+                break;
+            case 2:  // Insert a byte
+                if (size < FUZZ_MAX_SIZE) {
+                    memmove(data + at + 1, data + at, size - at);
+                    data[at] = fuzz_rand_byte();
+                    size++;
+                }
+                break;
+            case 3: {  // Delete a run
+                const size_t length = size ? fuzz_rand(size - at < 64 ? size - at : 64) + 1 : 0;
+                memmove(data + at, data + at + length, size - at - length);
+                size -= length;
+                break;
+            }
+            case 4: {  // Splice in part of another input
+                const fuzz_input_t* other = &fuzz_inputs[fuzz_rand(fuzz_input_count)];
+                if (0 == other->size) {
+                    break;
+                }
+                const size_t from = fuzz_rand(other->size);
+                size_t length = fuzz_rand(other->size - from) + 1;
+                if (length > FUZZ_MAX_SIZE - size) {
+                    length = FUZZ_MAX_SIZE - size;
+                }
+                memmove(data + at + length, data + at, size - at);
+                memcpy(data + at, other->data + from, length);
+                size += length;
+                break;
+            }
+        }
+    }
+    return size;
+}
+
+// =============================================================================
+// Crashes
+// =============================================================================
+
+static const uint8_t* fuzz_current_data = NULL;
+static size_t fuzz_current_size = 0;
+
+static void fuzz_save_crash(int signal_number) {
+    static const char message[] = "Input saved to crash-input\n";
+    const int fd = open("crash-input", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (0 <= fd && (ssize_t)fuzz_current_size == write(fd, fuzz_current_data, fuzz_current_size) &&
+        0 > write(STDERR_FILENO, message, sizeof(message) - 1)) {
+        // Nowhere left to report it
+    }
+    if (0 <= fd) {
+        close(fd);
+    }
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}
+
+static void fuzz_run(const uint8_t* data, size_t size) {
+    fuzz_current_data = data;
+    fuzz_current_size = size;
+    LLVMFuzzerTestOneInput(data, size);
+}
+
+// =============================================================================
+// Main
+// =============================================================================
+
+int main(int argc, char** argv) {
+    long runs = 0;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strncmp(argv[i], "-runs=", 6)) {
+            runs = strtol(argv[i] + 6, NULL, 10);
+        } else if (0 == strncmp(argv[i], "-seed=", 6)) {
+            fuzz_rng_state = strtoull(argv[i] + 6, NULL, 10) | 1;
+        } else if (0 == strcmp(argv[i], "-v")) {
+            host_log_enabled = 1;
+        } else if (!fuzz_add_path(argv[i])) {
+            return 1;
+        }
+    }
+    if (0 == fuzz_input_count) {
+        fprintf(stderr, "Usage: %s [-runs=N] [-seed=S] [-v] FILE|DIR...\n", argv[0]);
+        return 1;
+    }
+
+    signal(SIGABRT, fuzz_save_crash);
+    signal(SIGSEGV, fuzz_save_crash);
+
+    for (size_t i = 0; i < fuzz_input_count; i++) {
+        fuzz_run(fuzz_inputs[i].data, fuzz_inputs[i].size);
+    }
+
+    static uint8_t data[FUZZ_MAX_SIZE];
+    for (long run = 0; run < runs; run++) {
+        const fuzz_input_t* input = &fuzz_inputs[fuzz_rand(fuzz_input_count)];
+        memcpy(data, input->data, input->size);
+        const size_t size = fuzz_mutate(data, input->size);
+        fuzz_run(data, size);
+    }
+
+    printf("%zu inputs and %ld mutations run\n", fuzz_input_count, runs);
+    return 0;
+}
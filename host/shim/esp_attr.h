@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand-in for the ESP-IDF header. There's no IRAM to place code in.
+
+#define IRAM_ATTR
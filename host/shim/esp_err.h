@@ -0,0 +1,9 @@
+#pragma once
+
+// Host stand-in for the ESP-IDF header, just what the host build uses
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_STATE 0x103
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdio.h>
+
+// Host stand-in for the ESP-IDF header. Log output goes to stderr, and only
+// when host_log_enabled is set, so fuzzing and benchmarks aren't slowed down
+// by it.
+
+extern int host_log_enabled;
+
+#define HOST_LOG(level, tag, format, ...)                                    \
+    do {                                                                     \
+        if (host_log_enabled) {                                              \
+            fprintf(stderr, level " (%s) " format "\n", tag, ##__VA_ARGS__); \
+        }                                                                    \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG("I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG("D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HOST_LOG("V", tag, format, ##__VA_ARGS__)
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for the ESP-IDF header. Microseconds since the program started.
+
+int64_t esp_timer_get_time(void);
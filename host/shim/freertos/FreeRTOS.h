@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for FreeRTOS. The host build is single threaded, so critical
+// sections and mutexes do nothing beyond checking they're used in pairs.
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY UINT32_MAX
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) / 10)  // CONFIG_FREERTOS_HZ is 100
+
+#define taskENTER_CRITICAL() ((void)0)
+#define taskEXIT_CRITICAL() ((void)0)
@@ -0,0 +1,182 @@
+#include "host.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "file_system.h"
+#include "freertos/semphr.h"
+#include "lfs.h"
+#include "spi_flash.h"
+
+int host_log_enabled = 0;
+
+// =============================================================================
+// Flash
+// =============================================================================
+
+// NOR flash: erasing sets every bit of a sector, and writes can only clear
+// bits. littlefs relies on this, so the RAM copy does too.
+static uint8_t host_flash[HOST_FLASH_PARTITION_SIZE] = {0};
+static uint8_t host_flash_image[HOST_FLASH_PARTITION_SIZE] = {0};
+static host_flash_stats_t host_flash_stats = {0};
+
+static bool host_flash_range(size_t addr, size_t size) {
+    return addr >= HOST_FLASH_PARTITION_OFFSET && size <= HOST_FLASH_PARTITION_SIZE &&
+           addr - HOST_FLASH_PARTITION_OFFSET <= HOST_FLASH_PARTITION_SIZE - size;
+}
+
+bool host_flash_load(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (NULL == file) {
+        return false;
+    }
+
+    memset(host_flash_image, 0xFF, sizeof(host_flash_image));
+    const size_t size = fread(host_flash_image, 1, sizeof(host_flash_image), file);
+    const bool ok = 0 == ferror(file) && 0 < size;
+    fclose(file);
+
+    host_flash_reset();
+    return ok;
+}
+
+void host_flash_reset(void) {
+    memcpy(host_flash, host_flash_image, sizeof(host_flash));
+    memset(&host_flash_stats, 0, sizeof(host_flash_stats));
+}
+
+void host_flash_get_stats(host_flash_stats_t* out_stats) {
+    *out_stats = host_flash_stats;
+}
+
+esp_err_t spi_flash_read(size_t src_addr, void* dest, size_t size) {
+    if (!host_flash_range(src_addr, size)) {
+        return ESP_FAIL;
+    }
+    host_flash_stats.reads++;
+    memcpy(dest, &host_flash[src_addr - HOST_FLASH_PARTITION_OFFSET], size);
+    return ESP_OK;
+}
+
+esp_err_t spi_flash_write(size_t dest_addr, const void* src, size_t size) {
+    if (!host_flash_range(dest_addr, size)) {
+        return ESP_FAIL;
+    }
+    host_flash_stats.writes++;
+    uint8_t* dest = &host_flash[dest_addr - HOST_FLASH_PARTITION_OFFSET];
+    const uint8_t* bytes = src;
+    for (size_t i = 0; i < size; i++) {
+        if (bytes[i] & ~dest[i]) {
+            host_flash_stats.bad_writes++;
+        }
+        dest[i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t spi_flash_erase_sector(size_t sector) {
+    const size_t addr = sector * HOST_FLASH_SECTOR_SIZE;
+    if (!host_flash_range(addr, HOST_FLASH_SECTOR_SIZE)) {
+        return ESP_FAIL;
+    }
+    host_flash_stats.erases++;
+    memset(&host_flash[addr - HOST_FLASH_PARTITION_OFFSET], 0xFF, HOST_FLASH_SECTOR_SIZE);
+    return ESP_OK;
+}
+
+// =============================================================================
+// File System
+// =============================================================================
+
+bool host_fs_boot(void) {
+    host_flash_reset();
+    return fs_init(NULL);
+}
+
+bool host_fs_write(const char* path, const void* data, size_t size) {
+    lfs_t* fs = fs_get_and_lock(portMAX_DELAY);
+    if (NULL == fs) {
+        return false;
+    }
+
+    lfs_file_t file = {0};
+    if (0 > lfs_file_open(fs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC)) {
+        fs_unlock(fs);
+        return false;
+    }
+    bool ok = (lfs_ssize_t)size == lfs_file_write(fs, &file, data, size);
+    ok = 0 <= lfs_file_close(fs, &file) && ok;
+
+    fs_unlock(fs);
+    return ok;
+}
+
+int host_fs_read(const char* path, void* data, size_t size) {
+    lfs_t* fs = fs_get_and_lock(portMAX_DELAY);
+    if (NULL == fs) {
+        return -1;
+    }
+
+    lfs_file_t file = {0};
+    if (0 > lfs_file_open(fs, &file, path, LFS_O_RDONLY)) {
+        fs_unlock(fs);
+        return -1;
+    }
+    const lfs_ssize_t read = lfs_file_read(fs, &file, data, size);
+    lfs_file_close(fs, &file);
+
+    fs_unlock(fs);
+    return 0 > read ? -1 : (int)read;
+}
+
+// =============================================================================
+// Timer
+// =============================================================================
+
+int64_t esp_timer_get_time(void) {
+    static int64_t start_us = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const int64_t now_us = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    if (0 == start_us) {
+        start_us = now_us;
+    }
+    return now_us - start_us;
+}
+
+// =============================================================================
+// Mutexes
+// =============================================================================
+
+struct host_semaphore {
+    bool taken;
+};
+
+// file_system.c makes the only mutex in the host build, once per fs_init(), so
+// one is reused rather than leaking one per remount.
+static struct host_semaphore host_mutex = {0};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    host_mutex.taken = false;
+    return &host_mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout) {
+    if (semaphore->taken) {
+        return pdFAIL;
+    }
+    semaphore->taken = true;
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    if (!semaphore->taken) {
+        return pdFAIL;
+    }
+    semaphore->taken = false;
+    return pdPASS;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// =============================================================================
+// Host Flash
+// =============================================================================
+
+// The file system partition, as laid out by file_system.c. Only the partition
+// is backed by RAM, so flash access outside it fails like a bad address would.
+#define HOST_FLASH_PARTITION_OFFSET 0x12000
+#define HOST_FLASH_PARTITION_SIZE 0x20000
+#define HOST_FLASH_SECTOR_SIZE 4096
+
+// Loads a littlefs image (as built by tools/mklittlefs) into the partition.
+// Anything past the end of the image reads as erased flash.
+//
+// Returns true on success.
+bool host_flash_load(const char* path);
+
+// Restores the partition to what was last loaded by host_flash_load().
+void host_flash_reset(void);
+
+// Flash operations since the last load or reset
+typedef struct host_flash_stats {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases;
+    uint32_t bad_writes;  // Writes that tried to set a bit erasing hadn't
+} host_flash_stats_t;
+
+void host_flash_get_stats(host_flash_stats_t* out_stats);
+
+// =============================================================================
+// Host File System
+// =============================================================================
+
+// Restores the loaded image and mounts it with fs_init(), as if the device had
+// just booted.
+//
+// Returns true if it mounted.
+bool host_fs_boot(void);
+
+// Replaces the file at `path` with `size` bytes of `data`.
+//
+// Returns true on success.
+bool host_fs_write(const char* path, const void* data, size_t size);
+
+// Reads up to `size` bytes of the file at `path` into `data`.
+//
+// Returns the number of bytes read, or -1 if the file can't be read.
+int host_fs_read(const char* path, void* data, size_t size);
+
+// =============================================================================
+// Host Logging
+// =============================================================================
+
+// Non-zero to print ESP_LOGx output to stderr. Off by default.
+extern int host_log_enabled;
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for the ESP8266 ROM header. The programs that build drivers
+// using it provide the function.
+
+void ets_delay_us(uint32_t us);
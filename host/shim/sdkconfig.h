@@ -0,0 +1,6 @@
+#pragma once
+
+// Host stand-in for the generated header, with the values from
+// sdkconfig.defaults that the host build needs.
+
+#define CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ 160
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+// Host stand-in for the ESP8266 SDK header. The flash is RAM, see host.h.
+
+esp_err_t spi_flash_read(size_t src_addr, void* dest, size_t size);
+esp_err_t spi_flash_write(size_t dest_addr, const void* src, size_t size);
+esp_err_t spi_flash_erase_sector(size_t sector);
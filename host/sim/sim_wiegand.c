@@ -0,0 +1,339 @@
+// Simulates the legacy Wiegand reader on the host, using the driver itself
+// (main/rfid_legacy.c): its ISR, edge ring, task loop and decoder.
+//
+// The CPU's cycle counter is replaced with a simulated clock, which starts a
+// second before it wraps. Frames of random cards become falling edges on D0/D1.
+// vTaskDelay() advances the clock, calling the ISR for each edge as it arrives,
+// so the task sees the edges just as it would on a device. Edges are delayed by
+// ISR latency jitter and occasional long stalls (e.g. the WiFi NMI), and some
+// scenarios add spurious edges.
+//
+//   sim_wiegand [--frames=N] [--seed=S] [-v]
+//
+// For each scenario it reports how many frames were decoded, dropped as bad and
+// misread (a wrong card passed the checks), and the host time spent per frame
+// in the task and per edge in the ISR. Host times only compare changes to the
+// driver. They say little about device cycles.
+//
+// Fails if a scenario marked as decodable loses a frame, or if anything is
+// misread.
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host.h"
+
+#define RFID_LEGACY_SIMULATOR
+static uint32_t rfid_legacy_ccount(void);
+
+#include "rfid_legacy.c"
+
+// =============================================================================
+// Scenarios
+// =============================================================================
+
+typedef struct sim_scenario {
+    const char* name;
+    uint8_t bits;                // Frame length, 26 or 34
+    uint32_t interval_us;        // Between bits
+    uint32_t jitter_us;          // ISR latency, uniformly up to this
+    uint32_t stall_per_mille;    // Edges held up by a long stall, per 1000
+    uint32_t stall_us;           // Length of a stall
+    uint32_t glitch_per_mille;   // Bits followed by a spurious edge, per 1000
+    bool decodable;              // Every frame should decode
+} sim_scenario_t;
+
+static const sim_scenario_t sim_scenarios[] = {
+    {"26_bit/clean", 26, 2000, 0, 0, 0, 0, true},
+    {"34_bit/clean", 34, 2000, 0, 0, 0, 0, true},
+    {"34_bit/jitter_100us", 34, 2000, 100, 0, 0, 0, true},
+    {"34_bit/fast_jitter_100us", 34, 400, 100, 0, 0, 0, true},
+    {"34_bit/stall_1ms", 34, 2000, 50, 20, 1000, 0, true},
+    {"34_bit/fast_stall_250us", 34, 400, 50, 50, 250, 0, false},
+    {"34_bit/fast_jitter_300us", 34, 400, 300, 0, 0, 0, false},
+    {"34_bit/glitch_1pct", 34, 2000, 50, 0, 0, 10, false},
+};
+
+#define SIM_N_SCENARIOS (sizeof(sim_scenarios) / sizeof(sim_scenarios[0]))
+
+// Quiet time between frames, on top of the frame gap the driver waits for
+#define SIM_FRAME_SPACING_US 40000
+#define SIM_FRAME_SPACING_RANDOM_US 60000
+
+// Where the cycle counter starts, a second before it wraps
+#define SIM_CCOUNT_START (UINT32_MAX - 1000000u * RFID_LEGACY_CYCLES_PER_US)
+
+// =============================================================================
+// Randomness
+// =============================================================================
+
+static uint64_t sim_rng_state = 1;
+
+static uint32_t sim_rand(uint32_t limit) {
+    // xorshift64*, so runs are repeatable for a given seed
+    sim_rng_state ^= sim_rng_state >> 12;
+    sim_rng_state ^= sim_rng_state << 25;
+    sim_rng_state ^= sim_rng_state >> 27;
+    const uint32_t value = (sim_rng_state * 0x2545F4914F6CDD1DULL) >> 32;
+    return 0 == limit ? 0 : value % limit;
+}
+
+// =============================================================================
+// Edge Stream
+// =============================================================================
+
+typedef struct sim_edge {
+    uint64_t time;     // Simulated microseconds
+    uint64_t arrival;  // When the ISR for it runs
+    uint8_t line;      // 0 for D0, 1 for D1
+} sim_edge_t;
+
+#define SIM_MAX_EDGES (2 * RFID_LEGACY_MAX_BITS)
+
+typedef struct sim_state {
+    const sim_scenario_t* scenario;
+    uint32_t frames;  // Frames to send
+
+    // Simulated time, in microseconds, and the cycle counter
+    uint64_t now_us;
+    uint32_t ccount;
+
+    // Edges of the frame being sent
+    sim_edge_t edges[SIM_MAX_EDGES];
+    uint32_t n_edges;
+    uint32_t next_edge;
+    uint64_t last_arrival_us;
+    uint64_t next_frame_us;
+    uint32_t frames_sent;
+    rfid_number_t frame_card;  // Card of the frame the ISR has started seeing
+    rfid_number_t next_card;
+
+    // Results
+    uint32_t decoded;
+    uint32_t misread;
+    uint32_t n_edges_total;
+    uint64_t task_ns;
+    uint64_t isr_ns;
+    uint64_t task_resumed_ns;
+} sim_state_t;
+
+static sim_state_t sim = {0};
+static jmp_buf sim_done;
+
+static uint64_t sim_host_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static uint32_t rfid_legacy_ccount(void) {
+    return sim.ccount;
+}
+
+static void sim_set_time(uint64_t now_us) {
+    sim.ccount += (uint32_t)((now_us - sim.now_us) * RFID_LEGACY_CYCLES_PER_US);
+    sim.now_us = now_us;
+}
+
+// When the ISR for `edge` runs. ISRs run in order, and can be held up.
+static uint64_t sim_arrival(const sim_edge_t* edge) {
+    const sim_scenario_t* scenario = sim.scenario;
+    uint64_t arrival = edge->time + sim_rand(scenario->jitter_us + 1);
+    if (sim_rand(1000) < scenario->stall_per_mille) {
+        arrival += scenario->stall_us;
+    }
+    return arrival > sim.last_arrival_us ? arrival : sim.last_arrival_us;
+}
+
+// Builds a Wiegand frame: even parity over the first half of the data, the
+// data, then odd parity over the second half.
+static uint64_t sim_frame_bits(rfid_number_t card, uint8_t bits) {
+    const uint8_t n_data = bits - 2;
+    const uint8_t half = n_data / 2;
+    const uint64_t first_half = card >> half;
+    const uint64_t second_half = card & ((UINT64_C(1) << half) - 1);
+    const uint64_t even = __builtin_popcountll(first_half) & 1;
+    const uint64_t odd = !(__builtin_popcountll(second_half) & 1);
+    return (even << (bits - 1)) | (card << 1) | odd;
+}
+
+// Queues the edges of the next frame, starting at sim.next_frame_us
+static void sim_queue_frame(void) {
+    const sim_scenario_t* scenario = sim.scenario;
+    const uint8_t n_data = scenario->bits - 2;
+    sim.next_card = ((uint64_t)sim_rand(UINT32_MAX) << 32 | sim_rand(UINT32_MAX)) & ((UINT64_C(1) << n_data) - 1);
+    const uint64_t bits = sim_frame_bits(sim.next_card, scenario->bits);
+
+    sim.n_edges = 0;
+    sim.next_edge = 0;
+    for (uint8_t i = 0; i < scenario->bits; i++) {
+        const uint64_t time = sim.next_frame_us + (uint64_t)i * scenario->interval_us;
+        sim.edges[sim.n_edges++] = (sim_edge_t){.time = time, .line = (bits >> (scenario->bits - 1 - i)) & 1};
+
+        if (sim_rand(1000) < scenario->glitch_per_mille) {
+            // Ringing or crosstalk, well inside the driver's minimum edge gap
+            const sim_edge_t glitch = {.time = time + 5 + sim_rand(150), .line = sim_rand(2)};
+            sim.edges[sim.n_edges++] = glitch;
+        }
+    }
+
+    // Glitches can land after the next bit's edge
+    for (uint32_t i = 1; i < sim.n_edges; i++) {
+        for (uint32_t j = i; j > 0 && sim.edges[j - 1].time > sim.edges[j].time; j--) {
+            const sim_edge_t swap = sim.edges[j];
+            sim.edges[j] = sim.edges[j - 1];
+            sim.edges[j - 1] = swap;
+        }
+    }
+    for (uint32_t i = 0; i < sim.n_edges; i++) {
+        sim.edges[i].arrival = sim_arrival(&sim.edges[i]);
+        sim.last_arrival_us = sim.edges[i].arrival;
+    }
+
+    sim.frames_sent++;
+    sim.n_edges_total += sim.n_edges;
+    sim.next_frame_us = sim.edges[sim.n_edges - 1].time + SIM_FRAME_SPACING_US + sim_rand(SIM_FRAME_SPACING_RANDOM_US);
+}
+
+// =============================================================================
+// SDK Stand-ins
+// =============================================================================
+
+void vTaskDelay(TickType_t ticks) {
+    const uint64_t paused_ns = sim_host_ns();
+    sim.task_ns += paused_ns - sim.task_resumed_ns;
+
+    const uint64_t until_us = sim.now_us + (uint64_t)ticks * 10000;
+    while (true) {
+        if (sim.next_edge == sim.n_edges) {
+            if (sim.frames_sent == sim.frames || sim.next_frame_us > until_us) {
+                break;
+            }
+            sim_queue_frame();
+        }
+
+        const sim_edge_t* edge = &sim.edges[sim.next_edge];
+        if (edge->arrival > until_us) {
+            break;
+        }
+        if (0 == sim.next_edge) {
+            sim.frame_card = sim.next_card;
+        }
+        sim.next_edge++;
+
+        sim_set_time(edge->arrival);
+        const uint64_t isr_start_ns = sim_host_ns();
+        rfid_legacy_isr((void*)(uintptr_t)edge->line);
+        sim.isr_ns += sim_host_ns() - isr_start_ns;
+    }
+    sim_set_time(until_us);
+
+    // Done once the last frame has had time to be decoded
+    if (sim.frames_sent == sim.frames && sim.next_edge == sim.n_edges &&
+        sim.now_us > sim.last_arrival_us + 2 * RFID_LEGACY_FRAME_GAP_US) {
+        longjmp(sim_done, 1);
+    }
+
+    sim.task_resumed_ns = sim_host_ns();
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return sim.now_us / 10000;
+}
+
+void rfid_frame_started(void) {}
+
+void rfid_submit(rfid_number_t card) {
+    if (card == sim.frame_card) {
+        sim.decoded++;
+    } else {
+        sim.misread++;
+    }
+}
+
+void health_watch_task(TaskHandle_t task) {}
+
+esp_err_t gpio_config(const gpio_config_t* config) {
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int flags) {
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void* args) {
+    return ESP_OK;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stack_depth, void* arg, UBaseType_t priority,
+                       TaskHandle_t* out_task) {
+    return pdPASS;
+}
+
+// =============================================================================
+// Main
+// =============================================================================
+
+// Runs the driver's task, which returns here once every frame has been sent.
+static void sim_run(const sim_scenario_t* scenario, uint32_t frames) {
+    memset(&sim, 0, sizeof(sim));
+    sim.scenario = scenario;
+    sim.frames = frames;
+    sim.ccount = SIM_CCOUNT_START;
+    sim.next_frame_us = SIM_FRAME_SPACING_US;
+
+    rfid_legacy_ring_head = 0;
+    rfid_legacy_ring_tail = 0;
+    rfid_legacy_ring_overrun = false;
+
+    if (0 == setjmp(sim_done)) {
+        sim.task_resumed_ns = sim_host_ns();
+        rfid_legacy_task(NULL);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t frames = 2000;
+    for (int i = 1; i < argc; i++) {
+        if (0 == strncmp(argv[i], "--frames=", 9)) {
+            frames = strtoul(argv[i] + 9, NULL, 10);
+        } else if (0 == strncmp(argv[i], "--seed=", 7)) {
+            sim_rng_state = strtoull(argv[i] + 7, NULL, 10) | 1;
+        } else if (0 == strcmp(argv[i], "-v")) {
+            host_log_enabled = 1;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (0 == frames) {
+        fprintf(stderr, "--frames must be at least 1\n");
+        return 1;
+    }
+
+    printf("%-26s %7s %8s %8s %8s %8s %14s %12s\n", "Scenario", "Frames", "Decoded", "Dropped", "Misread", "Success",
+           "Task ns/frame", "ISR ns/edge");
+    int failures = 0;
+    for (size_t i = 0; i < SIM_N_SCENARIOS; i++) {
+        const sim_scenario_t* scenario = &sim_scenarios[i];
+        sim_run(scenario, frames);
+
+        const uint32_t dropped = sim.frames_sent - sim.decoded - sim.misread;
+        const bool failed = 0 != sim.misread || (scenario->decodable && sim.decoded != sim.frames_sent);
+        printf("%-26s %7u %8u %8u %8u %7.2f%% %14.0f %12.1f%s\n", scenario->name, sim.frames_sent, sim.decoded,
+               dropped, sim.misread, 100.0 * sim.decoded / sim.frames_sent, (double)sim.task_ns / sim.frames_sent,
+               (double)sim.isr_ns / sim.n_edges_total, failed ? "  FAILED" : "");
+        failures += failed;
+    }
+
+    if (0 != failures) {
+        fprintf(stderr, "%d scenarios failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
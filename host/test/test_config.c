@@ -0,0 +1,339 @@
+// Tests for config.c and core.c, against the littlefs image the firmware build
+// flashes. Run by ctest, or directly with -v for log output.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "core.h"
+#include "host.h"
+
+// =============================================================================
+// Harness
+// =============================================================================
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                                \
+    do {                                                                           \
+        if (!(cond)) {                                                             \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                       \
+        }                                                                          \
+    } while (0)
+
+#define CHECK_STR(actual, expected) CHECK(0 == strcmp((actual), (expected)))
+
+// A complete, current config. Tests put the lines they care about in front of
+// it, as the first occurrence of a key wins.
+static const char* test_config_base =
+    "CONFIG_VERSION=2\n"
+    "DEVICE_NAME=Base\n"
+    "DEVICE_TYPE=INTERLOCK\n"
+    "PORTAL_ADDRESS=portal.example.org\n"
+    "PORTAL_PORT=8443\n"
+    "PORTAL_API_KEY=key\n"
+    "LED_COUNT=1\n"
+    "LED_TYPE=RGBW\n"
+    "RFID_READER_TYPE=LEGACY\n"
+    "RFID_SKELETON_CARD=NONE\n"
+    "WIFI_SSID=ssid\n"
+    "WIFI_PSK=psk\n"
+    "WIFI_IP=DHCP\n"
+    "WIFI_NETMASK=NONE\n"
+    "WIFI_GATEWAY=NONE\n"
+    "WIFI_DNS=NONE\n";
+
+// Boots with `text` as the config file, then loads it.
+static bool test_config_init(const char* text) {
+    if (!host_fs_boot() || !host_fs_write("/config.txt", text, strlen(text))) {
+        fprintf(stderr, "Unable to set up the file system\n");
+        return false;
+    }
+    return config_init();
+}
+
+// As test_config_init(), with `lines` in front of the base config.
+static bool test_config_init_with(const char* lines) {
+    static char text[4096];
+    snprintf(text, sizeof(text), "%s%s", lines, test_config_base);
+    return test_config_init(text);
+}
+
+static uint32_t test_ip(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    // Network byte order on a little endian CPU, as on the ESP8266
+    return a | (b << 8) | (c << 16) | ((uint32_t)d << 24);
+}
+
+// =============================================================================
+// Config Tests
+// =============================================================================
+
+static void test_stock_config(void) {
+    CHECK(host_fs_boot());
+    CHECK(config_init());
+    CHECK_STR(config_get_device_name(), "TestInterlock");
+    CHECK(DEVICE_TYPE_DOOR == config_get_device_type());
+    CHECK_STR(config_get_portal_address(), "portal.hsbne.org");
+    CHECK(443 == config_get_portal_port());
+    CHECK_STR(config_get_portal_api_key(), "123456789abcdefg");
+    CHECK(20 == config_get_led_count());
+    CHECK(LED_TYPE_BGRW == config_get_led_type());
+    CHECK(RFID_READER_TYPE_RF125PS == config_get_rfid_reader_type());
+    CHECK(!config_get_rfid_use_skeleton_card());
+    CHECK_STR(config_get_wifi_ssid(), "FBIVan");
+    CHECK_STR(config_get_wifi_psk(), "password");
+    config_static_ip_t static_ip;
+    CHECK(!config_get_wifi_static_ip(&static_ip));
+    CHECK(config_verify());
+
+    // A current config is never rewritten
+    host_flash_stats_t stats;
+    host_flash_get_stats(&stats);
+    CHECK(0 == stats.writes && 0 == stats.erases);
+}
+
+static void test_line_endings(void) {
+    char text[4096];
+    snprintf(text, sizeof(text), "; CRLF\r\ndevice_name=Crlf\r\n\r\n# CR only\rled_count=300\r%s", test_config_base);
+    CHECK(test_config_init(text));
+    CHECK_STR(config_get_device_name(), "Crlf");
+    CHECK(300 == config_get_led_count());
+    CHECK(config_verify());
+}
+
+static void test_values(void) {
+    CHECK(test_config_init_with("RFID_SKELETON_CARD=0x0A1B2C3D4E\nLED_TYPE=bgrw\n"));
+    CHECK(config_get_rfid_use_skeleton_card());
+    CHECK(0x0A1B2C3D4EULL == config_get_skeleton_card());
+    CHECK(LED_TYPE_BGRW == config_get_led_type());
+    CHECK(DEVICE_TYPE_INTERLOCK == config_get_device_type());
+
+    CHECK(test_config_init_with("RFID_SKELETON_CARD=714456\n"));
+    CHECK(714456 == config_get_skeleton_card());
+
+    CHECK(!test_config_init_with("RFID_SKELETON_CARD=0\n"));
+    CHECK(!test_config_init_with("RFID_SKELETON_CARD=0x\n"));
+    CHECK(!test_config_init_with("PORTAL_PORT=65536\n"));
+    CHECK(!test_config_init_with("PORTAL_PORT= 443\n"));
+    CHECK(!test_config_init_with("LED_COUNT=-1\n"));
+    CHECK(!test_config_init_with("LED_TYPE=RGB\n"));
+    CHECK(!test_config_init_with("DEVICE_TYPE=\n"));
+    CHECK(!test_config_init_with("NOT A PAIR\n"));
+}
+
+static void test_static_ip(void) {
+    CHECK(test_config_init_with("WIFI_IP=10.0.1.20\nWIFI_NETMASK=255.255.255.0\nWIFI_GATEWAY=10.0.1.1\n"));
+    config_static_ip_t static_ip;
+    CHECK(config_get_wifi_static_ip(&static_ip));
+    CHECK(test_ip(10, 0, 1, 20) == static_ip.ip);
+    CHECK(test_ip(255, 255, 255, 0) == static_ip.netmask);
+    CHECK(test_ip(10, 0, 1, 1) == static_ip.gateway);
+    CHECK(static_ip.gateway == static_ip.dns);
+
+    CHECK(test_config_init_with(
+        "WIFI_IP=10.0.1.20\nWIFI_NETMASK=255.255.255.0\nWIFI_GATEWAY=10.0.1.1\nWIFI_DNS=1.1.1.1\n"));
+    CHECK(config_get_wifi_static_ip(&static_ip));
+    CHECK(test_ip(1, 1, 1, 1) == static_ip.dns);
+
+    // The keys are optional, giving DHCP, and aren't added to a current config
+    char text[1024];
+    strlcpy(text, test_config_base, sizeof(text));
+    *strstr(text, "WIFI_IP=") = '\0';
+    CHECK(test_config_init(text));
+    CHECK(!config_get_wifi_static_ip(&static_ip));
+    CHECK(config_verify());
+    char read_back[1024] = {0};
+    CHECK(0 < host_fs_read("/config.txt", read_back, sizeof(read_back) - 1));
+    CHECK_STR(read_back, text);
+
+    CHECK(test_config_init_with("WIFI_IP=DHCP\nWIFI_NETMASK=255.255.255.0\n"));
+    CHECK(!config_get_wifi_static_ip(&static_ip));
+
+    // A static address needs a netmask and gateway
+    CHECK(!test_config_init_with("WIFI_IP=10.0.1.20\nWIFI_NETMASK=255.255.255.0\n"));
+    CHECK(!test_config_init_with("WIFI_IP=10.0.1\n"));
+    CHECK(!test_config_init_with("WIFI_IP=10.0.1.256\n"));
+    CHECK(!test_config_init_with("WIFI_IP=10.0.1.20.\n"));
+    CHECK(!test_config_init_with("WIFI_DNS=1.1.1\n"));
+}
+
+static void test_truncation(void) {
+    char lines[512];
+
+    // The longest value that fits
+    char value[128];
+    memset(value, 'n', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    snprintf(lines, sizeof(lines), "DEVICE_NAME=%s\n", value);
+    CHECK(test_config_init_with(lines));
+    CHECK(127 == strlen(config_get_device_name()));
+
+    // One more is truncated, which fails rather than using part of the value
+    snprintf(lines, sizeof(lines), "PORTAL_API_KEY=%sn\n", value);
+    CHECK(!test_config_init_with(lines));
+
+    // As is a line too long to read at all
+    snprintf(lines, sizeof(lines), "X=%s%s\n", value, value);
+    CHECK(!test_config_init_with(lines));
+}
+
+static void test_missing(void) {
+    CHECK(host_fs_boot());
+    CHECK(host_fs_write("/config.txt", "", 0));
+    CHECK(!config_init());
+
+    // Every key but the version missing
+    CHECK(!test_config_init("CONFIG_VERSION=2\n"));
+}
+
+static void test_migration(void) {
+    // Version 0: unversioned, and from before the static IP keys
+    const char* old =
+        "# Old config\r\n"
+        "DEVICE_NAME=Old\r\n"
+        "DEVICE_TYPE=DOOR\r\n"
+        "PORTAL_ADDRESS=portal.example.org\r\n"
+        "PORTAL_PORT=443\r\n"
+        "PORTAL_API_KEY=key\r\n"
+        "LED_COUNT=20\r\n"
+        "LED_TYPE=BGRW\r\n"
+        "RFID_READER_TYPE=RF125PS\r\n"
+        "RFID_SKELETON_CARD=NONE\r\n"
+        "WIFI_SSID=ssid\r\n"
+        "WIFI_PSK=psk\r\n"
+        "UNKNOWN_KEY=kept\r\n";
+    CHECK(test_config_init(old));
+    CHECK_STR(config_get_device_name(), "Old");
+    config_static_ip_t static_ip;
+    CHECK(!config_get_wifi_static_ip(&static_ip));
+
+    // Written back with the new keys, keeping what the firmware doesn't know
+    char text[2048] = {0};
+    CHECK(0 < host_fs_read("/config.txt", text, sizeof(text) - 1));
+    CHECK(NULL != strstr(text, "# Old config\n"));
+    CHECK(NULL != strstr(text, "CONFIG_VERSION=2\n"));
+    CHECK(NULL != strstr(text, "WIFI_IP=DHCP\n"));
+    CHECK(NULL != strstr(text, "UNKNOWN_KEY=kept\n"));
+    CHECK(0 > host_fs_read("/config.txt.tmp", text, sizeof(text)));
+    CHECK(config_verify());
+
+    host_flash_stats_t stats;
+    host_flash_get_stats(&stats);
+    CHECK(0 == stats.bad_writes);
+
+    // A NUL hides the rest of a comment, but mustn't take its line break with
+    // it when written back
+    static const char nul_comment[] = "# Comment\0 hidden\n";
+    const char* unversioned = test_config_base + strlen("CONFIG_VERSION=2\n");
+    char with_nul[2048];
+    memcpy(with_nul, nul_comment, sizeof(nul_comment) - 1);
+    strcpy(with_nul + sizeof(nul_comment) - 1, unversioned);
+    CHECK(host_fs_boot());
+    CHECK(host_fs_write("/config.txt", with_nul, sizeof(nul_comment) - 1 + strlen(unversioned)));
+    CHECK(config_init());
+    CHECK(config_verify());
+    CHECK(0 < host_fs_read("/config.txt", text, sizeof(text) - 1));
+    CHECK(0 == strncmp(text, "# Comment\nDEVICE_NAME=Base\n", 27));
+
+    // Configs from newer firmware are refused
+    CHECK(!test_config_init("CONFIG_VERSION=3\n"));
+}
+
+static void test_snapshot(void) {
+    CHECK(test_config_init_with("DEVICE_NAME=Snapshot\nRFID_SKELETON_CARD=123\n"));
+    uint8_t snapshot[1024];
+    const size_t size = config_snapshot_save(snapshot, sizeof(snapshot));
+    CHECK(0 < size);
+    CHECK(0 == config_snapshot_save(snapshot, size - 1));
+
+    // Restoring replaces a different config, and matches the file again
+    CHECK(test_config_init_with("DEVICE_NAME=Other\n"));
+    CHECK(!config_snapshot_restore(snapshot, size - 1));
+    CHECK_STR(config_get_device_name(), "Other");
+    CHECK(config_snapshot_restore(snapshot, size));
+    CHECK_STR(config_get_device_name(), "Snapshot");
+    CHECK(123 == config_get_skeleton_card());
+    CHECK(!config_verify());
+
+    CHECK(test_config_init_with("DEVICE_NAME=Snapshot\nRFID_SKELETON_CARD=123\n"));
+    CHECK(config_snapshot_restore(snapshot, size));
+    CHECK(config_verify());
+}
+
+// =============================================================================
+// Core Tests
+// =============================================================================
+
+static void test_core(void) {
+    char buffer[8];
+    CHECK(5 == strlcpy(buffer, "hello", sizeof(buffer)));
+    CHECK_STR(buffer, "hello");
+    CHECK(9 == strlcpy(buffer, "truncated", sizeof(buffer)));
+    CHECK_STR(buffer, "truncat");
+    buffer[0] = 'x';
+    CHECK(5 == strlcpy(buffer, "hello", 0));
+    CHECK('x' == buffer[0]);
+
+    CHECK(0 == strcmp_icase("Door", "DOOR"));
+    CHECK(0 > strcmp_icase("DOO", "door"));
+    CHECK(0 < strcmp_icase("doors", "DOOR"));
+
+    long value = 0;
+    CHECK(strtol_easy("-42", &value) && -42 == value);
+    CHECK(strtol_easy("0", &value) && 0 == value);
+    CHECK(!strtol_easy("", &value));
+    CHECK(!strtol_easy("-", &value));
+    CHECK(!strtol_easy("4 2", &value));
+    CHECK(!strtol_easy("+4", &value));
+
+    rfid_number_t card = 0;
+    CHECK(rfid_number_from_dec("18446744073709551615", 20, &card) && UINT64_MAX == card);
+    CHECK(!rfid_number_from_dec("18446744073709551616", 20, &card));
+    CHECK(rfid_number_from_dec("123xyz", 3, &card) && 123 == card);
+    CHECK(!rfid_number_from_dec("", 0, &card));
+    CHECK(rfid_number_from_hex("ffffFFFFffffFFFF", 16, &card) && UINT64_MAX == card);
+    CHECK(!rfid_number_from_hex("10000000000000000", 17, &card));
+    CHECK(!rfid_number_from_hex("0g", 2, &card));
+    CHECK(rfid_number_from_str("0X1f", &card) && 0x1F == card);
+    CHECK(!rfid_number_from_str("0x", &card));
+
+    CHECK(0xCBF43926 == crc32_update(0, "123456789", 9));
+    CHECK(0xCBF43926 == crc32_update(crc32_update(0, "1234", 4), "56789", 5));
+
+    CHECK_STR(U64_DEC(UINT64_MAX), "18446744073709551615");
+    CHECK_STR(I64_DEC(INT64_MIN), "-9223372036854775808");
+    CHECK_STR(I64_DEC(0), "0");
+}
+
+// =============================================================================
+// Main
+// =============================================================================
+
+int main(int argc, char** argv) {
+    host_log_enabled = argc > 1 && 0 == strcmp(argv[1], "-v");
+
+    if (!host_flash_load(HOST_IMAGE)) {
+        fprintf(stderr, "Unable to load %s\n", HOST_IMAGE);
+        return 1;
+    }
+
+    test_stock_config();
+    test_line_endings();
+    test_values();
+    test_static_ip();
+    test_truncation();
+    test_missing();
+    test_migration();
+    test_snapshot();
+    test_core();
+
+    if (0 != test_failures) {
+        fprintf(stderr, "%d checks failed\n", test_failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
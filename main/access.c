@@ -0,0 +1,215 @@
+#include "access.h"
+#include <stdbool.h>
+
+#include "card_cache.h"
+#include "card_store.h"
+#include "config.h"
+#include "core.h"
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "health.h"
+#include "led_animation.h"
+#include "network.h"
+#include "portal.h"
+#include "rfid.h"
+#include "wall_clock.h"
+
+#define TAG "access"
+
+// =============================================================================
+// Relay
+// =============================================================================
+
+#define ACCESS_RELAY_GPIO GPIO_NUM_12
+
+// The relay stays on until a granted card hasn't been seen for this long. Cards
+// held at the reader keep it on, a quick swipe unlocks for this long.
+#define ACCESS_UNLOCK_MS 5000
+
+// The relay is on while either a card or the portal has it unlocked. Guarded
+// by critical sections, as remote unlocks come from the portal task and end in
+// the timer task.
+static bool access_card_unlocked = false;
+static bool access_remote_unlocked = false;
+static esp_timer_handle_t access_remote_timer = NULL;
+
+// Must be in a critical section
+static void access_relay_apply(void) {
+    gpio_set_level(ACCESS_RELAY_GPIO, access_card_unlocked || access_remote_unlocked ? 1 : 0);
+}
+
+static void access_relay_set(bool on) {
+    taskENTER_CRITICAL();
+    access_card_unlocked = on;
+    access_relay_apply();
+    taskEXIT_CRITICAL();
+}
+
+static void access_remote_expired(void* arg) {
+    taskENTER_CRITICAL();
+    access_remote_unlocked = false;
+    access_relay_apply();
+    taskEXIT_CRITICAL();
+    ESP_LOGI(TAG, "Remote unlock ended");
+}
+
+// =============================================================================
+// Decisions
+// =============================================================================
+
+// How long to wait for the portal to answer a card check
+#define ACCESS_PORTAL_TIMEOUT_MS 1500
+
+static bool access_check(rfid_number_t card) {
+    if (config_get_rfid_use_skeleton_card() && card == config_get_skeleton_card()) {
+        return true;
+    }
+
+    // Cards synced from the portal, then the portal itself for any added since,
+    // remembering its answer for when the card comes back
+    if (card_store_contains(card)) {
+        return true;
+    }
+
+    bool granted;
+    if (card_cache_get(card, &granted)) {
+        return granted;
+    }
+
+    const uint32_t generation = card_cache_generation();
+    const int64_t asked = esp_timer_get_time();
+    if (portal_check_card(card, pdMS_TO_TICKS(ACCESS_PORTAL_TIMEOUT_MS), &granted)) {
+        card_cache_put(card, granted, generation, esp_timer_get_time() - asked);
+        return granted;
+    }
+
+    return false;
+}
+
+static access_stats_t access_stats = {0};
+
+static void access_count(const rfid_event_t* event, bool granted) {
+    const uint32_t latency = esp_timer_get_time() - event->time;
+
+    taskENTER_CRITICAL();
+    access_stats.decisions++;
+    access_stats.granted += granted;
+    access_stats.latency_total_us += latency;
+    access_stats.latency_last_us = latency;
+    if (latency > access_stats.latency_max_us) {
+        access_stats.latency_max_us = latency;
+    }
+    taskEXIT_CRITICAL();
+}
+
+static void access_task(void* arg) {
+    bool unlocked = false;
+    rfid_number_t unlocked_card = 0;
+    TickType_t unlocked_seen = 0;  // When the card that unlocked was last seen
+
+    while (1) {
+        // Only wake without an event when we need to relock
+        TickType_t timeout = portMAX_DELAY;
+        if (unlocked) {
+            const TickType_t elapsed = xTaskGetTickCount() - unlocked_seen;
+            timeout = elapsed < pdMS_TO_TICKS(ACCESS_UNLOCK_MS) ? pdMS_TO_TICKS(ACCESS_UNLOCK_MS) - elapsed : 0;
+        }
+
+        rfid_event_t event;
+        if (rfid_wait_for_event(&event, timeout)) {
+            if (RFID_EVENT_CARD_PRESENTED == event.type) {
+                // No roaming or power save while the portal may be asked
+                const bool held = network_hold();
+                const bool granted = access_check(event.card);
+                if (held) {
+                    network_release();
+                }
+                if (granted) {
+                    unlocked = true;
+                    unlocked_card = event.card;
+                    unlocked_seen = xTaskGetTickCount();
+                    access_relay_set(true);
+                }
+                access_count(&event, granted);
+                led_animation_flash(granted ? LED_FLASH_GRANTED : LED_FLASH_DENIED);
+                ESP_LOGI(TAG, "Card %s %s", U64_DEC(event.card), granted ? "granted" : "denied");
+                portal_log_access(event.card, granted, wall_clock_at(event.time));
+            } else if (unlocked && unlocked_card == event.card) {
+                unlocked_seen = xTaskGetTickCount();
+            }
+        }
+
+        if (unlocked && xTaskGetTickCount() - unlocked_seen >= pdMS_TO_TICKS(ACCESS_UNLOCK_MS)) {
+            unlocked = false;
+            access_relay_set(false);
+            ESP_LOGI(TAG, "Locked");
+        }
+    }
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+bool access_start(void) {
+    const gpio_config_t io_config = {
+        .pin_bit_mask = (1 << ACCESS_RELAY_GPIO),
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    if (ESP_OK != gpio_config(&io_config)) {
+        return false;
+    }
+    access_relay_set(false);
+
+    // Bring the WiFi to full power while a card is still being read, so it is
+    // ready by the time the portal may be asked
+    rfid_set_frame_hook(network_wake);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = access_remote_expired,
+        .name = "Remote Unlock",
+    };
+    if (ESP_OK != esp_timer_create(&timer_args, &access_remote_timer)) {
+        return false;
+    }
+
+    TaskHandle_t task;
+    if (pdPASS != xTaskCreate(access_task, "Access", 2048, NULL, tskIDLE_PRIORITY + 4, &task)) {
+        return false;
+    }
+    health_watch_task(task);
+    return true;
+}
+
+bool access_unlock_remote(uint32_t duration_ms, int64_t* out_actuated) {
+    if (NULL == access_remote_timer) {
+        return false;
+    }
+
+    // Stopped first, so it can't end the unlock it is being restarted for
+    esp_timer_stop(access_remote_timer);
+    taskENTER_CRITICAL();
+    access_remote_unlocked = true;
+    access_relay_apply();
+    *out_actuated = esp_timer_get_time();
+    taskEXIT_CRITICAL();
+
+    if (ESP_OK != esp_timer_start_once(access_remote_timer, duration_ms * 1000ULL)) {
+        access_remote_expired(NULL);
+        return false;
+    }
+    led_animation_flash(LED_FLASH_GRANTED);
+    return true;
+}
+
+void access_get_stats(access_stats_t* out_stats) {
+    taskENTER_CRITICAL();
+    *out_stats = access_stats;
+    taskEXIT_CRITICAL();
+}
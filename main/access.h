@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct access_stats {
+    uint32_t decisions;         // Cards presented
+    uint32_t granted;
+    uint64_t latency_total_us;  // From the card being read to the relay being set
+    uint32_t latency_last_us;
+    uint32_t latency_max_us;
+} access_stats_t;
+
+// Starts the access control task. It handles card events from the RFID reader,
+// decides whether to grant access and drives the relay.
+//
+// Must come after config_init() and rfid_start().
+//
+// Returns true on success.
+bool access_start(void);
+
+// Unlocks for `duration_ms` on behalf of the portal, whatever the cards are
+// doing. Calling it again while unlocked restarts the countdown. The command
+// must already have been authenticated.
+//
+// Returns true with the esp_timer time the relay was switched on in
+// `out_actuated`.
+bool access_unlock_remote(uint32_t duration_ms, int64_t* out_actuated);
+
+// Gets a copy of the decision counters.
+void access_get_stats(access_stats_t* out_stats);
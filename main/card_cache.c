@@ -0,0 +1,134 @@
+#include "card_cache.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// How long answers are trusted for. The portal invalidates them when access
+// changes, so these only bound how stale an answer gets if that is missed.
+// Denials expire sooner, so a newly added card isn't kept out for long.
+#define CARD_CACHE_GRANT_TTL_MS (10 * 60 * 1000)
+#define CARD_CACHE_DENY_TTL_MS (60 * 1000)
+
+// =============================================================================
+// State
+// =============================================================================
+
+typedef struct card_cache_entry {
+    rfid_number_t card;
+    int64_t expires;  // esp_timer time, 0 if the entry is free
+    uint32_t used;    // card_cache_clock when last looked up or stored
+    bool granted;
+} card_cache_entry_t;
+
+// Guarded by critical sections, as lookups come from the access task and
+// invalidations from the portal task. Scanning the entries is quick enough.
+static card_cache_entry_t card_cache_entries[CARD_CACHE_SIZE] = {0};
+static uint32_t card_cache_clock = 0;
+static uint32_t card_cache_generation_count = 0;
+static card_cache_stats_t card_cache_stats = {0};
+static uint32_t card_cache_checks = 0;  // Portal checks whose time went into card_cache_check_total_us
+static uint64_t card_cache_check_total_us = 0;
+
+// Must be in a critical section
+static card_cache_entry_t* card_cache_find(rfid_number_t card) {
+    for (size_t i = 0; i < CARD_CACHE_SIZE; i++) {
+        if (0 != card_cache_entries[i].expires && card == card_cache_entries[i].card) {
+            return &card_cache_entries[i];
+        }
+    }
+    return NULL;
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+bool card_cache_get(rfid_number_t card, bool* out_granted) {
+    const int64_t now = esp_timer_get_time();
+    bool hit = false;
+
+    taskENTER_CRITICAL();
+    card_cache_entry_t* entry = card_cache_find(card);
+    if (NULL != entry && now >= entry->expires) {
+        entry->expires = 0;
+        entry = NULL;
+    }
+    if (NULL != entry) {
+        hit = true;
+        entry->used = ++card_cache_clock;
+        *out_granted = entry->granted;
+        card_cache_stats.hits++;
+        if (0 != card_cache_checks) {
+            card_cache_stats.saved_us += card_cache_check_total_us / card_cache_checks;
+        }
+    } else {
+        card_cache_stats.misses++;
+    }
+    taskEXIT_CRITICAL();
+    return hit;
+}
+
+uint32_t card_cache_generation(void) {
+    taskENTER_CRITICAL();
+    const uint32_t generation = card_cache_generation_count;
+    taskEXIT_CRITICAL();
+    return generation;
+}
+
+void card_cache_put(rfid_number_t card, bool granted, uint32_t generation, uint32_t check_us) {
+    const int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL();
+    card_cache_checks++;
+    card_cache_check_total_us += check_us;
+
+    if (generation == card_cache_generation_count) {
+        // The same card, else a free entry, else the least recently used
+        card_cache_entry_t* entry = card_cache_find(card);
+        if (NULL == entry) {
+            entry = &card_cache_entries[0];
+            for (size_t i = 1; i < CARD_CACHE_SIZE && 0 != entry->expires; i++) {
+                card_cache_entry_t* other = &card_cache_entries[i];
+                if (0 == other->expires || card_cache_clock - other->used > card_cache_clock - entry->used) {
+                    entry = other;
+                }
+            }
+        }
+
+        entry->card = card;
+        entry->granted = granted;
+        entry->expires = now + 1000LL * (granted ? CARD_CACHE_GRANT_TTL_MS : CARD_CACHE_DENY_TTL_MS);
+        entry->used = ++card_cache_clock;
+    }
+    taskEXIT_CRITICAL();
+}
+
+void card_cache_invalidate(rfid_number_t card) {
+    taskENTER_CRITICAL();
+    card_cache_entry_t* entry = card_cache_find(card);
+    if (NULL != entry) {
+        entry->expires = 0;
+    }
+    card_cache_generation_count++;
+    card_cache_stats.invalidations++;
+    taskEXIT_CRITICAL();
+}
+
+void card_cache_clear(void) {
+    taskENTER_CRITICAL();
+    for (size_t i = 0; i < CARD_CACHE_SIZE; i++) {
+        card_cache_entries[i].expires = 0;
+    }
+    card_cache_generation_count++;
+    card_cache_stats.invalidations++;
+    taskEXIT_CRITICAL();
+}
+
+void card_cache_get_stats(card_cache_stats_t* out_stats) {
+    taskENTER_CRITICAL();
+    *out_stats = card_cache_stats;
+    taskEXIT_CRITICAL();
+}
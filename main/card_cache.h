@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+
+// =============================================================================
+// Card Cache
+// =============================================================================
+//
+// Remembers the portal's recent answers for cards that aren't in the card
+// store, so a card presented again (e.g. to re-enable a tool) is decided
+// without a round trip. Grants are kept longer than denials, and the portal
+// invalidates entries when a member's access changes. Kept in RAM only, the
+// least recently used entry makes way for new ones.
+
+// Cards remembered
+#define CARD_CACHE_SIZE 32
+
+typedef struct card_cache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t invalidations;
+    uint64_t saved_us;  // Portal round trips avoided by hits, at the average time a check takes
+} card_cache_stats_t;
+
+// Looks `card` up.
+//
+// Returns true and sets `out_granted` if the portal answered for it recently.
+bool card_cache_get(rfid_number_t card, bool* out_granted);
+
+// Returns a value to pass to card_cache_put(), taken before asking the portal.
+uint32_t card_cache_generation(void);
+
+// Remembers the portal's answer for `card`, which took `check_us` to arrive.
+// Dropped if the cache was invalidated since `generation` was taken, as the
+// answer may be out of date.
+void card_cache_put(rfid_number_t card, bool granted, uint32_t generation, uint32_t check_us);
+
+// Forgets the answer for `card`.
+void card_cache_invalidate(rfid_number_t card);
+
+// Forgets every answer.
+void card_cache_clear(void);
+
+// Gets a copy of the counters.
+void card_cache_get_stats(card_cache_stats_t* out_stats);
@@ -0,0 +1,141 @@
+#include "card_store.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+#include "file_system.h"
+#include "freertos/FreeRTOS.h"
+
+#define TAG "card_store"
+
+#define CARD_STORE_PATH "/cards.bin"
+#define CARD_STORE_TMP_PATH "/cards.bin.tmp"
+
+// The file is a plain array of rfid_number_t. Cards are read and written this
+// many at a time.
+#define CARD_STORE_BLOCK 32
+
+// Lookups come from the access path, so don't wait forever on a busy file system
+#define CARD_STORE_LOCK_TIMEOUT_MS 1000
+
+// =============================================================================
+// Update State
+// =============================================================================
+
+static bool card_store_updating = false;
+static lfs_file_t card_store_file;
+static rfid_number_t card_store_buffer[CARD_STORE_BLOCK];
+static uint32_t card_store_buffered = 0;
+static int32_t card_store_written = 0;
+
+static bool card_store_flush(void) {
+    if (0 == card_store_buffered) {
+        return true;
+    }
+
+    lfs_t* fs = fs_get_and_lock(portMAX_DELAY);
+    if (NULL == fs) {
+        return false;
+    }
+    const lfs_ssize_t size = card_store_buffered * sizeof(rfid_number_t);
+    const bool ok = size == lfs_file_write(fs, &card_store_file, card_store_buffer, size);
+    fs_unlock(fs);
+
+    card_store_written += card_store_buffered;
+    card_store_buffered = 0;
+    return ok;
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+bool card_store_contains(rfid_number_t card) {
+    lfs_t* fs = fs_get_and_lock(pdMS_TO_TICKS(CARD_STORE_LOCK_TIMEOUT_MS));
+    if (NULL == fs) {
+        return false;
+    }
+
+    lfs_file_t file;
+    bool found = false;
+    if (0 <= lfs_file_open(fs, &file, CARD_STORE_PATH, LFS_O_RDONLY)) {
+        rfid_number_t cards[CARD_STORE_BLOCK];
+        lfs_ssize_t size;
+        while (!found && 0 < (size = lfs_file_read(fs, &file, cards, sizeof(cards)))) {
+            for (size_t i = 0; i < size / sizeof(rfid_number_t); i++) {
+                found |= card == cards[i];
+            }
+        }
+        lfs_file_close(fs, &file);
+    }
+
+    fs_unlock(fs);
+    return found;
+}
+
+bool card_store_update_begin(void) {
+    if (card_store_updating) {
+        return false;
+    }
+
+    lfs_t* fs = fs_get_and_lock(portMAX_DELAY);
+    if (NULL == fs) {
+        return false;
+    }
+    card_store_updating =
+        0 <= lfs_file_open(fs, &card_store_file, CARD_STORE_TMP_PATH, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+    fs_unlock(fs);
+
+    card_store_buffered = 0;
+    card_store_written = 0;
+    return card_store_updating;
+}
+
+bool card_store_update_add(rfid_number_t card) {
+    if (!card_store_updating) {
+        return false;
+    }
+
+    card_store_buffer[card_store_buffered++] = card;
+    return CARD_STORE_BLOCK != card_store_buffered || card_store_flush();
+}
+
+int32_t card_store_update_commit(void) {
+    if (!card_store_updating) {
+        return -1;
+    }
+
+    bool ok = card_store_flush();
+
+    lfs_t* fs = fs_get_and_lock(portMAX_DELAY);
+    if (NULL == fs) {
+        return -1;
+    }
+    ok = (0 <= lfs_file_close(fs, &card_store_file)) && ok;
+    ok = ok && 0 <= lfs_rename(fs, CARD_STORE_TMP_PATH, CARD_STORE_PATH);
+    if (!ok) {
+        lfs_remove(fs, CARD_STORE_TMP_PATH);
+    }
+    fs_unlock(fs);
+
+    card_store_updating = false;
+    if (!ok) {
+        ESP_LOGE(TAG, "Unable to save the card list");
+        return -1;
+    }
+    return card_store_written;
+}
+
+void card_store_update_abort(void) {
+    if (!card_store_updating) {
+        return;
+    }
+
+    lfs_t* fs = fs_get_and_lock(portMAX_DELAY);
+    if (NULL != fs) {
+        lfs_file_close(fs, &card_store_file);
+        lfs_remove(fs, CARD_STORE_TMP_PATH);
+        fs_unlock(fs);
+    }
+    card_store_updating = false;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+
+// =============================================================================
+// Card Store
+// =============================================================================
+//
+// The list of cards allowed in, as last synced from the portal. It is kept on
+// the file system so the door keeps working while the portal is unreachable.
+
+// Returns true if `card` is in the list.
+bool card_store_contains(rfid_number_t card);
+
+// Starts replacing the list. Cards are written out as they arrive and only
+// replace the list on card_store_update_commit(), so a failed sync leaves the
+// old list in place. Only one update may be in progress at a time.
+//
+// Returns true on success.
+bool card_store_update_begin(void);
+
+// Adds a card to the update.
+//
+// Returns true on success.
+bool card_store_update_add(rfid_number_t card);
+
+// Replaces the list with the update.
+//
+// Returns the number of cards in the new list, or -1 on failure.
+int32_t card_store_update_commit(void);
+
+// Discards the update, if there is one.
+void card_store_update_abort(void);
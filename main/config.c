@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "core.h"
 #include "esp_log.h"
@@ -80,6 +81,10 @@ static const char* config_key_strings[CFG_KEY_N_KEYS] = {
     [CFG_KEY_PORTAL_PORT] = "PORTAL_PORT",
     [CFG_KEY_RFID_READER_TYPE] = "RFID_READER_TYPE",
     [CFG_KEY_RFID_SKELETON_CARD] = "RFID_SKELETON_CARD",
+    [CFG_KEY_WIFI_DNS] = "WIFI_DNS",
+    [CFG_KEY_WIFI_GATEWAY] = "WIFI_GATEWAY",
+    [CFG_KEY_WIFI_IP] = "WIFI_IP",
+    [CFG_KEY_WIFI_NETMASK] = "WIFI_NETMASK",
     [CFG_KEY_WIFI_PSK] = "WIFI_PSK",
     [CFG_KEY_WIFI_SSID] = "WIFI_SSID",
 };
@@ -90,23 +95,164 @@ static const char* config_key_strings[CFG_KEY_N_KEYS] = {
         fflush(stdout);           \
     } while (0)
 
+// =============================================================================
+// Migrations
+// =============================================================================
+
+// The config schema version this firmware expects. Bump it and add steps to
+// config_migrations whenever a key is renamed, added or changes meaning.
+#define CONFIG_CURRENT_VERSION 2
+
+// If true, a successfully migrated config is written back to the file system so
+// the migration only runs once per device.
+#define CONFIG_WRITE_BACK_MIGRATIONS true
+
+// Temporary file used to atomically replace the config when writing it back.
+#define CONFIG_FILE_TMP_PATH "/config.txt.tmp"
+
+typedef enum config_migration_op {
+    CONFIG_MIGRATION_NOP,        // Nothing to do, the version is just stamped
+    CONFIG_MIGRATION_RENAME,     // Rename `from` to `key`
+    CONFIG_MIGRATION_DEFAULT,    // Set `key` to `value` if it is missing
+    CONFIG_MIGRATION_TRANSFORM,  // Rewrite the value of `key` with `transform`
+} config_migration_op_t;
+
+typedef struct config_migration {
+    uint16_t version;  // The version this step upgrades the config to
+    config_migration_op_t op;
+    const char* key;    // Name of the key at `version`
+    const char* from;   // RENAME: name of the key before `version`
+    const char* value;  // DEFAULT: the default value
+
+    // TRANSFORM: rewrite `value` (a buffer of `size` bytes) in place. Returns
+    // false if the value could not be converted.
+    bool (*transform)(char* value, size_t size);
+} config_migration_t;
+
+// Upgrade steps, in version order. Each step is applied once to any config
+// older than its version. Steps are applied in memory during config_init(),
+// so a config many versions old is upgraded in a single pass.
+static const config_migration_t config_migrations[] = {
+    // Version 1 is the first versioned schema. Unversioned configs are
+    // otherwise identical.
+    {.version = 1, .op = CONFIG_MIGRATION_NOP},
+
+    // Version 2 adds optional static IP settings. Existing devices keep DHCP.
+    {.version = 2, .op = CONFIG_MIGRATION_DEFAULT, .key = "WIFI_IP", .value = "DHCP"},
+    {.version = 2, .op = CONFIG_MIGRATION_DEFAULT, .key = "WIFI_NETMASK", .value = "NONE"},
+    {.version = 2, .op = CONFIG_MIGRATION_DEFAULT, .key = "WIFI_GATEWAY", .value = "NONE"},
+    {.version = 2, .op = CONFIG_MIGRATION_DEFAULT, .key = "WIFI_DNS", .value = "NONE"},
+};
+
+#define CONFIG_N_MIGRATIONS (sizeof(config_migrations) / sizeof(config_migrations[0]))
+
+// Follows every rename newer than `from_version` to give the current name of
+// key `name`.
+static const char* config_migration_resolve(const char* name, uint16_t from_version) {
+    for (size_t i = 0; i < CONFIG_N_MIGRATIONS; i++) {
+        const config_migration_t* step = &config_migrations[i];
+        if (step->version > from_version && CONFIG_MIGRATION_RENAME == step->op &&
+            0 == strcmp_icase(step->from, name)) {
+            name = step->key;
+        }
+    }
+    return name;
+}
+
 // =============================================================================
 // File Parsing
 // =============================================================================
 
-// Attempts to read the value of a given key from the config. The value is only
-// valid if the function returns CONFIG_OK.
+// Values loaded from the config file. The file is parsed once into this table
+// by config_load(), migrated in memory, and then read by config_value_get().
+// It only lives for the duration of config_init().
+typedef struct config_values {
+    config_err_t state[CFG_KEY_N_KEYS];  // CONFIG_OK if the value is usable
+    char value[CFG_KEY_N_KEYS][CONFIG_MAX_VALUE_LENGTH + 1];
+} config_values_t;
+
+static config_values_t* config_values = NULL;
+
+// Returns the key matching `str` (case insensitive), or CFG_KEY_N_KEYS if there
+// is no such key.
+static config_key_t config_key_from_str(const char* str) {
+    for (int i = 0; i < CFG_KEY_N_KEYS; i++) {
+        if (0 == strcmp_icase(config_key_strings[i], str)) {
+            return i;
+        }
+    }
+    return CFG_KEY_N_KEYS;
+}
+
+// Reads the next key/value pair from the config file, skipping blank lines and
+// comments. `line` must be at least CONFIG_MAX_LINE_LENGTH + 1 bytes long.
 //
-// On success, up to `size` bytes will be copied to `out_value`, which will
-// be null terminated for any `size` greater than zero. Size is recommended to
-// be at least CONFIG_MAX_VALUE_LENGTH + 1.
+// On success, `out_key` and `out_value` point into `line`. Comments and blank
+// lines are returned with `out_key` set to NULL so callers that copy the file
+// can preserve them.
 //
-// On failure, a relevant error code will be returned. The value in `out_value`
-// must be ignored.
-static config_err_t config_value_get(config_key_t key, char* out_value, size_t size) {
-    // Validate the key
-    if (0 > key || key >= CFG_KEY_N_KEYS) {
-        return CONFIG_ERR_INVALID_ARG;
+// Returns CONFIG_ERR_MISSING_KEY at the end of the file.
+static config_err_t config_line_read(lfs_file_t* file, lfs_t* fs, char* line, char** out_key, char** out_value) {
+    if (NULL == fs_fgets(line, CONFIG_MAX_LINE_LENGTH, file, fs)) {
+        return CONFIG_ERR_MISSING_KEY;
+    }
+
+    *out_key = NULL;
+    *out_value = NULL;
+
+    // Skip empty lines and comments
+    if ('\0' == line[0] || '#' == line[0] || ';' == line[0] || '\n' == line[0]) {
+        return CONFIG_OK;
+    }
+
+    // Check for truncation
+    size_t len = strlen(line);
+    if (len == (CONFIG_MAX_LINE_LENGTH - 1) && line[len - 1] != '\n') {
+        return CONFIG_ERR_TRUNCATED;
+    }
+
+    // Remove trailing linefeeds and carrige returns
+    while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n')) {
+        len--;
+        line[len] = '\0';
+    }
+
+    // Find where the value starts, and replace the K/V delimiter ('=') with
+    // a null terminator.
+    char* value = strchr(line, '=');
+    if (NULL == value) {
+        return CONFIG_ERR_BAD_CONFIG_FILE;
+    }
+    *value = '\0';
+    value++;
+
+    *out_key = line;
+    *out_value = value;
+    return CONFIG_OK;
+}
+
+// Stores a value in the table, recording truncation / missing values.
+static void config_values_set(config_values_t* values, config_key_t key, const char* value) {
+    const size_t length = strlcpy(values->value[key], value, sizeof(values->value[key]));
+    if (length >= sizeof(values->value[key])) {
+        values->state[key] = CONFIG_ERR_TRUNCATED;
+    } else if (0 == length) {
+        values->state[key] = CONFIG_ERR_MISSING_VALUE;
+    } else {
+        values->state[key] = CONFIG_OK;
+    }
+}
+
+// Parses the whole config file into `values` in a single pass. Keys are renamed
+// by any migrations newer than the file's version as they are read, so the
+// table always uses current key names.
+//
+// The version of the file is placed in `out_version`. Files without a valid
+// version are treated as version 0.
+static config_err_t config_load(config_values_t* values, uint16_t* out_version) {
+    for (int i = 0; i < CFG_KEY_N_KEYS; i++) {
+        values->state[i] = CONFIG_ERR_MISSING_KEY;
+        values->value[i][0] = '\0';
     }
 
     // Obtain file system
@@ -123,66 +269,220 @@ static config_err_t config_value_get(config_key_t key, char* out_value, size_t s
         return CONFIG_ERR_MISSING_CONFIG_FILE;
     }
 
-    // Fetch the string for the key we cant to find
-    const char* key_str = config_key_strings[key];
+    char line[CONFIG_MAX_LINE_LENGTH + 1] = {0};
+    char* key = NULL;
+    char* value = NULL;
+    config_err_t ret_val = CONFIG_OK;
+
+    // Renames depend on the file's version, so find that first. It is the first
+    // pair in the file, so this normally only reads the header comments.
+    while (CONFIG_OK == (ret_val = config_line_read(&config_file, fs, line, &key, &value))) {
+        if (NULL != key && CFG_KEY_CONFIG_VERSION == config_key_from_str(key)) {
+            config_values_set(values, CFG_KEY_CONFIG_VERSION, value);
+            break;
+        }
+    }
+    if (CONFIG_ERR_MISSING_KEY == ret_val) {
+        // No version, assume an unversioned file
+        ret_val = CONFIG_OK;
+    }
+    long version_number;
+    if (CONFIG_OK == values->state[CFG_KEY_CONFIG_VERSION] &&
+        strtol_easy(values->value[CFG_KEY_CONFIG_VERSION], &version_number) && version_number >= 0 &&
+        version_number <= UINT16_MAX) {
+        *out_version = (uint16_t)version_number;
+    } else {
+        ESP_LOGW(TAG, "Config has no valid CONFIG_VERSION, assuming version 0");
+        *out_version = 0;
+    }
 
-    // If this never gets updated then the key is missing
-    config_err_t ret_val = CONFIG_ERR_MISSING_KEY;
+    // Then read every pair in one pass
+    if (CONFIG_OK == ret_val && 0 > lfs_file_rewind(fs, &config_file)) {
+        ret_val = CONFIG_ERR_FILE_SYSTEM;
+    }
+    while (CONFIG_OK == ret_val && CONFIG_OK == (ret_val = config_line_read(&config_file, fs, line, &key, &value))) {
+        if (NULL == key) {
+            continue;
+        }
+        // The first occurrence of a key wins
+        const config_key_t k = config_key_from_str(config_migration_resolve(key, *out_version));
+        if (CFG_KEY_N_KEYS != k && CONFIG_ERR_MISSING_KEY == values->state[k]) {
+            config_values_set(values, k, value);
+        }
+    }
+    if (CONFIG_ERR_MISSING_KEY == ret_val) {
+        // Reached the end of the file
+        ret_val = CONFIG_OK;
+    }
 
-    // Read config line by line
-    char line[CONFIG_MAX_LINE_LENGTH + 1] = {0};
+    // Close the file
+    lfs_file_close(fs, &config_file);
+
+    // Return the file system
+    fs_unlock(fs);
+
+    return ret_val;
+}
+
+// Attempts to read the value of a given key from the loaded config. The value
+// is only valid if the function returns CONFIG_OK.
+//
+// On success, up to `size` bytes will be copied to `out_value`, which will
+// be null terminated for any `size` greater than zero. Size is recommended to
+// be at least CONFIG_MAX_VALUE_LENGTH + 1.
+//
+// On failure, a relevant error code will be returned. The value in `out_value`
+// must be ignored.
+static config_err_t config_value_get(config_key_t key, char* out_value, size_t size) {
+    // Validate the key
+    if (0 > key || key >= CFG_KEY_N_KEYS) {
+        return CONFIG_ERR_INVALID_ARG;
+    }
+
+    if (NULL == config_values) {
+        return CONFIG_ERR_FILE_SYSTEM;
+    }
 
-    while (NULL != fs_fgets(line, CONFIG_MAX_LINE_LENGTH, &config_file, fs)) {
-        // Skip empty lines and comments
-        if ('\0' == line[0] || '#' == line[0] || ';' == line[0] || '\n' == line[0]) {
+    if (CONFIG_OK != config_values->state[key]) {
+        return config_values->state[key];
+    }
+
+    if (strlcpy(out_value, config_values->value[key], size) >= size) {
+        return CONFIG_ERR_TRUNCATED;
+    }
+
+    return CONFIG_OK;
+}
+
+// Applies every migration step newer than `file_version` to the loaded values.
+// Renames have already been applied by config_load().
+//
+// Returns false if a value could not be migrated.
+static bool config_migrate(config_values_t* values, uint16_t file_version) {
+    bool ok = true;
+
+    for (size_t i = 0; i < CONFIG_N_MIGRATIONS; i++) {
+        const config_migration_t* step = &config_migrations[i];
+        if (step->version <= file_version ||
+            (CONFIG_MIGRATION_DEFAULT != step->op && CONFIG_MIGRATION_TRANSFORM != step->op)) {
             continue;
         }
 
-        // Check for truncation
-        size_t len = strlen(line);
-        if (len == (CONFIG_MAX_LINE_LENGTH - 1) && line[len - 1] != '\n') {
-            ret_val = CONFIG_ERR_TRUNCATED;
-            break;
+        // The key may have been renamed again by a later step
+        const config_key_t key = config_key_from_str(config_migration_resolve(step->key, step->version));
+        if (CFG_KEY_N_KEYS == key) {
+            // Key has since been removed
+            continue;
         }
 
-        // Remove trailing linefeeds and carrige returns
-        while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n')) {
-            len--;
-            line[len] = '\0';
+        if (CONFIG_MIGRATION_DEFAULT == step->op && CONFIG_ERR_MISSING_KEY == values->state[key]) {
+            config_values_set(values, key, step->value);
         }
 
-        // Find where the value starts, and replace the K/V delimiter ('=') with
-        // a null terminator.
-        char* value = strchr(line, '=');
-        if (NULL == value) {
-            ret_val = CONFIG_ERR_BAD_CONFIG_FILE;
-            break;
+        if (CONFIG_MIGRATION_TRANSFORM == step->op && CONFIG_OK == values->state[key] &&
+            !step->transform(values->value[key], sizeof(values->value[key]))) {
+            ESP_LOGE(TAG, "Unable to migrate %s to version %u", config_key_strings[key], step->version);
+            values->state[key] = CONFIG_ERR_INVALID_VALUE;
+            ok = false;
         }
-        *value = '\0';
-        value++;
-
-        // Exit loop if we've found the key we're looking for
-        if (0 == strcmp_icase(key_str, line)) {
-            // Copy value out and check for truncation / missing value
-            const size_t key_length = strlcpy(out_value, value, size);
-            if (key_length >= size) {
-                ret_val = CONFIG_ERR_TRUNCATED;
-            } else if (0 == key_length) {
-                ret_val = CONFIG_ERR_MISSING_VALUE;
-            } else {
-                ret_val = CONFIG_OK;
-            }
-            break;
+    }
+
+    // Stamp the new version
+    snprintf(values->value[CFG_KEY_CONFIG_VERSION], sizeof(values->value[CFG_KEY_CONFIG_VERSION]), "%u",
+             CONFIG_CURRENT_VERSION);
+    values->state[CFG_KEY_CONFIG_VERSION] = CONFIG_OK;
+
+    return ok;
+}
+
+static bool config_file_write_str(lfs_t* fs, lfs_file_t* file, const char* str) {
+    const size_t len = strlen(str);
+    return (lfs_ssize_t)len == lfs_file_write(fs, file, str, len);
+}
+
+static bool config_file_write_pair(lfs_t* fs, lfs_file_t* file, const char* key, const char* value) {
+    return config_file_write_str(fs, file, key) && config_file_write_str(fs, file, "=") &&
+           config_file_write_str(fs, file, value) && config_file_write_str(fs, file, "\n");
+}
+
+// Writes the migrated config back to the file system. Comments, unknown keys
+// and ordering are preserved, keys added by migrations are appended.
+//
+// The new config is written to a temporary file which then replaces the old one
+// with a single rename, so a reset part way through leaves the old config
+// intact.
+static bool config_write_back(const config_values_t* values, uint16_t file_version) {
+    lfs_t* fs = fs_get_and_lock(portMAX_DELAY);
+    if (NULL == fs) {
+        return false;
+    }
+
+    lfs_file_t in_file = {0};
+    if (0 > lfs_file_open(fs, &in_file, CONFIG_FILE_PATH, LFS_O_RDONLY)) {
+        fs_unlock(fs);
+        return false;
+    }
+
+    lfs_file_t out_file = {0};
+    if (0 > lfs_file_open(fs, &out_file, CONFIG_FILE_TMP_PATH, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC)) {
+        lfs_file_close(fs, &in_file);
+        fs_unlock(fs);
+        return false;
+    }
+
+    bool ok = true;
+    bool written[CFG_KEY_N_KEYS] = {0};
+    char line[CONFIG_MAX_LINE_LENGTH + 1] = {0};
+    char* key = NULL;
+    char* value = NULL;
+    config_err_t err;
+
+    // Copy the file, rewriting known keys
+    while (ok && CONFIG_OK == (err = config_line_read(&in_file, fs, line, &key, &value))) {
+        if (NULL == key) {
+            // A NUL in a comment hides the rest of the line, line break and
+            // all. Put the break back so the next line isn't joined onto it.
+            const size_t len = strlen(line);
+            const bool broken = len < CONFIG_MAX_LINE_LENGTH - 1 && (0 == len || '\n' != line[len - 1]);
+            ok = config_file_write_str(fs, &out_file, line) && (!broken || config_file_write_str(fs, &out_file, "\n"));
+            continue;
+        }
+
+        const config_key_t k = config_key_from_str(config_migration_resolve(key, file_version));
+        if (CFG_KEY_N_KEYS == k) {
+            ok = config_file_write_pair(fs, &out_file, key, value);
+        } else if (!written[k]) {
+            written[k] = true;
+            ok = config_file_write_pair(fs, &out_file, config_key_strings[k],
+                                        CONFIG_OK == values->state[k] ? values->value[k] : value);
         }
     }
+    ok = ok && CONFIG_ERR_MISSING_KEY == err;
 
-    // Close the file
-    lfs_file_close(fs, &config_file);
+    // Append keys added by the migration
+    bool first = true;
+    for (int k = 0; ok && k < CFG_KEY_N_KEYS; k++) {
+        if (written[k] || CONFIG_OK != values->state[k]) {
+            continue;
+        }
+        if (first) {
+            ok = config_file_write_str(fs, &out_file, "\n# Added by config migration\n");
+            first = false;
+        }
+        ok = ok && config_file_write_pair(fs, &out_file, config_key_strings[k], values->value[k]);
+    }
 
-    // Return the file system
-    fs_unlock(fs);
+    lfs_file_close(fs, &in_file);
+    ok = (0 <= lfs_file_close(fs, &out_file)) && ok;
 
-    return ret_val;
+    // Commit
+    ok = ok && 0 <= lfs_rename(fs, CONFIG_FILE_TMP_PATH, CONFIG_FILE_PATH);
+    if (!ok) {
+        lfs_remove(fs, CONFIG_FILE_TMP_PATH);
+    }
+
+    fs_unlock(fs);
+    return ok;
 }
 
 // =============================================================================
@@ -202,6 +502,8 @@ typedef struct interlock_config {
     // WIFI
     char wifi_ssid[CONFIG_MAX_VALUE_LENGTH + 1];
     char wifi_psk[CONFIG_MAX_VALUE_LENGTH + 1];
+    bool wifi_use_static_ip;
+    config_static_ip_t wifi_static_ip;
 
     // LED
     uint16_t led_count;
@@ -269,6 +571,34 @@ static bool config_str_to_u16(const char* str, uint16_t* val) {
     return true;
 }
 
+// Parses a dotted quad IPv4 address into network byte order.
+static bool config_str_to_ip4(const char* str, uint32_t* addr) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        if (str[0] < '0' || str[0] > '9') {
+            return false;
+        }
+        char* end;
+        const unsigned long octet = strtoul(str, &end, 10);
+        if (octet > 255 || end - str > 3 || (3 == i ? '\0' : '.') != *end) {
+            return false;
+        }
+        value |= (uint32_t)octet << (8 * i);
+        str = end + 1;
+    }
+    *addr = value;
+    return true;
+}
+
+// Parses an address that may be left as NONE, which gives 0.
+static bool config_str_to_optional_ip4(const char* str, uint32_t* addr) {
+    if (0 == strcmp_icase(str, "NONE")) {
+        *addr = 0;
+        return true;
+    }
+    return config_str_to_ip4(str, addr);
+}
+
 static void config_read_From_file_log_error(config_key_t key, config_err_t err) {
     ESP_LOGE(TAG, "Error reading config value for %s: %s", config_key_strings[key], config_err_to_str(err));
 }
@@ -281,6 +611,17 @@ static void config_read_from_file_helper(config_key_t key, char* buffer, size_t
     }
 }
 
+// As config_read_from_file_helper(), for a key that may be left out. A missing
+// key reads as `default_value`.
+static void config_read_optional_from_file_helper(config_key_t key, char* buffer, size_t buffer_size,
+                                                  const char* default_value, uint32_t* status) {
+    if (CONFIG_ERR_MISSING_KEY == config_value_get(key, buffer, buffer_size)) {
+        strlcpy(buffer, default_value, buffer_size);
+        return;
+    }
+    config_read_from_file_helper(key, buffer, buffer_size, status);
+}
+
 // Returns true if the config was successfully read.
 static bool config_read_from_file(interlock_config_t* config) {
     uint32_t status = 0;                             // Bit field of errors
@@ -317,6 +658,34 @@ static bool config_read_from_file(interlock_config_t* config) {
     // Wifi PSK
     config_read_from_file_helper(CFG_KEY_WIFI_PSK, config->wifi_psk, sizeof(config->wifi_psk), &status);
 
+    // Wifi static IP, or DHCP. A static IP needs a netmask and gateway, the DNS
+    // server defaults to the gateway. The keys are optional: without them the
+    // address comes from DHCP.
+    config_static_ip_t* static_ip = &config->wifi_static_ip;
+    config_read_optional_from_file_helper(CFG_KEY_WIFI_IP, buffer, sizeof(buffer), "DHCP", &status);
+    if (0 == strcmp_icase(buffer, "DHCP")) {
+        config->wifi_use_static_ip = false;
+    } else if (config_str_to_ip4(buffer, &static_ip->ip)) {
+        config->wifi_use_static_ip = true;
+    } else {
+        config_read_From_file_log_error(CFG_KEY_WIFI_IP, CONFIG_ERR_INVALID_ARG);
+        status |= CONFIG_ERR_INVALID_ARG;
+    }
+
+    const config_key_t address_keys[] = {CFG_KEY_WIFI_NETMASK, CFG_KEY_WIFI_GATEWAY, CFG_KEY_WIFI_DNS};
+    uint32_t* addresses[] = {&static_ip->netmask, &static_ip->gateway, &static_ip->dns};
+    for (size_t i = 0; i < sizeof(address_keys) / sizeof(address_keys[0]); i++) {
+        config_read_optional_from_file_helper(address_keys[i], buffer, sizeof(buffer), "NONE", &status);
+        const bool required = config->wifi_use_static_ip && CFG_KEY_WIFI_DNS != address_keys[i];
+        if (!config_str_to_optional_ip4(buffer, addresses[i]) || (required && 0 == *addresses[i])) {
+            config_read_From_file_log_error(address_keys[i], CONFIG_ERR_INVALID_ARG);
+            status |= CONFIG_ERR_INVALID_ARG;
+        }
+    }
+    if (0 == static_ip->dns) {
+        static_ip->dns = static_ip->gateway;
+    }
+
     // LED count
     config_read_from_file_helper(CFG_KEY_LED_COUNT, buffer, sizeof(buffer), &status);
     if (!config_str_to_u16(buffer, &config->led_count)) {
@@ -339,12 +708,12 @@ static bool config_read_from_file(interlock_config_t* config) {
     }
 
     // RFID skeleton card
-    long skeleton_card;
+    rfid_number_t skeleton_card;
     config_read_from_file_helper(CFG_KEY_RFID_SKELETON_CARD, buffer, sizeof(buffer), &status);
     if (0 == strcmp_icase(buffer, "NONE")) {
         config->rfid_use_skeleton_card = false;
         config->skeleton_card = UINT64_MAX;
-    } else if (strtol_easy(buffer, &skeleton_card) && skeleton_card > 0) {
+    } else if (rfid_number_from_str(buffer, &skeleton_card) && skeleton_card > 0) {
         config->rfid_use_skeleton_card = true;
         config->skeleton_card = skeleton_card;
     } else {
@@ -367,8 +736,174 @@ static bool config_read_from_file(interlock_config_t* config) {
 
 static interlock_config_t config = {0};
 
+// Loads, migrates and validates the config file into `out_config`.
+static bool config_load_from_file(interlock_config_t* out_config) {
+    config_values = calloc(1, sizeof(config_values_t));
+    if (NULL == config_values) {
+        ESP_LOGE(TAG, "Unable to allocate memory for the config");
+        return false;
+    }
+
+    // Load the file
+    uint16_t file_version = 0;
+    const config_err_t err = config_load(config_values, &file_version);
+    bool ok = CONFIG_OK == err;
+    if (!ok) {
+        ESP_LOGE(TAG, "Unable to load the config file: %s", config_err_to_str(err));
+    }
+
+    if (ok && file_version > CONFIG_CURRENT_VERSION) {
+        ESP_LOGE(TAG, "Config version %u is newer than this firmware supports (%u)", file_version,
+                 CONFIG_CURRENT_VERSION);
+        ok = false;
+    }
+
+    // Upgrade old configs
+    const bool needs_migration = ok && file_version < CONFIG_CURRENT_VERSION;
+    if (needs_migration) {
+        ESP_LOGI(TAG, "Migrating config from version %u to %u", file_version, CONFIG_CURRENT_VERSION);
+        ok = config_migrate(config_values, file_version);
+    }
+
+    ok = ok && config_read_from_file(out_config);
+
+    // Only persist the migration once we know the result is valid
+    if (ok && needs_migration && CONFIG_WRITE_BACK_MIGRATIONS) {
+        if (config_write_back(config_values, file_version)) {
+            ESP_LOGI(TAG, "Migrated config written back");
+        } else {
+            ESP_LOGW(TAG, "Unable to write back the migrated config. It will be migrated again next boot.");
+        }
+    }
+
+    free(config_values);
+    config_values = NULL;
+
+    return ok;
+}
+
 bool config_init() {
-    return config_read_from_file(&config);
+    return config_load_from_file(&config);
+}
+
+bool config_verify(void) {
+    interlock_config_t* from_file = malloc(sizeof(interlock_config_t));
+    if (NULL == from_file) {
+        return false;
+    }
+
+    const bool ok = config_load_from_file(from_file) && 0 == memcmp(from_file, &config, sizeof(config));
+
+    free(from_file);
+    return ok;
+}
+
+// =============================================================================
+// Snapshots
+// =============================================================================
+
+// The fixed size part of a snapshot. Strings follow it, each null terminated.
+typedef struct config_snapshot {
+    device_type_t device_type;
+    uint16_t portal_port;
+    uint16_t led_count;
+    led_type_t led_type;
+    rfid_reader_type_t rfid_reader_type;
+    bool rfid_use_skeleton_card;
+    rfid_number_t skeleton_card;
+    bool wifi_use_static_ip;
+    config_static_ip_t wifi_static_ip;
+} config_snapshot_t;
+
+// Appends `str` to the snapshot buffer. Returns false if it doesn't fit.
+static bool config_snapshot_put_str(uint8_t* buffer, size_t size, size_t* offset, const char* str) {
+    const size_t length = strlen(str) + 1;
+    if (*offset + length > size) {
+        return false;
+    }
+    memcpy(buffer + *offset, str, length);
+    *offset += length;
+    return true;
+}
+
+// Reads a string from the snapshot buffer into `dst`. Returns false if the
+// string is unterminated or doesn't fit.
+static bool config_snapshot_get_str(const uint8_t* buffer, size_t size, size_t* offset, char* dst, size_t dsize) {
+    const uint8_t* end = memchr(buffer + *offset, '\0', size - *offset);
+    if (NULL == end) {
+        return false;
+    }
+    const size_t length = end - (buffer + *offset) + 1;
+    if (length > dsize) {
+        return false;
+    }
+    memcpy(dst, buffer + *offset, length);
+    *offset += length;
+    return true;
+}
+
+size_t config_snapshot_save(uint8_t* buffer, size_t size) {
+    if (size < sizeof(config_snapshot_t)) {
+        return 0;
+    }
+
+    const config_snapshot_t snapshot = {
+        .device_type = config.device_type,
+        .portal_port = config.portal_port,
+        .led_count = config.led_count,
+        .led_type = config.led_type,
+        .rfid_reader_type = config.rfid_reader_type,
+        .rfid_use_skeleton_card = config.rfid_use_skeleton_card,
+        .skeleton_card = config.skeleton_card,
+        .wifi_use_static_ip = config.wifi_use_static_ip,
+        .wifi_static_ip = config.wifi_static_ip,
+    };
+    memcpy(buffer, &snapshot, sizeof(snapshot));
+
+    size_t offset = sizeof(snapshot);
+    const bool ok = config_snapshot_put_str(buffer, size, &offset, config.device_name) &&
+                    config_snapshot_put_str(buffer, size, &offset, config.portal_address) &&
+                    config_snapshot_put_str(buffer, size, &offset, config.portal_api_key) &&
+                    config_snapshot_put_str(buffer, size, &offset, config.wifi_ssid) &&
+                    config_snapshot_put_str(buffer, size, &offset, config.wifi_psk);
+
+    return ok ? offset : 0;
+}
+
+bool config_snapshot_restore(const uint8_t* buffer, size_t size) {
+    if (size < sizeof(config_snapshot_t)) {
+        return false;
+    }
+
+    config_snapshot_t snapshot;
+    memcpy(&snapshot, buffer, sizeof(snapshot));
+
+    // Zeroed the same way as config_read_from_file() so config_verify() can
+    // compare the structs directly.
+    interlock_config_t restored;
+    memset(&restored, 0, sizeof(restored));
+    restored.device_type = snapshot.device_type;
+    restored.portal_port = snapshot.portal_port;
+    restored.led_count = snapshot.led_count;
+    restored.led_type = snapshot.led_type;
+    restored.rfid_reader_type = snapshot.rfid_reader_type;
+    restored.rfid_use_skeleton_card = snapshot.rfid_use_skeleton_card;
+    restored.skeleton_card = snapshot.skeleton_card;
+    restored.wifi_use_static_ip = snapshot.wifi_use_static_ip;
+    restored.wifi_static_ip = snapshot.wifi_static_ip;
+
+    size_t offset = sizeof(snapshot);
+    const bool ok =
+        config_snapshot_get_str(buffer, size, &offset, restored.device_name, sizeof(restored.device_name)) &&
+        config_snapshot_get_str(buffer, size, &offset, restored.portal_address, sizeof(restored.portal_address)) &&
+        config_snapshot_get_str(buffer, size, &offset, restored.portal_api_key, sizeof(restored.portal_api_key)) &&
+        config_snapshot_get_str(buffer, size, &offset, restored.wifi_ssid, sizeof(restored.wifi_ssid)) &&
+        config_snapshot_get_str(buffer, size, &offset, restored.wifi_psk, sizeof(restored.wifi_psk));
+
+    if (ok) {
+        config = restored;
+    }
+    return ok;
 }
 
 // =============================================================================
@@ -403,6 +938,13 @@ const char* config_get_wifi_psk(void) {
     return config.wifi_psk;
 }
 
+bool config_get_wifi_static_ip(config_static_ip_t* out_static_ip) {
+    if (config.wifi_use_static_ip) {
+        *out_static_ip = config.wifi_static_ip;
+    }
+    return config.wifi_use_static_ip;
+}
+
 uint16_t config_get_led_count(void) {
     return config.led_count;
 }
@@ -18,6 +18,10 @@ typedef enum config_key {
     CFG_KEY_PORTAL_PORT,
     CFG_KEY_RFID_READER_TYPE,
     CFG_KEY_RFID_SKELETON_CARD,
+    CFG_KEY_WIFI_DNS,
+    CFG_KEY_WIFI_GATEWAY,
+    CFG_KEY_WIFI_IP,
+    CFG_KEY_WIFI_NETMASK,
     CFG_KEY_WIFI_PSK,
     CFG_KEY_WIFI_SSID,
     CFG_KEY_N_KEYS  // Sentinel, must be last.
@@ -38,6 +42,15 @@ typedef enum config_err {
 
 const char* config_err_to_str(config_err_t err);
 
+// A fixed IPv4 configuration, used instead of DHCP. Addresses are in network
+// byte order.
+typedef struct config_static_ip {
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gateway;
+    uint32_t dns;
+} config_static_ip_t;
+
 // =============================================================================
 // Interface
 // =============================================================================
@@ -52,6 +65,24 @@ const char* config_err_to_str(config_err_t err);
 // Returns true on success, false otherwise.
 bool config_init(void);
 
+// Re-reads the config from the file system and checks it matches the config in
+// use (e.g. one restored from a snapshot).
+//
+// Returns true if they match, false if they differ or the file can't be read.
+bool config_verify(void);
+
+// Serialises the config in use into `buffer` so it can be restored without the
+// file system, e.g. after a warm boot.
+//
+// Returns the number of bytes used, or 0 if the config does not fit in `size`.
+size_t config_snapshot_save(uint8_t* buffer, size_t size);
+
+// Restores the config from a snapshot made by config_snapshot_save(). This can
+// be used in place of config_init().
+//
+// Returns true on success. On failure the config in use is unchanged.
+bool config_snapshot_restore(const uint8_t* buffer, size_t size);
+
 // Device
 device_type_t config_get_device_type(void);
 const char* config_get_device_name(void);
@@ -65,6 +96,10 @@ uint16_t config_get_portal_port(void);
 const char* config_get_wifi_ssid(void);
 const char* config_get_wifi_psk(void);
 
+// Returns true, with the addresses in `out_static_ip`, if WIFI_IP is an address
+// rather than DHCP.
+bool config_get_wifi_static_ip(config_static_ip_t* out_static_ip);
+
 // LED
 uint16_t config_get_led_count(void);
 led_type_t config_get_led_type(void);
@@ -2,6 +2,8 @@
 #include <ctype.h>
 #include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 // =============================================================================
 // Misc. Helpers
@@ -33,8 +35,10 @@ size_t strlcpy(char* dst, const char* src, size_t dsize) {
     }
 
     if (nleft == 0) {
-        if (dsize != 0) {}
-        *dst = '\0';
+        // Nothing can be written to a zero length buffer
+        if (dsize != 0) {
+            *dst = '\0';
+        }
         while (*src++) {
             // NOP
         }
@@ -81,3 +85,144 @@ bool strtol_easy(const char* str, long* result) {
     *result = acc;
     return true;
 }
+
+uint32_t crc32_update(uint32_t crc, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    crc = ~crc;
+    while (size--) {
+        crc ^= *bytes++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// Writes the digits backwards from the end of `buf` and returns where they
+// start. 64 bit division is done in software, so it's only used until the rest
+// fits in 32 bits.
+static char* dec64_format(uint64_t magnitude, bool negative, char* buf) {
+    char* out = buf + DEC64_SIZE - 1;
+    *out = '\0';
+    while (magnitude > UINT32_MAX) {
+        *--out = '0' + magnitude % 10;
+        magnitude /= 10;
+    }
+    uint32_t rest = magnitude;
+    do {
+        *--out = '0' + rest % 10;
+        rest /= 10;
+    } while (0 != rest);
+    if (negative) {
+        *--out = '-';
+    }
+    return out;
+}
+
+char* u64_to_dec(uint64_t value, char* buf) {
+    return dec64_format(value, false, buf);
+}
+
+char* i64_to_dec(int64_t value, char* buf) {
+    // Negated as unsigned so INT64_MIN doesn't overflow
+    return dec64_format(value < 0 ? 0 - (uint64_t)value : (uint64_t)value, value < 0, buf);
+}
+
+// =============================================================================
+// RFID Helpers
+// =============================================================================
+
+// Card numbers are decoded a word at a time. Four ASCII characters are loaded
+// into a uint32_t (first character in the low byte), validated together and
+// then combined with a couple of multiplies, rather than a compare and
+// multiply per character. The LX106 has no 64 bit multiplier, so cutting the
+// number of 64 bit multiply-adds by four matters.
+
+// True if all four bytes of `chunk` are ASCII '0'-'9'.
+static inline bool rfid_chunk_is_dec(uint32_t chunk) {
+    // High nibble of each byte must be 3, and adding 6 must not carry out of
+    // the low nibble (i.e. it is at most 9).
+    return 0x33333333 == ((chunk & 0xF0F0F0F0) | (((chunk + 0x06060606) & 0xF0F0F0F0) >> 4));
+}
+
+// Converts four validated ASCII digits to their value (0-9999).
+static inline uint32_t rfid_chunk_dec_value(uint32_t chunk) {
+    chunk -= 0x30303030;
+    chunk = ((chunk * 10) + (chunk >> 8)) & 0x00FF00FF;  // Two 2 digit values
+    return ((chunk & 0xFF) * 100) + (chunk >> 16);
+}
+
+bool rfid_number_from_dec(const char* str, size_t len, rfid_number_t* out) {
+    if (NULL == str || NULL == out || 0 == len) {
+        return false;
+    }
+
+    rfid_number_t acc = 0;
+
+    // Leading digits so the rest is a whole number of chunks
+    const size_t head = len % 4;
+    for (size_t i = 0; i < head; i++) {
+        const uint32_t digit = (uint8_t)str[i] - '0';
+        if (digit > 9) {
+            return false;
+        }
+        acc = (acc * 10) + digit;
+    }
+
+    // Four digits at a time
+    for (size_t i = head; i < len; i += 4) {
+        uint32_t chunk;
+        memcpy(&chunk, str + i, sizeof(chunk));
+        if (!rfid_chunk_is_dec(chunk)) {
+            return false;
+        }
+
+        const uint32_t value = rfid_chunk_dec_value(chunk);
+        if (acc > (UINT64_MAX - value) / 10000) {
+            return false;  // Overflow
+        }
+        acc = (acc * 10000) + value;
+    }
+
+    *out = acc;
+    return true;
+}
+
+bool rfid_number_from_hex(const char* str, size_t len, rfid_number_t* out) {
+    if (NULL == str || NULL == out || 0 == len) {
+        return false;
+    }
+
+    rfid_number_t acc = 0;
+    bool valid = true;
+    for (size_t i = 0; i < len; i++) {
+        const uint8_t c = (uint8_t)str[i];
+        const uint32_t digit = c - '0';
+        const uint32_t alpha = (c | 0x20) - 'a';  // Folds case
+        const bool is_digit = digit < 10;
+        const bool is_alpha = alpha < 6;
+
+        // Anything that would be shifted out of the top is an overflow
+        valid &= (is_digit | is_alpha) && 0 == (acc >> 60);
+        acc = (acc << 4) | (is_digit ? digit : alpha + 10);
+    }
+
+    if (!valid) {
+        return false;
+    }
+
+    *out = acc;
+    return true;
+}
+
+bool rfid_number_from_str(const char* str, rfid_number_t* out) {
+    if (NULL == str) {
+        return false;
+    }
+
+    if ('0' == str[0] && ('x' == str[1] || 'X' == str[1])) {
+        return rfid_number_from_hex(str + 2, strlen(str + 2), out);
+    }
+
+    return rfid_number_from_dec(str, strlen(str), out);
+}
@@ -50,4 +50,45 @@ size_t strlcpy(char *dst, const char *src, size_t dsize);
 // false the the result is invalid and can not be used.
 bool strtol_easy(const char* str, long *result);
 
+// CRC-32 (IEEE 802.3) of `size` bytes at `data`.
+//
+// To checksum data in pieces, pass the result of the previous call as `crc`.
+// Start with a `crc` of 0.
+uint32_t crc32_update(uint32_t crc, const void* data, size_t size);
+
+// Room for any 64 bit value in decimal, with its sign and terminator
+#define DEC64_SIZE 21
+
+// Formats `value` in decimal into `buf`, which must hold DEC64_SIZE chars.
+// Returns the start of the string, which is somewhere inside `buf`.
+//
+// newlib nano's printf (CONFIG_NEWLIB_NANO_FORMAT) can't format 64 bit values,
+// and %lld/%llu also throw off every argument after them. Format them with
+// these and print the result with %s.
+char* u64_to_dec(uint64_t value, char* buf);
+char* i64_to_dec(int64_t value, char* buf);
+
+// As above, formatting into a temporary that lasts until the end of the
+// enclosing block, so they can be used directly as printf arguments:
+//
+//   ESP_LOGI(TAG, "Took %s us", I64_DEC(time));
+#define U64_DEC(value) u64_to_dec((value), (char[DEC64_SIZE]){0})
+#define I64_DEC(value) i64_to_dec((value), (char[DEC64_SIZE]){0})
+
+// =============================================================================
+// RFID Helpers
+// =============================================================================
+
+// Decodes exactly `len` decimal digits from `str` into `out`. `str` does not
+// need to be null terminated, so this can be used directly on reader frames.
+//
+// Returns false for empty input, any non-digit character, or a value that does
+// not fit in an rfid_number_t. `out` is only written on success.
+bool rfid_number_from_dec(const char* str, size_t len, rfid_number_t* out);
+
+// As rfid_number_from_dec(), but for hex digits (either case, no prefix).
+bool rfid_number_from_hex(const char* str, size_t len, rfid_number_t* out);
 
+// Decodes a null terminated card number. Numbers prefixed with "0x" or "0X"
+// are hex, anything else is decimal.
+bool rfid_number_from_str(const char* str, rfid_number_t* out);
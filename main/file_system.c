@@ -7,6 +7,7 @@
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "lfs.h"
 #include "projdefs.h"
 #include "spi_flash.h"
@@ -47,20 +48,40 @@ static uint32_t fs_lookahead_buffer[FS_LOOKAHEAD_SIZE / sizeof(uint32_t)] = {0};
 // LittleFS HAL
 // =============================================================================
 
+// Only written by the HAL, which LittleFS calls with fs_mutex held
+static fs_stats_t fs_stats = {0};
+
 static int fs_hal_read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size) {
     const size_t addr = FS_PARTITION_OFFSET + (block * FS_BLOCK_SIZE) + off;
-    return spi_flash_read(addr, buffer, size) == ESP_OK ? 0 : -1;
+    fs_stats.reads++;
+    fs_stats.read_bytes += size;
+    if (spi_flash_read(addr, buffer, size) != ESP_OK) {
+        fs_stats.errors++;
+        return -1;
+    }
+    return 0;
 }
 
 static int fs_hal_prog(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer,
                        lfs_size_t size) {
     const size_t addr = FS_PARTITION_OFFSET + (block * FS_BLOCK_SIZE) + off;
-    return spi_flash_write(addr, buffer, size) == ESP_OK ? 0 : -1;
+    fs_stats.writes++;
+    fs_stats.write_bytes += size;
+    if (spi_flash_write(addr, buffer, size) != ESP_OK) {
+        fs_stats.errors++;
+        return -1;
+    }
+    return 0;
 }
 
 static int fs_hal_erase(const struct lfs_config* c, lfs_block_t block) {
     const size_t sector = FS_FIRST_BLOCK + block;
-    return spi_flash_erase_sector(sector) == ESP_OK ? 0 : -1;
+    fs_stats.erases++;
+    if (spi_flash_erase_sector(sector) != ESP_OK) {
+        fs_stats.errors++;
+        return -1;
+    }
+    return 0;
 }
 
 static int fs_hal_sync(const struct lfs_config* c) {
@@ -125,6 +146,10 @@ bool fs_init(const char** out_status) {
 
 lfs_t* fs_get_and_lock(TickType_t max_delay) {
     lfs_t* fs = NULL;
+    if (NULL == fs_mutex) {
+        // fs_init() hasn't been called yet (e.g. during a warm boot)
+        return NULL;
+    }
     if (pdPASS == xSemaphoreTake(fs_mutex, max_delay)) {
         fs = &filesystem;
         if (!filesystem_mounted) {
@@ -141,6 +166,12 @@ void fs_unlock(lfs_t* fs) {
     }
 }
 
+void fs_get_stats(fs_stats_t* out_stats) {
+    taskENTER_CRITICAL();
+    *out_stats = fs_stats;
+    taskEXIT_CRITICAL();
+}
+
 char* fs_fgets(char* buffer, size_t size, lfs_file_t* file, lfs_t* fs) {
     if (0 == size) {
         return NULL;
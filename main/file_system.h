@@ -4,6 +4,16 @@
 
 #include "freertos/FreeRTOS.h"
 
+// Flash operations made on behalf of the file system, since boot
+typedef struct fs_stats {
+    uint32_t reads;
+    uint32_t read_bytes;
+    uint32_t writes;
+    uint32_t write_bytes;
+    uint32_t erases;  // 4 KB sectors
+    uint32_t errors;  // Operations the flash driver failed
+} fs_stats_t;
+
 // Initialises the file system, handles mounting, etc.
 //
 // If `out_status` is not NULL, a human readble status will be placed there.
@@ -14,7 +24,7 @@ bool fs_init(const char** out_status);
 // Obtain the file system and lock the mutex. When the caller is done with the
 // file system it must return it using fs_unlock.
 //
-// Must only be called after fs_init()
+// Returns NULL if called before fs_init().
 //
 // Will return NULL on failure (file system not available or mutex timed out).
 lfs_t* fs_get_and_lock(TickType_t max_delay);
@@ -22,6 +32,9 @@ lfs_t* fs_get_and_lock(TickType_t max_delay);
 // Release the file system mutex. Does nothing if NULL is passed to `fs`.
 void fs_unlock(lfs_t* fs);
 
+// Gets a copy of the flash operation counters.
+void fs_get_stats(fs_stats_t* out_stats);
+
 // fgets style function designed to work with LittleFS.
 // Supports LF/CRLF/CR line endings, but will always convert to LF endings (only 
 // a single '\n' will appear at the end of the buffer).
@@ -0,0 +1,76 @@
+#include "health.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "network.h"
+
+#define TAG "health"
+
+// =============================================================================
+// State
+// =============================================================================
+
+static TaskHandle_t health_tasks[HEALTH_TASKS_MAX] = {0};
+static uint8_t health_task_count = 0;
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+void health_watch_task(TaskHandle_t task) {
+    taskENTER_CRITICAL();
+    if (health_task_count < HEALTH_TASKS_MAX) {
+        health_tasks[health_task_count++] = task;
+    }
+    taskEXIT_CRITICAL();
+}
+
+void health_get(health_t* out_health) {
+    out_health->uptime_s = esp_timer_get_time() / 1000000;
+    out_health->heap_free = esp_get_free_heap_size();
+    out_health->heap_min = esp_get_minimum_free_heap_size();
+    if (!network_get_rssi(&out_health->rssi)) {
+        out_health->rssi = 0;
+    }
+    network_get_stats(&out_health->wifi);
+    fs_get_stats(&out_health->flash);
+    access_get_stats(&out_health->access);
+    card_cache_get_stats(&out_health->cache);
+    out_health->time_s = wall_clock_now() / 1000000;
+    wall_clock_get_stats(&out_health->clock);
+
+    // Stacks are in bytes on the ESP8266
+    out_health->stack_count = health_task_count;
+    for (uint8_t i = 0; i < out_health->stack_count; i++) {
+        out_health->stacks[i].name = pcTaskGetName(health_tasks[i]);
+        out_health->stacks[i].free = uxTaskGetStackHighWaterMark(health_tasks[i]);
+    }
+}
+
+void health_log(void) {
+    health_t health;
+    health_get(&health);
+
+    const health_stack_t* tightest = NULL;
+    for (uint8_t i = 0; i < health.stack_count; i++) {
+        if (NULL == tightest || health.stacks[i].free < tightest->free) {
+            tightest = &health.stacks[i];
+        }
+    }
+
+    ESP_LOGI(TAG, "Up %u s, heap %u (lowest %u), RSSI %d (%u roams, ~%u mA), flash %u reads %u writes %u "
+             "erases, %u cards (last %u ms, cache hit %u of %u, saving %s ms)",
+             health.uptime_s, health.heap_free, health.heap_min, health.rssi, health.wifi.roams,
+             health.wifi.current_ua / 1000, health.flash.reads, health.flash.writes, health.flash.erases,
+             health.access.decisions, health.access.latency_last_us / 1000, health.cache.hits,
+             health.cache.hits + health.cache.misses, U64_DEC(health.cache.saved_us / 1000));
+    if (NULL != tightest) {
+        ESP_LOGI(TAG, "Least stack spare: %s, %u bytes", tightest->name, tightest->free);
+    }
+}
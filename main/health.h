@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "access.h"
+#include "card_cache.h"
+#include "file_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "network.h"
+#include "wall_clock.h"
+
+// =============================================================================
+// Health
+// =============================================================================
+//
+// Gathers the numbers that show a device degrading before it fails: heap,
+// stack and WiFi headroom, flash traffic and how long access decisions take.
+// The portal client sends them as a heartbeat.
+
+// Most tasks that can be watched
+#define HEALTH_TASKS_MAX 10
+
+typedef struct health_stack {
+    const char* name;
+    uint32_t free;  // Least stack, in bytes, the task has ever had spare
+} health_stack_t;
+
+typedef struct health {
+    uint32_t uptime_s;
+    uint32_t heap_free;
+    uint32_t heap_min;  // Lowest heap_free since boot
+    int8_t rssi;        // Of the AP, 0 if not connected
+    network_stats_t wifi;
+    fs_stats_t flash;
+    access_stats_t access;
+    card_cache_stats_t cache;
+    uint32_t time_s;  // UTC, 0 if not known yet
+    wall_clock_stats_t clock;
+    uint8_t stack_count;
+    health_stack_t stacks[HEALTH_TASKS_MAX];
+} health_t;
+
+// Adds a task whose stack high water mark is reported. Only for tasks that
+// never end.
+void health_watch_task(TaskHandle_t task);
+
+// Takes a snapshot of the device's health.
+void health_get(health_t* out_health);
+
+// Logs a one line summary of health_get().
+void health_log(void);
@@ -0,0 +1,383 @@
+#include "json_stream.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// =============================================================================
+// States
+// =============================================================================
+
+typedef enum json_stream_state {
+    JSON_STATE_VALUE,         // Expecting a value
+    JSON_STATE_VALUE_OR_END,  // After '[', expecting a value or ']'
+    JSON_STATE_KEY,           // After ',' in an object
+    JSON_STATE_KEY_OR_END,    // After '{', expecting a key or '}'
+    JSON_STATE_COLON,
+    JSON_STATE_COMMA_OR_END,  // After a value in a container
+    JSON_STATE_STRING,
+    JSON_STATE_ESCAPE,        // After a '\' in a string
+    JSON_STATE_UNICODE,       // In the digits of a \u escape
+    JSON_STATE_NUMBER,
+    JSON_STATE_LITERAL,
+    JSON_STATE_DONE,          // The top level value is complete
+    JSON_STATE_ERROR,
+} json_stream_state_t;
+
+// =============================================================================
+// Helpers
+// =============================================================================
+
+static bool json_stream_emit(json_stream_t* s, json_token_type_t type, const char* value, size_t length,
+                             bool truncated) {
+    const json_token_t token = {
+        .type = type,
+        .depth = s->depth,
+        .value = value,
+        .length = length,
+        .truncated = truncated,
+    };
+
+    if (!s->callback(s->ctx, &token)) {
+        s->state = JSON_STATE_ERROR;
+        return false;
+    }
+    return true;
+}
+
+static void json_stream_append(json_stream_t* s, const char* data, size_t size) {
+    const size_t space = sizeof(s->value) - s->length;
+    if (size > space) {
+        size = space;
+        s->truncated = true;
+    }
+    memcpy(&s->value[s->length], data, size);
+    s->length += size;
+}
+
+// Emits a string or number ending at `end` in the current piece. If parts of it
+// were copied the rest is appended, otherwise it is passed in place.
+static bool json_stream_emit_value(json_stream_t* s, json_token_type_t type, const char* start, const char* end) {
+    if (!s->copying) {
+        return json_stream_emit(s, type, start, end - start, false);
+    }
+    json_stream_append(s, start, end - start);
+    return json_stream_emit(s, type, s->value, s->length, s->truncated);
+}
+
+static void json_stream_value_done(json_stream_t* s) {
+    s->state = 0 == s->depth ? JSON_STATE_DONE : JSON_STATE_COMMA_OR_END;
+}
+
+static bool json_stream_in_object(const json_stream_t* s) {
+    return s->objects & (1u << (s->depth - 1));
+}
+
+static void json_stream_push(json_stream_t* s, bool object) {
+    if (JSON_STREAM_MAX_DEPTH == s->depth) {
+        s->state = JSON_STATE_ERROR;
+        return;
+    }
+    if (!json_stream_emit(s, object ? JSON_TOKEN_OBJECT_START : JSON_TOKEN_ARRAY_START, NULL, 0, false)) {
+        return;
+    }
+
+    if (object) {
+        s->objects |= 1u << s->depth;
+    } else {
+        s->objects &= ~(1u << s->depth);
+    }
+    s->depth++;
+    s->state = object ? JSON_STATE_KEY_OR_END : JSON_STATE_VALUE_OR_END;
+}
+
+static void json_stream_pop(json_stream_t* s) {
+    const bool object = json_stream_in_object(s);
+    s->depth--;
+    if (json_stream_emit(s, object ? JSON_TOKEN_OBJECT_END : JSON_TOKEN_ARRAY_END, NULL, 0, false)) {
+        json_stream_value_done(s);
+    }
+}
+
+static void json_stream_start_scalar(json_stream_t* s, json_stream_state_t state) {
+    s->state = state;
+    s->copying = false;
+    s->truncated = false;
+    s->length = 0;
+}
+
+static void json_stream_start_value(json_stream_t* s, char c) {
+    switch (c) {
+        case '{':
+            json_stream_push(s, true);
+            break;
+        case '[':
+            json_stream_push(s, false);
+            break;
+        case '"':
+            s->string_is_key = false;
+            json_stream_start_scalar(s, JSON_STATE_STRING);
+            break;
+        case 't':
+            s->literal = "true";
+            s->literal_type = JSON_TOKEN_TRUE;
+            s->literal_index = 1;
+            s->state = JSON_STATE_LITERAL;
+            break;
+        case 'f':
+            s->literal = "false";
+            s->literal_type = JSON_TOKEN_FALSE;
+            s->literal_index = 1;
+            s->state = JSON_STATE_LITERAL;
+            break;
+        case 'n':
+            s->literal = "null";
+            s->literal_type = JSON_TOKEN_NULL;
+            s->literal_index = 1;
+            s->state = JSON_STATE_LITERAL;
+            break;
+        default:
+            if ('-' == c || (c >= '0' && c <= '9')) {
+                json_stream_start_scalar(s, JSON_STATE_NUMBER);
+            } else {
+                s->state = JSON_STATE_ERROR;
+            }
+            break;
+    }
+}
+
+static bool json_stream_is_number_char(char c) {
+    return (c >= '0' && c <= '9') || '-' == c || '+' == c || '.' == c || 'e' == c || 'E' == c;
+}
+
+static bool json_stream_is_space(char c) {
+    return ' ' == c || '\t' == c || '\n' == c || '\r' == c;
+}
+
+// Appends a \u escape as UTF-8. Surrogate pairs are not combined.
+static void json_stream_append_unicode(json_stream_t* s, uint16_t code) {
+    char utf8[3];
+    size_t size;
+    if (code < 0x80) {
+        utf8[0] = code;
+        size = 1;
+    } else if (code < 0x800) {
+        utf8[0] = 0xC0 | (code >> 6);
+        utf8[1] = 0x80 | (code & 0x3F);
+        size = 2;
+    } else {
+        utf8[0] = 0xE0 | (code >> 12);
+        utf8[1] = 0x80 | ((code >> 6) & 0x3F);
+        utf8[2] = 0x80 | (code & 0x3F);
+        size = 3;
+    }
+    json_stream_append(s, utf8, size);
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+void json_stream_init(json_stream_t* stream, json_stream_callback_t callback, void* ctx) {
+    memset(stream, 0, sizeof(*stream));
+    stream->callback = callback;
+    stream->ctx = ctx;
+    stream->state = JSON_STATE_VALUE;
+}
+
+bool json_stream_feed(json_stream_t* s, const char* data, size_t size) {
+    const char* p = data;
+    const char* const end = data + size;
+
+    // Start of the string or number being received, within this piece
+    const char* scalar = data;
+
+    while (p < end && JSON_STATE_ERROR != s->state) {
+        switch (s->state) {
+            case JSON_STATE_STRING: {
+                // Skip straight to the next character that needs attention
+                const char* q = p;
+                while (q < end && '"' != *q && '\\' != *q && (uint8_t)*q >= 0x20) {
+                    q++;
+                }
+                p = q;
+                if (q == end) {
+                    break;
+                }
+
+                if ('"' == *q) {
+                    if (json_stream_emit_value(s, s->string_is_key ? JSON_TOKEN_KEY : JSON_TOKEN_STRING, scalar, q)) {
+                        if (s->string_is_key) {
+                            s->state = JSON_STATE_COLON;
+                        } else {
+                            json_stream_value_done(s);
+                        }
+                    }
+                    p++;
+                } else if ('\\' == *q) {
+                    // Escapes have to be undone, so the rest of the string is copied
+                    json_stream_append(s, scalar, q - scalar);
+                    s->copying = true;
+                    s->state = JSON_STATE_ESCAPE;
+                    p++;
+                } else {
+                    s->state = JSON_STATE_ERROR;
+                }
+                break;
+            }
+
+            case JSON_STATE_ESCAPE: {
+                static const char escapes[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+                const char c = *p++;
+                s->state = JSON_STATE_STRING;
+                scalar = p;
+
+                if ('u' == c) {
+                    s->unicode = 0;
+                    s->unicode_digits = 0;
+                    s->state = JSON_STATE_UNICODE;
+                    break;
+                }
+
+                const char* escape = NULL;
+                for (size_t i = 0; i < sizeof(escapes) - 1; i += 2) {
+                    if (escapes[i] == c) {
+                        escape = &escapes[i + 1];
+                        break;
+                    }
+                }
+                if (NULL == escape) {
+                    s->state = JSON_STATE_ERROR;
+                } else {
+                    json_stream_append(s, escape, 1);
+                }
+                break;
+            }
+
+            case JSON_STATE_UNICODE: {
+                const char c = *p++;
+                const uint8_t digit = (c >= '0' && c <= '9')   ? c - '0'
+                                      : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                                      : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+                                                               : 0xFF;
+                if (0xFF == digit) {
+                    s->state = JSON_STATE_ERROR;
+                    break;
+                }
+
+                s->unicode = (s->unicode << 4) | digit;
+                if (4 == ++s->unicode_digits) {
+                    json_stream_append_unicode(s, s->unicode);
+                    s->state = JSON_STATE_STRING;
+                    scalar = p;
+                }
+                break;
+            }
+
+            case JSON_STATE_NUMBER: {
+                const char* q = p;
+                while (q < end && json_stream_is_number_char(*q)) {
+                    q++;
+                }
+                p = q;
+
+                // The character after a number belongs to whatever follows it
+                if (q != end && json_stream_emit_value(s, JSON_TOKEN_NUMBER, scalar, q)) {
+                    json_stream_value_done(s);
+                }
+                break;
+            }
+
+            case JSON_STATE_LITERAL:
+                if (*p++ != s->literal[s->literal_index++]) {
+                    s->state = JSON_STATE_ERROR;
+                } else if ('\0' == s->literal[s->literal_index]) {
+                    if (json_stream_emit(s, s->literal_type, NULL, 0, false)) {
+                        json_stream_value_done(s);
+                    }
+                }
+                break;
+
+            default: {
+                const char c = *p++;
+                if (json_stream_is_space(c)) {
+                    break;
+                }
+
+                switch (s->state) {
+                    case JSON_STATE_VALUE_OR_END:
+                        if (']' == c) {
+                            json_stream_pop(s);
+                            break;
+                        }
+                        // fall through
+                    case JSON_STATE_VALUE:
+                        scalar = p - 1;
+                        if ('"' == c) {
+                            scalar = p;
+                        }
+                        json_stream_start_value(s, c);
+                        break;
+
+                    case JSON_STATE_KEY_OR_END:
+                        if ('}' == c) {
+                            json_stream_pop(s);
+                            break;
+                        }
+                        // fall through
+                    case JSON_STATE_KEY:
+                        if ('"' == c) {
+                            s->string_is_key = true;
+                            json_stream_start_scalar(s, JSON_STATE_STRING);
+                            scalar = p;
+                        } else {
+                            s->state = JSON_STATE_ERROR;
+                        }
+                        break;
+
+                    case JSON_STATE_COLON:
+                        s->state = ':' == c ? JSON_STATE_VALUE : JSON_STATE_ERROR;
+                        break;
+
+                    case JSON_STATE_COMMA_OR_END:
+                        if (',' == c) {
+                            s->state = json_stream_in_object(s) ? JSON_STATE_KEY : JSON_STATE_VALUE;
+                        } else if (('}' == c && json_stream_in_object(s)) || (']' == c && !json_stream_in_object(s))) {
+                            json_stream_pop(s);
+                        } else {
+                            s->state = JSON_STATE_ERROR;
+                        }
+                        break;
+
+                    default:
+                        // Anything but whitespace after the value
+                        s->state = JSON_STATE_ERROR;
+                        break;
+                }
+                break;
+            }
+        }
+    }
+
+    // The piece ended part way through a string or number, keep what we have
+    if (JSON_STATE_STRING == s->state || JSON_STATE_NUMBER == s->state) {
+        json_stream_append(s, scalar, end - scalar);
+        s->copying = true;
+    }
+
+    return JSON_STATE_ERROR != s->state;
+}
+
+bool json_stream_finish(json_stream_t* stream) {
+    // A top level number only ends with the document
+    if (JSON_STATE_NUMBER == stream->state && 0 == stream->depth &&
+        json_stream_emit(stream, JSON_TOKEN_NUMBER, stream->value, stream->length, stream->truncated)) {
+        stream->state = JSON_STATE_DONE;
+    }
+
+    return JSON_STATE_DONE == stream->state;
+}
+
+bool json_token_equals(const json_token_t* token, const char* str) {
+    return !token->truncated && strlen(str) == token->length && 0 == memcmp(token->value, str, token->length);
+}
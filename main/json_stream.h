@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// =============================================================================
+// Streaming JSON Tokenizer
+// =============================================================================
+//
+// Push parser for JSON arriving in pieces, e.g. straight out of a socket
+// receive buffer. Tokens are handed to a callback as soon as they are complete,
+// so arrays of any length can be consumed without holding the whole document.
+// Uses no heap; all state is in json_stream_t.
+//
+// Strings and numbers that lie wholly within one piece are passed as pointers
+// into that piece. Only ones that span pieces or contain escapes are copied,
+// into a buffer of JSON_STREAM_VALUE_MAX bytes.
+
+// Longest string or number that can be copied. Longer ones are truncated.
+// Enough for a firmware URL.
+#define JSON_STREAM_VALUE_MAX 128
+
+// Deepest nesting allowed
+#define JSON_STREAM_MAX_DEPTH 32
+
+typedef enum json_token_type {
+    JSON_TOKEN_OBJECT_START,
+    JSON_TOKEN_OBJECT_END,
+    JSON_TOKEN_ARRAY_START,
+    JSON_TOKEN_ARRAY_END,
+    JSON_TOKEN_KEY,
+    JSON_TOKEN_STRING,
+    JSON_TOKEN_NUMBER,
+    JSON_TOKEN_TRUE,
+    JSON_TOKEN_FALSE,
+    JSON_TOKEN_NULL,
+} json_token_type_t;
+
+typedef struct json_token {
+    json_token_type_t type;
+    uint8_t depth;      // 0 for the top level value, 1 for its members, etc.
+    const char* value;  // Keys, strings (unescaped, no quotes) and numbers. Not null terminated.
+    size_t length;
+    bool truncated;     // The value was longer than JSON_STREAM_VALUE_MAX
+} json_token_t;
+
+// Receives each token. The token, and the value it points to, are only valid
+// during the call.
+//
+// Return false to stop parsing.
+typedef bool (*json_stream_callback_t)(void* ctx, const json_token_t* token);
+
+typedef struct json_stream {
+    json_stream_callback_t callback;
+    void* ctx;
+    uint8_t state;
+    uint8_t depth;
+    uint32_t objects;  // Bit n is set if the container at depth n is an object
+
+    // String and number being received
+    bool string_is_key;
+    bool copying;  // Value is being assembled in `value`
+    bool truncated;
+    size_t length;
+    uint16_t unicode;
+    uint8_t unicode_digits;
+    char value[JSON_STREAM_VALUE_MAX];
+
+    // Literal being received
+    const char* literal;
+    uint8_t literal_index;
+    json_token_type_t literal_type;
+} json_stream_t;
+
+// Prepares `stream` to parse one JSON value.
+void json_stream_init(json_stream_t* stream, json_stream_callback_t callback, void* ctx);
+
+// Parses the next piece of the document.
+//
+// Returns false on a syntax error or if the callback stopped parsing. After
+// that every call fails until json_stream_init() is called again.
+bool json_stream_feed(json_stream_t* stream, const char* data, size_t size);
+
+// Ends the document.
+//
+// Returns true if exactly one complete value was parsed.
+bool json_stream_finish(json_stream_t* stream);
+
+// Returns true if the value of `token` is exactly `str`.
+bool json_token_equals(const json_token_t* token, const char* str);
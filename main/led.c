@@ -0,0 +1,206 @@
+#include "led.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "rom/ets_sys.h"
+
+#define TAG "led"
+
+// =============================================================================
+// Bitstream
+// =============================================================================
+
+// SK6812 LEDs are driven from UART1 TX (GPIO2) instead of bit-banging, which
+// would need interrupts off for ~40 us per LED. I2S isn't used because its
+// data out pin is shared with UART0 RX, which the RF125PS reader needs.
+//
+// At 3.2 Mbaud each UART bit is 312.5 ns, a quarter of an SK6812 bit. With 6
+// data bits, 1 stop bit and the output inverted, each UART byte is 8 periods on
+// the wire: the start bit (high), 6 data bits, then the stop bit (low). That is
+// two SK6812 bits, each sent as high-high-low-low for a 1 or high-low-low-low
+// for a 0. The line idles low, which doubles as the reset/latch signal.
+#define LED_UART UART_NUM_1
+#define LED_UART_BAUD 3200000
+
+// UART bytes for each pair of SK6812 bits, packed into a word so no byte reads
+// from flash are needed. Pair 00 is in the low byte:
+//
+//   00 -> 0x37
+//   01 -> 0x27
+//   10 -> 0x36
+//   11 -> 0x26
+#define LED_SYMBOLS 0x26362737
+#define LED_SYMBOL(pair) ((LED_SYMBOLS >> (8 * (pair))) & 0xFF)
+
+#if 0x37 != LED_SYMBOL(0) || 0x27 != LED_SYMBOL(1) || 0x36 != LED_SYMBOL(2) || 0x26 != LED_SYMBOL(3)
+#error "LED_SYMBOLS doesn't match the symbol table"
+#endif
+
+#define LED_CHANNELS 4
+#define LED_WORDS_PER_LED LED_CHANNELS  // Each channel byte encodes to one 32 bit word
+#define LED_BYTES_PER_LED (LED_WORDS_PER_LED * sizeof(uint32_t))
+
+// SK6812 needs the line low for at least 80 us to latch a frame
+#define LED_RESET_US 80
+
+// Longest a frame can take to send (300 LEDs is ~10 ms)
+#define LED_TX_TIMEOUT_MS 50
+
+// Frames are encoded LED_CHUNK_LEDS at a time and queued in the UART driver's
+// TX ring, which holds up to LED_TX_BUFFER_SIZE bytes (~5 ms on the wire, 128
+// LEDs). Shorter strips fit whole, so their frames are queued in one go. On
+// longer ones led_show() tops the ring up as it drains, and must not be held
+// off for longer than the ring takes to empty, or the line idles long enough
+// to latch part of the frame.
+#define LED_CHUNK_LEDS 16
+#define LED_TX_BUFFER_SIZE 2048
+
+// =============================================================================
+// Lookup Tables
+// =============================================================================
+
+// Gamma correction (gamma 2.6), four 8 bit entries per word. Kept as words so
+// it can live in flash, which only supports 32 bit reads.
+static const uint32_t led_gamma_table[64] = {
+    0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+    0x01010101, 0x01010101, 0x01010101, 0x02020202, 0x02020202, 0x03030303,
+    0x04040303, 0x05050404, 0x06050505, 0x07060606, 0x08080707, 0x09090908,
+    0x0B0A0A0A, 0x0C0C0B0B, 0x0E0D0D0D, 0x100F0F0E, 0x12111110, 0x14131312,
+    0x16151514, 0x18181716, 0x1B1A1919, 0x1D1D1C1B, 0x201F1F1E, 0x23222221,
+    0x26262524, 0x2A292827, 0x2D2C2B2A, 0x31302F2E, 0x35343332, 0x39383736,
+    0x3D3C3B3A, 0x41403F3E, 0x46454442, 0x4B494847, 0x504E4D4C, 0x55545251,
+    0x5A595856, 0x605E5D5C, 0x66646361, 0x6C6A6967, 0x72706F6D, 0x78777573,
+    0x7F7D7C7A, 0x86848281, 0x8D8B8988, 0x9492918F, 0x9C9A9896, 0xA4A2A09E,
+    0xACAAA8A6, 0xB4B2B0AE, 0xBCBAB8B6, 0xC5C3C1BF, 0xCECCCAC7, 0xD7D5D3D1,
+    0xE1DFDCDA, 0xEBE8E6E3, 0xF5F2F0ED, 0xFFFCFAF7,
+};
+
+static uint8_t led_gamma(uint8_t value) {
+    return (led_gamma_table[value / 4] >> (8 * (value % 4))) & 0xFF;
+}
+
+// The encoded bitstream word for each channel value, with brightness and gamma
+// already applied. Rebuilt by led_set_brightness(), so encoding a channel is a
+// single lookup and store.
+static uint32_t led_levels[256] = {0};
+
+// Encodes a level to four UART bytes, first byte in the low byte so a word
+// store on this little endian CPU puts them in order.
+static uint32_t led_encode_level(uint8_t level) {
+    return LED_SYMBOL(level >> 6) | (LED_SYMBOL((level >> 4) & 0x3) << 8) | (LED_SYMBOL((level >> 2) & 0x3) << 16) |
+           (LED_SYMBOL(level & 0x3) << 24);
+}
+
+// =============================================================================
+// Encoders
+// =============================================================================
+
+// One encoder per channel order, picked once by led_init(), so the per pixel
+// loop has no branches.
+typedef void (*led_encoder_t)(uint32_t* out, const led_color_t* colors, uint16_t count);
+
+static void led_encode_rgbw(uint32_t* out, const led_color_t* colors, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        out[0] = led_levels[colors[i].r];
+        out[1] = led_levels[colors[i].g];
+        out[2] = led_levels[colors[i].b];
+        out[3] = led_levels[colors[i].w];
+        out += LED_WORDS_PER_LED;
+    }
+}
+
+static void led_encode_bgrw(uint32_t* out, const led_color_t* colors, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        out[0] = led_levels[colors[i].b];
+        out[1] = led_levels[colors[i].g];
+        out[2] = led_levels[colors[i].r];
+        out[3] = led_levels[colors[i].w];
+        out += LED_WORDS_PER_LED;
+    }
+}
+
+static uint16_t led_count = 0;
+static led_encoder_t led_encoder = led_encode_rgbw;
+static bool led_ready = false;
+static uint32_t led_chunk[LED_CHUNK_LEDS * LED_WORDS_PER_LED];
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+bool led_init(uint16_t count, led_type_t type) {
+    led_count = count;
+    led_encoder = LED_TYPE_BGRW == type ? led_encode_bgrw : led_encode_rgbw;
+    led_set_brightness(UINT8_MAX);
+
+    // Nothing to drive
+    if (0 == count) {
+        return true;
+    }
+
+    const uart_config_t uart_config = {
+        .baud_rate = LED_UART_BAUD,
+        .data_bits = UART_DATA_6_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
+    if (ESP_OK != uart_param_config(LED_UART, &uart_config) ||
+        ESP_OK != uart_set_line_inverse(LED_UART, UART_INVERSE_TXD)) {
+        return false;
+    }
+
+    // The driver tops up the FIFO from its interrupt as it drains. It needs
+    // more than the 128 byte FIFO. UART1 has no RX.
+    size_t tx_buffer_size = (size_t)count * LED_BYTES_PER_LED;
+    if (tx_buffer_size > LED_TX_BUFFER_SIZE) {
+        tx_buffer_size = LED_TX_BUFFER_SIZE;
+    } else if (tx_buffer_size < 256) {
+        tx_buffer_size = 256;
+    }
+    led_ready = ESP_OK == uart_driver_install(LED_UART, 0, tx_buffer_size, 0, NULL, 0);
+    return led_ready;
+}
+
+void led_set_brightness(uint8_t brightness) {
+    for (int value = 0; value <= UINT8_MAX; value++) {
+        // Scale before gamma correction so dimming looks even
+        const uint8_t level = led_gamma(((uint32_t)value * brightness + (UINT8_MAX / 2)) / UINT8_MAX);
+        led_levels[value] = led_encode_level(level);
+    }
+}
+
+bool led_show(const led_color_t* colors) {
+    if (0 == led_count) {
+        return true;
+    }
+    if (!led_ready) {
+        return false;
+    }
+
+    // The previous frame must be fully sent and latched
+    if (ESP_OK != uart_wait_tx_done(LED_UART, pdMS_TO_TICKS(LED_TX_TIMEOUT_MS))) {
+        return false;
+    }
+    ets_delay_us(LED_RESET_US);
+
+    // Writes block while the TX ring is full
+    const int64_t start_time = esp_timer_get_time();
+    bool ok = true;
+    for (uint32_t first = 0; ok && first < led_count; first += LED_CHUNK_LEDS) {
+        const uint16_t count = led_count - first < LED_CHUNK_LEDS ? led_count - first : LED_CHUNK_LEDS;
+        led_encoder(led_chunk, &colors[first], count);
+        const int length = count * LED_BYTES_PER_LED;
+        ok = length == uart_write_bytes(LED_UART, (const char*)led_chunk, length);
+    }
+    const int64_t queue_time = esp_timer_get_time() - start_time;
+
+    ESP_LOGD(TAG, "Frame of %u LEDs encoded and queued in %s us, interrupts never disabled", led_count,
+             I64_DEC(queue_time));
+    return ok;
+}
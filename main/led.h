@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+
+// =============================================================================
+// Types
+// =============================================================================
+
+typedef struct led_color {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t w;
+} led_color_t;
+
+// =============================================================================
+// Interface
+// =============================================================================
+
+// Initialises the LED driver for a strip of `count` SK6812 LEDs of `type`.
+//
+// Returns true on success.
+bool led_init(uint16_t count, led_type_t type);
+
+// Sets the global brightness (0-255) applied to every frame. Defaults to 255.
+void led_set_brightness(uint8_t brightness);
+
+// Sends a frame to the LEDs. `colors` must contain one entry per LED.
+//
+// The frame is encoded into a bitstream a few LEDs at a time and handed to the
+// UART, which clocks it out from its hardware FIFO. Interrupts stay enabled
+// throughout. If the previous frame is still being sent this waits for it to
+// finish first, and on long strips it waits for room as the frame goes out.
+//
+// With no LEDs this does nothing and returns true.
+//
+// Returns true on success.
+bool led_show(const led_color_t* colors);
@@ -0,0 +1,251 @@
+#include "led_animation.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "core.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "health.h"
+#include "led.h"
+
+#define TAG "led_animation"
+
+// =============================================================================
+// Timing
+// =============================================================================
+
+// Fixed frame clock. Animations are functions of the frame number.
+#define LED_ANIMATION_FRAME_MS 20
+#define LED_ANIMATION_FRAMES(ms) ((ms) / LED_ANIMATION_FRAME_MS)
+
+// Flash lengths
+#define LED_ANIMATION_GRANTED_FRAMES LED_ANIMATION_FRAMES(1000)
+#define LED_ANIMATION_DENIED_FRAMES LED_ANIMATION_FRAMES(1200)
+
+// How often CPU use is logged
+#define LED_ANIMATION_STATS_FRAMES LED_ANIMATION_FRAMES(60000)
+
+// =============================================================================
+// State
+// =============================================================================
+
+static TaskHandle_t led_animation_task_handle = NULL;
+
+// Requests from other tasks. Read once per frame by the animation task.
+static volatile led_status_t led_animation_status = LED_STATUS_CONNECTING;
+static volatile bool led_animation_flash_pending = false;
+static volatile led_flash_t led_animation_flash_requested = LED_FLASH_GRANTED;
+static volatile int64_t led_animation_flash_time = 0;  // When the flash was requested
+
+// Front buffer is on the LEDs, the back buffer is rendered into
+static uint16_t led_animation_count = 0;
+static led_color_t* led_animation_front = NULL;
+static led_color_t* led_animation_back = NULL;
+
+// =============================================================================
+// Fixed Point Helpers
+// =============================================================================
+
+// a * b / 255, for 8 bit values
+static inline uint8_t led_scale8(uint8_t a, uint8_t b) {
+    return ((uint16_t)a * b + 255) >> 8;
+}
+
+// Triangle wave between 0 and 255 with a period of `period` frames
+static uint8_t led_triangle(uint32_t frame, uint32_t period) {
+    const uint32_t phase = ((frame % period) * 510) / period;
+    return phase < 256 ? phase : 510 - phase;
+}
+
+static void led_fill(led_color_t* leds, led_color_t color) {
+    for (uint16_t i = 0; i < led_animation_count; i++) {
+        leds[i] = color;
+    }
+}
+
+// =============================================================================
+// Animations
+// =============================================================================
+
+static const led_color_t led_off = {0};
+
+// Blue comet circling the ring
+static void led_render_connecting(led_color_t* leds, uint32_t frame) {
+    // Head position in 8.8 fixed point, one lap per second
+    const uint32_t lap = (uint32_t)led_animation_count << 8;
+    const uint32_t head = ((frame % LED_ANIMATION_FRAMES(1000)) * lap) / LED_ANIMATION_FRAMES(1000);
+    const uint32_t tail = 4 << 8;
+
+    for (uint16_t i = 0; i < led_animation_count; i++) {
+        const uint32_t behind = (head + lap - ((uint32_t)i << 8)) % lap;
+        const uint8_t level = behind < tail ? 255 - (behind * 255) / tail : 0;
+        leds[i] = (led_color_t){.b = level};
+    }
+}
+
+// Dim steady white
+static void led_render_idle(led_color_t* leds, uint32_t frame) {
+    led_fill(leds, (led_color_t){.w = 32});
+}
+
+// Slow amber breathing
+static void led_render_offline(led_color_t* leds, uint32_t frame) {
+    const uint8_t level = led_triangle(frame, LED_ANIMATION_FRAMES(3000));
+    led_fill(leds, (led_color_t){.r = level, .g = led_scale8(level, 96)});
+}
+
+// Solid green
+static void led_render_granted(led_color_t* leds, uint32_t frame) {
+    led_fill(leds, (led_color_t){.g = 255});
+}
+
+// Three red blinks
+static void led_render_denied(led_color_t* leds, uint32_t frame) {
+    const bool on = (frame / LED_ANIMATION_FRAMES(200)) % 2 == 0;
+    led_fill(leds, on ? (led_color_t){.r = 255} : led_off);
+}
+
+// =============================================================================
+// Task
+// =============================================================================
+
+static void led_animation_task(void* arg) {
+    uint32_t frame = 0;             // Frames since the current animation started
+    led_status_t status = LED_STATUS_CONNECTING;
+    bool flashing = false;
+    led_flash_t flash = LED_FLASH_GRANTED;
+    int64_t flash_time = 0;         // When the current flash was requested, 0 once shown
+    int64_t worst_flash_latency = 0;
+    int64_t render_time = 0;        // Total time spent rendering since the last stats log
+    uint32_t stats_frames = 0;
+    TickType_t next_frame = xTaskGetTickCount();  // Deadline of the next frame
+
+    while (1) {
+        // Pick up requests. A flash starts at once, and the clock from there.
+        if (led_animation_flash_pending) {
+            taskENTER_CRITICAL();
+            led_animation_flash_pending = false;
+            flash = led_animation_flash_requested;
+            flash_time = led_animation_flash_time;
+            taskEXIT_CRITICAL();
+            flashing = true;
+            frame = 0;
+            next_frame = xTaskGetTickCount();
+        }
+        if (!flashing && status != led_animation_status) {
+            status = led_animation_status;
+            frame = 0;
+        }
+
+        // Render into the back buffer
+        const int64_t start_time = esp_timer_get_time();
+        if (flashing) {
+            if (LED_FLASH_GRANTED == flash) {
+                led_render_granted(led_animation_back, frame);
+                flashing = frame < LED_ANIMATION_GRANTED_FRAMES;
+            } else {
+                led_render_denied(led_animation_back, frame);
+                flashing = frame < LED_ANIMATION_DENIED_FRAMES;
+            }
+        } else if (LED_STATUS_CONNECTING == status) {
+            led_render_connecting(led_animation_back, frame);
+        } else if (LED_STATUS_OFFLINE == status) {
+            led_render_offline(led_animation_back, frame);
+        } else {
+            led_render_idle(led_animation_back, frame);
+        }
+
+        // Only send frames that changed
+        const size_t size = led_animation_count * sizeof(led_color_t);
+        if (0 != memcmp(led_animation_front, led_animation_back, size)) {
+            led_color_t* shown = led_animation_back;
+            led_animation_back = led_animation_front;
+            led_animation_front = shown;
+            led_show(led_animation_front);
+        }
+        render_time += esp_timer_get_time() - start_time;
+
+        // Decision to LED latency
+        if (0 != flash_time) {
+            const int64_t latency = esp_timer_get_time() - flash_time;
+            if (latency > worst_flash_latency) {
+                worst_flash_latency = latency;
+                ESP_LOGI(TAG, "New worst case decision to LED latency: %s us", I64_DEC(worst_flash_latency));
+            }
+            flash_time = 0;
+        }
+
+        if (++stats_frames >= LED_ANIMATION_STATS_FRAMES) {
+            // Hundredths of a percent of the frame time spent rendering
+            const uint32_t load = (render_time * 10) / ((int64_t)stats_frames * LED_ANIMATION_FRAME_MS);
+            ESP_LOGI(TAG, "Animation CPU load: %u.%02u%%", load / 100, load % 100);
+            render_time = 0;
+            stats_frames = 0;
+        }
+
+        // Wait for the next frame's deadline, or wake early for a flash. Other
+        // wakes go back to waiting, so only a deadline advances the frame. A
+        // frame that ran past its deadline moves the clock on rather than
+        // rushing to catch up.
+        next_frame += pdMS_TO_TICKS(LED_ANIMATION_FRAME_MS);
+        while (!led_animation_flash_pending) {
+            const TickType_t remaining = next_frame - xTaskGetTickCount();
+            if (remaining > pdMS_TO_TICKS(LED_ANIMATION_FRAME_MS)) {
+                next_frame = xTaskGetTickCount();
+                break;
+            }
+            if (0 == remaining) {
+                break;
+            }
+            ulTaskNotifyTake(pdTRUE, remaining);
+        }
+        frame++;
+    }
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+bool led_animation_start(void) {
+    led_animation_count = config_get_led_count();
+    if (0 == led_animation_count) {
+        ESP_LOGI(TAG, "No LEDs, not animating");
+        return true;
+    }
+
+    led_animation_front = calloc(led_animation_count, sizeof(led_color_t));
+    led_animation_back = calloc(led_animation_count, sizeof(led_color_t));
+    if (NULL == led_animation_front || NULL == led_animation_back) {
+        return false;
+    }
+
+    // Below access control, so rendering never delays a decision
+    if (pdPASS != xTaskCreate(led_animation_task, "LED Animation", 2048, NULL, tskIDLE_PRIORITY + 2,
+                              &led_animation_task_handle)) {
+        return false;
+    }
+    health_watch_task(led_animation_task_handle);
+    return true;
+}
+
+void led_animation_set_status(led_status_t status) {
+    led_animation_status = status;
+}
+
+void led_animation_flash(led_flash_t flash) {
+    taskENTER_CRITICAL();
+    led_animation_flash_requested = flash;
+    led_animation_flash_time = esp_timer_get_time();
+    led_animation_flash_pending = true;
+    taskEXIT_CRITICAL();
+
+    if (NULL != led_animation_task_handle) {
+        xTaskNotifyGive(led_animation_task_handle);
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+
+// =============================================================================
+// Types
+// =============================================================================
+
+// Background animation, shown until changed
+typedef enum led_status {
+    LED_STATUS_CONNECTING,  // Waiting for the network
+    LED_STATUS_IDLE,        // Ready for a card
+    LED_STATUS_OFFLINE,     // Network up but the portal is unreachable
+} led_status_t;
+
+// Short animation that interrupts the status animation, then returns to it
+typedef enum led_flash {
+    LED_FLASH_GRANTED,
+    LED_FLASH_DENIED,
+} led_flash_t;
+
+// =============================================================================
+// Interface
+// =============================================================================
+
+// Starts the animation task. Must come after led_init().
+//
+// Returns true on success.
+bool led_animation_start(void);
+
+// Changes the status animation.
+void led_animation_set_status(led_status_t status);
+
+// Shows a flash. The flash preempts whatever is being shown and is on the LEDs
+// within one frame. Never blocks, so it is safe to call from the access path.
+void led_animation_flash(led_flash_t flash);
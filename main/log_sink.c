@@ -0,0 +1,421 @@
+#include "log_sink.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "health.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include "network.h"
+#include "sdkconfig.h"
+#include "wall_clock.h"
+
+#define TAG "log_sink"
+
+// Lines are sent at least this often, and sooner once the ring is half full
+#define LOG_SINK_BATCH_MS 2000
+
+#define LOG_SINK_RING_SIZE 2048
+#define LOG_SINK_LINE_MAX 120  // Longer lines are cut short
+
+// Tasks that can be part way through a line at once. Output from any more is
+// lost until one of them finishes its line.
+#define LOG_SINK_WRITERS 4
+
+// Kept under the MTU, so packets are never fragmented
+#define LOG_SINK_PACKET_MAX 1024
+
+// Packets start with these, then a version
+#define LOG_SINK_MAGIC_0 'I'
+#define LOG_SINK_MAGIC_1 'L'
+#define LOG_SINK_VERSION 1
+
+// Longest LEB128 encoding of a uint64_t
+#define LOG_SINK_VARINT_MAX 10
+
+// Each line in the ring: level, length, uptime (ms, little endian), text
+#define LOG_SINK_RECORD_HEADER 6
+
+// How full the ring may get before lines of each level are dropped, in
+// sixteenths. Errors can use it all, debug lines only half.
+static const uint8_t log_sink_limits[LOG_SINK_LEVELS] = {16, 14, 12, 8};
+
+// Level letters used by ESP_LOG, and on the wire
+static const char log_sink_letters[LOG_SINK_LEVELS] = {'E', 'W', 'I', 'D'};
+
+// =============================================================================
+// Types
+// =============================================================================
+
+// A line being written by one task. A task can be switched out part way
+// through a line, so each gets its own until its newline, when the line is
+// moved to the ring.
+typedef struct log_sink_writer {
+    bool used;
+    bool in_escape;  // Skipping a colour code
+    TaskHandle_t task;
+    size_t size;
+    char line[LOG_SINK_LINE_MAX];
+} log_sink_writer_t;
+
+// =============================================================================
+// State
+// =============================================================================
+
+// Guarded by critical sections, like the ring
+static log_sink_writer_t log_sink_writers[LOG_SINK_WRITERS];
+
+// Guarded by critical sections. Lines are added at the head by whichever task
+// logs, and only the sender task takes them from the tail.
+static uint8_t log_sink_ring[LOG_SINK_RING_SIZE];
+static size_t log_sink_head = 0;
+static size_t log_sink_tail = 0;
+static size_t log_sink_used = 0;
+static log_sink_stats_t log_sink_stats = {0};
+
+// Where log output went before the sink, i.e. the UART
+static putchar_like_t log_sink_next = NULL;
+
+static TaskHandle_t log_sink_task_handle = NULL;
+static volatile bool log_sink_paused = false;  // For the benchmark, as if the network were down
+
+// Only used by the sender task
+static uint8_t log_sink_packet[LOG_SINK_PACKET_MAX];
+static uint32_t log_sink_sequence = 0;
+
+// =============================================================================
+// Ring
+// =============================================================================
+
+// Must be in a critical section
+static void log_sink_ring_write(const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        log_sink_ring[log_sink_head] = bytes[i];
+        log_sink_head = (log_sink_head + 1) % LOG_SINK_RING_SIZE;
+    }
+}
+
+// Reads from `offset` bytes past the tail. Only the sender task may call this,
+// as nothing else moves the tail, and only for bytes already in the ring.
+static void log_sink_ring_read(size_t offset, void* out, size_t size) {
+    uint8_t* bytes = out;
+    for (size_t i = 0; i < size; i++) {
+        bytes[i] = log_sink_ring[(log_sink_tail + offset + i) % LOG_SINK_RING_SIZE];
+    }
+}
+
+// ESP_LOG lines start with their level letter. Anything else counts as info.
+static log_sink_level_t log_sink_level(const char* line, size_t size) {
+    if (size >= 2 && ' ' == line[1]) {
+        for (int level = 0; level < LOG_SINK_LEVELS; level++) {
+            if (line[0] == log_sink_letters[level]) {
+                return level;
+            }
+        }
+        if ('V' == line[0]) {
+            return LOG_SINK_DEBUG;
+        }
+    }
+    return LOG_SINK_INFO;
+}
+
+// Finds the line `task` is writing, or a free one for it to start.
+//
+// Must be in a critical section. Returns NULL if none are free.
+static log_sink_writer_t* log_sink_writer(TaskHandle_t task) {
+    log_sink_writer_t* free_writer = NULL;
+    for (int i = 0; i < LOG_SINK_WRITERS; i++) {
+        log_sink_writer_t* writer = &log_sink_writers[i];
+        if (writer->used && task == writer->task) {
+            return writer;
+        }
+        if (!writer->used && NULL == free_writer) {
+            free_writer = writer;
+        }
+    }
+    if (NULL != free_writer) {
+        free_writer->used = true;
+        free_writer->task = task;
+    }
+    return free_writer;
+}
+
+// Moves a finished line into the ring, unless it is too full for its level,
+// and frees the writer.
+//
+// Must be in a critical section. Returns true if the sender should be woken.
+static bool log_sink_commit(log_sink_writer_t* writer, uint32_t uptime_ms) {
+    const size_t size = writer->size;
+    bool wake = false;
+    if (0 != size) {
+        const log_sink_level_t level = log_sink_level(writer->line, size);
+        const size_t record_size = LOG_SINK_RECORD_HEADER + size;
+        if (log_sink_used + record_size <= LOG_SINK_RING_SIZE * log_sink_limits[level] / 16) {
+            const uint8_t header[LOG_SINK_RECORD_HEADER] = {
+                level, size, uptime_ms, uptime_ms >> 8, uptime_ms >> 16, uptime_ms >> 24,
+            };
+            log_sink_ring_write(header, sizeof(header));
+            log_sink_ring_write(writer->line, size);
+            wake = log_sink_used < LOG_SINK_RING_SIZE / 2 && log_sink_used + record_size >= LOG_SINK_RING_SIZE / 2;
+            log_sink_used += record_size;
+            log_sink_stats.lines++;
+        } else {
+            log_sink_stats.dropped[level]++;
+        }
+    }
+
+    writer->used = false;
+    writer->in_escape = false;
+    writer->size = 0;
+    return wake;
+}
+
+// Installed with esp_log_set_putchar(). Passes everything on to the UART, and
+// keeps a copy of each line without its colour codes. Each character is added
+// to the calling task's own line, so lines from tasks that log at once don't
+// get mixed up.
+static int log_sink_putchar(int c) {
+    if (NULL != log_sink_next) {
+        log_sink_next(c);
+    }
+    if ('\r' == c) {
+        return c;
+    }
+
+    const TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    const uint32_t uptime_ms = '\n' == c ? esp_timer_get_time() / 1000 : 0;
+    bool wake = false;
+
+    taskENTER_CRITICAL();
+    log_sink_writer_t* writer = log_sink_writer(task);
+    if (NULL == writer) {
+        // Lost, too many tasks are part way through a line
+    } else if ('\033' == c) {
+        writer->in_escape = true;
+    } else if (writer->in_escape) {
+        writer->in_escape = 'm' != c;
+    } else if ('\n' == c) {
+        wake = log_sink_commit(writer, uptime_ms);
+    } else if (writer->size < LOG_SINK_LINE_MAX) {
+        writer->line[writer->size++] = c;
+    }
+    taskEXIT_CRITICAL();
+
+    if (wake && NULL != log_sink_task_handle) {
+        xTaskNotifyGive(log_sink_task_handle);
+    }
+    return c;
+}
+
+// =============================================================================
+// Sender
+// =============================================================================
+
+static size_t log_sink_varint_put(uint8_t* out, uint64_t value) {
+    size_t size = 0;
+    do {
+        out[size] = value & 0x7F;
+        value >>= 7;
+        out[size++] |= value ? 0x80 : 0;
+    } while (0 != value);
+    return size;
+}
+
+// Packs as many lines as fit into a packet: magic, version, then varints of
+// the sequence number, uptime (ms), UTC time (ms, 0 if unknown), lines dropped
+// since boot at each level and the line count. Then for each line its level
+// letter, and varints of its uptime and length before its text.
+//
+// Returns the packet size, and the ring bytes it holds in `out_taken`.
+static size_t log_sink_pack(size_t* out_taken) {
+    log_sink_stats_t stats;
+    taskENTER_CRITICAL();
+    const size_t available = log_sink_used;
+    stats = log_sink_stats;
+    taskEXIT_CRITICAL();
+
+    size_t size = 0;
+    log_sink_packet[size++] = LOG_SINK_MAGIC_0;
+    log_sink_packet[size++] = LOG_SINK_MAGIC_1;
+    log_sink_packet[size++] = LOG_SINK_VERSION;
+    size += log_sink_varint_put(&log_sink_packet[size], log_sink_sequence);
+    size += log_sink_varint_put(&log_sink_packet[size], esp_timer_get_time() / 1000);
+    size += log_sink_varint_put(&log_sink_packet[size], wall_clock_now() / 1000);
+    for (int level = 0; level < LOG_SINK_LEVELS; level++) {
+        size += log_sink_varint_put(&log_sink_packet[size], stats.dropped[level]);
+    }
+
+    // The count goes in once it is known, with room kept for it
+    const size_t count_at = size;
+    size += LOG_SINK_VARINT_MAX;
+
+    size_t taken = 0;
+    uint32_t count = 0;
+    while (taken < available) {
+        uint8_t header[LOG_SINK_RECORD_HEADER];
+        log_sink_ring_read(taken, header, sizeof(header));
+        const size_t length = header[1];
+        const uint32_t uptime_ms = header[2] | header[3] << 8 | header[4] << 16 | (uint32_t)header[5] << 24;
+        if (size + 1 + 2 * LOG_SINK_VARINT_MAX + length > sizeof(log_sink_packet)) {
+            break;
+        }
+
+        log_sink_packet[size++] = log_sink_letters[header[0]];
+        size += log_sink_varint_put(&log_sink_packet[size], uptime_ms);
+        size += log_sink_varint_put(&log_sink_packet[size], length);
+        log_sink_ring_read(taken + sizeof(header), &log_sink_packet[size], length);
+        size += length;
+        taken += sizeof(header) + length;
+        count++;
+    }
+
+    // Close the gap left for the count
+    uint8_t encoded[LOG_SINK_VARINT_MAX];
+    const size_t count_size = log_sink_varint_put(encoded, count);
+    memmove(&log_sink_packet[count_at + count_size], &log_sink_packet[count_at + LOG_SINK_VARINT_MAX],
+            size - count_at - LOG_SINK_VARINT_MAX);
+    memcpy(&log_sink_packet[count_at], encoded, count_size);
+    size -= LOG_SINK_VARINT_MAX - count_size;
+
+    *out_taken = taken;
+    return 0 == count ? 0 : size;
+}
+
+// Sends the ring until it is empty or the network pushes back. Lines are only
+// taken out once they have been sent.
+static void log_sink_flush(int sock, const struct sockaddr_in* to) {
+    while (!log_sink_paused) {
+        size_t taken;
+        const size_t size = log_sink_pack(&taken);
+        if (0 == size) {
+            return;
+        }
+
+        const bool sent =
+            (int)size == sendto(sock, log_sink_packet, size, MSG_DONTWAIT, (const struct sockaddr*)to, sizeof(*to));
+        taskENTER_CRITICAL();
+        if (sent) {
+            log_sink_tail = (log_sink_tail + taken) % LOG_SINK_RING_SIZE;
+            log_sink_used -= taken;
+            log_sink_stats.packets++;
+        } else {
+            log_sink_stats.send_failures++;
+        }
+        taskEXIT_CRITICAL();
+
+        // Logging here would only add to the ring, so failures are just counted
+        if (!sent) {
+            return;
+        }
+        log_sink_sequence++;
+    }
+}
+
+static bool log_sink_resolve(struct sockaddr_in* out_to) {
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo* result = NULL;
+    if (0 != getaddrinfo(CONFIG_INTERLOCK_LOG_SINK_HOST, NULL, &hints, &result) || NULL == result) {
+        return false;
+    }
+    *out_to = *(const struct sockaddr_in*)result->ai_addr;
+    out_to->sin_port = htons(CONFIG_INTERLOCK_LOG_SINK_PORT);
+    freeaddrinfo(result);
+    return true;
+}
+
+static void log_sink_task(void* arg) {
+    struct sockaddr_in to;
+    bool resolved = false;
+    int sock = -1;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOG_SINK_BATCH_MS));
+        if (!network_is_connected()) {
+            continue;
+        }
+
+        if (!resolved && !(resolved = log_sink_resolve(&to))) {
+            continue;
+        }
+        if (sock < 0 && (sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+            continue;
+        }
+        log_sink_flush(sock, &to);
+    }
+}
+
+// =============================================================================
+// Benchmark
+// =============================================================================
+
+#if CONFIG_INTERLOCK_LOG_SINK_BENCHMARK
+#define LOG_SINK_BENCHMARK_LINES 200
+
+static int log_sink_discard(int c) {
+    return c;
+}
+
+// Average time of an ESP_LOGI of a typical line, in us
+static uint32_t log_sink_time_logs(void) {
+    const int64_t start = esp_timer_get_time();
+    for (int i = 0; i < LOG_SINK_BENCHMARK_LINES; i++) {
+        ESP_LOGI(TAG, "Benchmark line %d of %d, about as long as most", i, LOG_SINK_BENCHMARK_LINES);
+    }
+    return (esp_timer_get_time() - start) / LOG_SINK_BENCHMARK_LINES;
+}
+
+void log_sink_benchmark(void) {
+    // The UART is left out, as it is far slower than the sink and would hide it
+    const putchar_like_t uart = log_sink_next;
+    log_sink_next = log_sink_discard;
+
+    esp_log_set_putchar(log_sink_discard);
+    const uint32_t bare_us = log_sink_time_logs();
+    esp_log_set_putchar(log_sink_putchar);
+
+    // Sending, from an empty ring
+    xTaskNotifyGive(log_sink_task_handle);
+    vTaskDelay(pdMS_TO_TICKS(500));
+    const bool connected = network_is_connected();
+    const uint32_t sending_us = log_sink_time_logs();
+
+    // Unable to send, so the ring fills and lines are dropped
+    log_sink_paused = true;
+    const uint32_t blocked_us = log_sink_time_logs();
+    log_sink_paused = false;
+    xTaskNotifyGive(log_sink_task_handle);
+
+    log_sink_next = uart;
+    log_sink_stats_t stats;
+    log_sink_get_stats(&stats);
+    ESP_LOGI(TAG, "ESP_LOGI takes %u us without the sink, %u us with the network %s, %u us with it down (%u dropped)",
+             bare_us, sending_us, connected ? "up" : "down", blocked_us, stats.dropped[LOG_SINK_INFO]);
+}
+#endif
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+bool log_sink_start(void) {
+    if (pdPASS != xTaskCreate(log_sink_task, "Log Sink", 2560, NULL, tskIDLE_PRIORITY + 1, &log_sink_task_handle)) {
+        return false;
+    }
+    health_watch_task(log_sink_task_handle);
+    log_sink_next = esp_log_set_putchar(log_sink_putchar);
+    return true;
+}
+
+void log_sink_get_stats(log_sink_stats_t* out_stats) {
+    taskENTER_CRITICAL();
+    *out_stats = log_sink_stats;
+    taskEXIT_CRITICAL();
+}
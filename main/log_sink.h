@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// =============================================================================
+// Log Sink
+// =============================================================================
+//
+// Copies ESP_LOG output, which otherwise only goes to the UART, into a ring in
+// RAM and ships it in batches over UDP to INTERLOCK_LOG_SINK_HOST, where
+// tools/log_receiver.py prints it. Logging never waits on the network: when
+// the ring fills up, debug lines are dropped first and errors last, and the
+// drops are counted in the next packet.
+//
+// Only built with INTERLOCK_LOG_SINK.
+
+// Log levels, as counted in log_sink_stats_t
+typedef enum log_sink_level {
+    LOG_SINK_ERROR,
+    LOG_SINK_WARNING,
+    LOG_SINK_INFO,
+    LOG_SINK_DEBUG,  // Also verbose
+    LOG_SINK_LEVELS,
+} log_sink_level_t;
+
+typedef struct log_sink_stats {
+    uint32_t lines;                     // Taken into the ring
+    uint32_t dropped[LOG_SINK_LEVELS];  // Lines lost to a full ring, by level
+    uint32_t packets;                   // Sent
+    uint32_t send_failures;             // Packets that will be tried again
+} log_sink_stats_t;
+
+// Starts copying log output into the ring, and the task that sends it on once
+// the network is up. Call as early as possible so boot logs are kept.
+//
+// Returns true on success.
+bool log_sink_start(void);
+
+// Gets a copy of the counters.
+void log_sink_get_stats(log_sink_stats_t* out_stats);
+
+// Logs how long an ESP_LOGI call takes without the sink, with it sending, and
+// with it unable to send. Only built with INTERLOCK_LOG_SINK_BENCHMARK.
+void log_sink_benchmark(void);
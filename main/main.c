@@ -1,19 +1,30 @@
 #include <stdio.h>
 #include <string.h>
+#include "access.h"
 #include "config.h"
 #include "core.h"
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_spi_flash.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "file_system.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "health.h"
+#include "led.h"
+#include "led_animation.h"
+#include "log_sink.h"
+#include "sdkconfig.h"
 
 #include "esp_spiffs.h"
 #include "lib/littlefs/lfs.h"
 #include "network.h"
+#include "portal.h"
 #include "projdefs.h"
+#include "rfid.h"
+#include "wall_clock.h"
+#include "warm_boot.h"
 
 #define TAG "interlock"
 
@@ -25,28 +36,85 @@ void trap(const char* reason) {
 }
 
 void app_main(void) {
-    // Delay a bit at startup so I can attach my crappy programmer
-    for (int i = 0; i < 3; i++) {
-        ESP_LOGE(TAG, "Waiting (%d s)", i);
-        vTaskDelay(pdMS_TO_TICKS(1000));
+    // Before the log sink, which passes its output on to whatever this installs
+    rfid_console_init();
+
+#if CONFIG_INTERLOCK_LOG_SINK
+    // Keep the boot logs, to send once the network is up
+    if (!log_sink_start()) {
+        ESP_LOGE(TAG, "Unable to start the log sink");
     }
+#endif
+
+    // After a soft or watchdog reset restore the config from RTC memory. The
+    // file system is only checked in the background.
+    const bool warm_boot = warm_boot_restore();
+
+    if (warm_boot) {
+        warm_boot_start_verification();
+    } else {
+        // Delay a bit at startup so I can attach my crappy programmer
+        for (int i = 0; i < 3; i++) {
+            ESP_LOGE(TAG, "Waiting (%d s)", i);
+            vTaskDelay(pdMS_TO_TICKS(1000));
+        }
 
-    // Start the file system
-    const char* fs_status = "";
-    if (!fs_init(&fs_status)) {
-        trap(fs_status);
+        // Start the file system
+        int64_t start_time = esp_timer_get_time();
+        const char* fs_status = "";
+        if (!fs_init(&fs_status)) {
+            trap(fs_status);
+        }
+        const int64_t fs_time = esp_timer_get_time() - start_time;
+
+        // Init the config
+        start_time = esp_timer_get_time();
+        if (!config_init()) {
+            trap("Config not OK");
+        }
+        const int64_t config_time = esp_timer_get_time() - start_time;
+        warm_boot_save_config();
+
+        // Boot path timings, so parser regressions show up in the logs
+        ESP_LOGI(TAG, "File system mounted in %s us, config loaded in %s us", I64_DEC(fs_time), I64_DEC(config_time));
     }
 
-    // Init the config
-    if (!config_init()) {
-        trap("Config not OK");
+    // Start the LEDs
+    if (!led_init(config_get_led_count(), config_get_led_type()) || !led_animation_start()) {
+        ESP_LOGE(TAG, "Unable to start the LEDs");
+    }
+
+    // Start the RFID reader and access control
+    if (!rfid_start(config_get_rfid_reader_type())) {
+        ESP_LOGE(TAG, "Unable to start the RFID reader");
+    }
+    if (!access_start()) {
+        trap("Unable to start access control");
     }
 
     // Start the network
-    network_start(config_get_wifi_ssid(), config_get_wifi_psk());
+    config_static_ip_t static_ip;
+    network_start(config_get_wifi_ssid(), config_get_wifi_psk(),
+                  config_get_wifi_static_ip(&static_ip) ? &static_ip : NULL);
+    if (!wall_clock_start()) {
+        ESP_LOGE(TAG, "Unable to start the wall clock");
+    }
+    if (!portal_start()) {
+        ESP_LOGE(TAG, "Unable to start the portal client");
+    }
+
+    ESP_LOGI(TAG, "Door ready %s ms after reset (%s boot)", I64_DEC(esp_timer_get_time() / 1000),
+             warm_boot ? "warm" : "cold");
+
+#if CONFIG_INTERLOCK_LOG_SINK_BENCHMARK
+    network_wait_for_connection(pdMS_TO_TICKS(30000));
+    log_sink_benchmark();
+#endif
 
+    // Sign of life on the console, the portal gets the same as a heartbeat
+    health_watch_task(xTaskGetCurrentTaskHandle());
     while (1) {
-        vTaskDelay(pdMS_TO_TICKS(3000));
-        ESP_LOGI(TAG, "OK");
+        vTaskDelay(pdMS_TO_TICKS(60000));
+        health_log();
     }
 }
\ No newline at end of file
@@ -1,41 +1,269 @@
 #include "network.h"
 #include <stdint.h>
+#include <string.h>
 
 #include "core.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_netif.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "esp_wifi_types.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "health.h"
+#include "led_animation.h"
+#include "lwip/dns.h"
 #include "portmacro.h"
 #include "projdefs.h"
+#include "sdkconfig.h"
 #include "tcpip_adapter.h"
+#include "warm_boot.h"
 
 // =============================================================================
 // WiFi
 // =============================================================================
 
+// Connection is checked, and the RSSI sampled, this often
+#define WIFI_MONITOR_MS 5000
+
+// Below this (smoothed) RSSI, in dBm, the device looks for a better AP. It only
+// moves for one at least WIFI_ROAM_HYSTERESIS_DB stronger, so it doesn't
+// bounce between two similar ones.
+#define WIFI_ROAM_RSSI -75
+#define WIFI_ROAM_HYSTERESIS_DB 8
+
+// Least time between roaming scans, which take the radio off channel
+#define WIFI_ROAM_SCAN_INTERVAL_MS 60000
+
+// A roam that hasn't got an IP after this long falls back to a fresh scan
+#define WIFI_ROAM_TIMEOUT_MS 10000
+
+// A roaming scan visits one channel at a time, for at most this long, and
+// spends WIFI_ROAM_SCAN_GAP_MS back on the AP's channel between them. An access
+// check that starts during the scan only waits for the channel being scanned,
+// well inside ACCESS_PORTAL_TIMEOUT_MS.
+#define WIFI_ROAM_SCAN_DWELL_MS 120
+#define WIFI_ROAM_SCAN_GAP_MS 50
+
+// APs considered from a scan
+#define WIFI_SCAN_MAX 8
+
+// Samples averaged into each NETWORK_RSSI_HISTORY entry
+#define WIFI_HISTORY_SAMPLES (60000 / WIFI_MONITOR_MS)
+
+// With INTERLOCK_WIFI_POWER_SAVE the radio sleeps between beacons while idle.
+// Anything holding the network, or a card being read, switches it to full
+// power. A read that never becomes an access check (a bad frame, or a card
+// that is still being held) keeps it there for this long.
+#define WIFI_WAKE_MS 1000
+
+// Supply current in each mode, in uA, for the estimate in network_stats_t.
+// From the ESP8266EX datasheet: receiving plus the CPU, and modem sleep.
+#define WIFI_CURRENT_AWAKE_UA 70000
+#define WIFI_CURRENT_SLEEP_UA 15000
+
+#if CONFIG_INTERLOCK_WIFI_POWER_SAVE
+#define WIFI_PS_IDLE WIFI_PS_MAX_MODEM
+#else
+#define WIFI_PS_IDLE WIFI_PS_NONE
+#endif
+
+#define WIFI_BSSID_FORMAT "%02x:%02x:%02x:%02x:%02x:%02x"
+#define WIFI_BSSID_ARGS(bssid) (bssid)[0], (bssid)[1], (bssid)[2], (bssid)[3], (bssid)[4], (bssid)[5]
+
 // Event group for wifi connection
 static EventGroupHandle_t wifi_event_group;
 
 #define WIFI_EVENT_GROUP_CONNECTED_BIT (1 << 0)
 
+static TaskHandle_t wifi_task_handle = NULL;
+static char wifi_ssid[33];
+
+// True while the station config is pinned to the AP restored from a warm boot
+static bool wifi_using_warm_boot_ap = false;
+
+// Associated with an AP, whether or not there is an IP yet
+static volatile bool wifi_associated = false;
+
+// Set for a static IP, which makes the station ready as soon as it associates
+static bool wifi_static_ip = false;
+
+// Guarded by critical sections
+static int64_t wifi_associated_time = 0;
+static bool wifi_ready_pending = false;  // Associated, waiting to be ready
+
+// Roaming, guarded by critical sections. A roam only starts when nothing holds
+// the network (see network_hold()).
+static uint8_t wifi_holds = 0;
+static bool wifi_roaming = false;
+static bool wifi_roam_scanning = false;  // Roaming, but still on the AP
+static int64_t wifi_roam_start = 0;
+static int64_t wifi_roam_scan_time = 0;  // When the last roaming scan started
+
+// Only written by the WiFi task, except the roam results from the event handler
+static network_stats_t wifi_stats = {0};
+static int32_t wifi_rssi_smoothed = 0;  // In 1/16 dBm, 0 until sampled
+static int32_t wifi_rssi_sum = 0;
+static uint8_t wifi_rssi_samples = 0;
+
+// Power save. wifi_ps_lock serialises changing the mode, the rest is guarded by
+// critical sections.
+static SemaphoreHandle_t wifi_ps_lock = NULL;
+static esp_timer_handle_t wifi_wake_timer = NULL;
+static bool wifi_waking = false;  // Within WIFI_WAKE_MS of a card read starting
+static int64_t wifi_wake_last = 0;  // When the last card read started
+static wifi_ps_type_t wifi_ps_mode = WIFI_PS_NONE;
+static int64_t wifi_ps_since = 0;  // When wifi_ps_mode was set
+static int64_t wifi_awake_us = 0;  // Time at full power before wifi_ps_since
+static int64_t wifi_asleep_us = 0;
+
+// Puts the radio in the mode wanted now: full power while anything holds the
+// network or a card is being read, otherwise WIFI_PS_IDLE.
+static void wifi_ps_apply(void) {
+    if (NULL == wifi_ps_lock) {
+        return;
+    }
+    xSemaphoreTake(wifi_ps_lock, portMAX_DELAY);
+
+    taskENTER_CRITICAL();
+    const wifi_ps_type_t mode = wifi_waking || 0 != wifi_holds ? WIFI_PS_NONE : WIFI_PS_IDLE;
+    const bool change = mode != wifi_ps_mode;
+    taskEXIT_CRITICAL();
+
+    const int64_t start = esp_timer_get_time();
+    if (change && ESP_OK == esp_wifi_set_ps(mode)) {
+        const int64_t now = esp_timer_get_time();
+        const uint32_t switch_us = now - start;
+
+        taskENTER_CRITICAL();
+        if (WIFI_PS_NONE == wifi_ps_mode) {
+            wifi_awake_us += now - wifi_ps_since;
+        } else {
+            wifi_asleep_us += now - wifi_ps_since;
+        }
+        wifi_ps_mode = mode;
+        wifi_ps_since = now;
+        if (WIFI_PS_NONE == mode) {
+            wifi_stats.wakes++;
+            if (switch_us > wifi_stats.wake_max_us) {
+                wifi_stats.wake_max_us = switch_us;
+            }
+        }
+        taskEXIT_CRITICAL();
+    }
+    xSemaphoreGive(wifi_ps_lock);
+}
+
+// Runs on the esp_timer task, straight away for network_wake(), so the mode
+// switch doesn't hold up the card read, then again once WIFI_WAKE_MS has
+// passed since the last read.
+static void wifi_wake_run(void* arg) {
+    const int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL();
+    const int64_t remaining_us = wifi_waking ? wifi_wake_last + WIFI_WAKE_MS * 1000LL - now : 0;
+    if (remaining_us <= 0) {
+        wifi_waking = false;
+    }
+    taskEXIT_CRITICAL();
+
+    wifi_ps_apply();
+    if (remaining_us > 0) {
+        esp_timer_start_once(wifi_wake_timer, remaining_us);
+    }
+}
+
+// Marks the station ready once it has an IP: from DHCP, or straight after
+// associating with a static IP.
+static void wifi_ready(void) {
+    const int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL();
+    const bool pending = wifi_ready_pending;
+    wifi_ready_pending = false;
+    const uint32_t ready_ms = (now - wifi_associated_time) / 1000;
+    if (pending) {
+        wifi_stats.ready_last_ms = ready_ms;
+        if (ready_ms > wifi_stats.ready_max_ms) {
+            wifi_stats.ready_max_ms = ready_ms;
+        }
+    }
+    const bool roamed = pending && wifi_roaming;
+    const uint32_t roam_ms = (now - wifi_roam_start) / 1000;
+    if (roamed) {
+        wifi_roaming = false;
+        wifi_stats.roams++;
+        wifi_stats.roam_last_ms = roam_ms;
+        if (roam_ms > wifi_stats.roam_max_ms) {
+            wifi_stats.roam_max_ms = roam_ms;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    // Already ready, e.g. the SDK reporting a static IP
+    if (!pending) {
+        return;
+    }
+
+    xEventGroupSetBits(wifi_event_group, WIFI_EVENT_GROUP_CONNECTED_BIT);
+    // The portal client moves this to idle once its session is up
+    led_animation_set_status(LED_STATUS_OFFLINE);
+
+    ESP_LOGI("wifi", "Ready %u ms after associating (%s)", ready_ms, wifi_static_ip ? "static IP" : "DHCP");
+    if (roamed) {
+        ESP_LOGI("wifi", "Roamed in %u ms", roam_ms);
+    }
+}
+
 static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
     // Wifi Events
     if (WIFI_EVENT == event_base) {
 
-        // Connect to WiFi on start event
+        // Connect straight away to the AP from the last boot, otherwise the
+        // WiFi task scans for the best one
         if (WIFI_EVENT_STA_START == event_id) {
-            esp_wifi_connect();
+            if (wifi_using_warm_boot_ap) {
+                esp_wifi_connect();
+            } else {
+                xTaskNotifyGive(wifi_task_handle);
+            }
+        }
+
+        // Remember the AP for the next warm boot
+        if (WIFI_EVENT_STA_CONNECTED == event_id) {
+            const wifi_event_sta_connected_t* connected = event_data;
+            wifi_associated = true;
+            taskENTER_CRITICAL();
+            wifi_associated_time = esp_timer_get_time();
+            wifi_ready_pending = true;
+            taskEXIT_CRITICAL();
+
+            // The SDK's handler, which runs first, has already brought the
+            // interface up with the static IP, so there's nothing to wait for
+            if (wifi_static_ip) {
+                wifi_ready();
+            }
+            warm_boot_save_network_state(connected->bssid, connected->channel);
         }
 
         // Clear connected bit if we become disconnected
         if (WIFI_EVENT_STA_DISCONNECTED == event_id) {
+            wifi_associated = false;
             xEventGroupClearBits(wifi_event_group, WIFI_EVENT_GROUP_CONNECTED_BIT);
+            led_animation_set_status(LED_STATUS_CONNECTING);
+
+            // The AP from the last boot may be gone, fall back to any AP
+            if (wifi_using_warm_boot_ap) {
+                wifi_using_warm_boot_ap = false;
+                wifi_config_t wifi_config;
+                esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_config);
+                wifi_config.sta.bssid_set = false;
+                wifi_config.sta.channel = 0;
+                esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
+            }
         }
     }
 
@@ -44,60 +272,378 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t e
 
         // Set connected bit if we got an IP
         if (IP_EVENT_STA_GOT_IP == event_id) {
-            xEventGroupSetBits(wifi_event_group, WIFI_EVENT_GROUP_CONNECTED_BIT);
+            wifi_ready();
+        }
+    }
+}
+
+// Scans for the configured SSID, on every channel with the driver's default
+// dwell if `channel` is 0, otherwise on `channel` for at most
+// WIFI_ROAM_SCAN_DWELL_MS.
+//
+// Returns true if it was found, with the strongest BSS in `out_best`.
+static bool wifi_scan(uint8_t channel, wifi_ap_record_t* out_best) {
+    wifi_scan_config_t scan_config = {
+        .ssid = (uint8_t*)wifi_ssid,
+        .channel = channel,
+        .show_hidden = true,
+        .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+    };
+    if (0 != channel) {
+        scan_config.scan_time.active.max = WIFI_ROAM_SCAN_DWELL_MS;
+    }
+    if (ESP_OK != esp_wifi_scan_start(&scan_config, true)) {
+        return false;
+    }
+
+    wifi_ap_record_t records[WIFI_SCAN_MAX];
+    uint16_t count = WIFI_SCAN_MAX;
+    if (ESP_OK != esp_wifi_scan_get_ap_records(&count, records) || 0 == count) {
+        return false;
+    }
+
+    *out_best = records[0];
+    for (uint16_t i = 1; i < count; i++) {
+        if (records[i].rssi > out_best->rssi) {
+            *out_best = records[i];
+        }
+    }
+    return true;
+}
+
+// Pins the station to `bssid`, or frees it to join any AP if NULL.
+static void wifi_pin(const uint8_t* bssid, uint8_t channel) {
+    wifi_config_t wifi_config;
+    esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_config);
+    wifi_config.sta.bssid_set = NULL != bssid;
+    if (NULL != bssid) {
+        memcpy(wifi_config.sta.bssid, bssid, sizeof(wifi_config.sta.bssid));
+    }
+    wifi_config.sta.channel = channel;
+    esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
+    wifi_using_warm_boot_ap = false;
+}
+
+static void wifi_connect(void) {
+    ESP_LOGI("wifi", "Attempting to reconnect to WiFi");
+
+    // Join the strongest AP rather than the first one the driver finds
+    wifi_ap_record_t best;
+    if (wifi_scan(0, &best)) {
+        ESP_LOGI("wifi", "Strongest AP " WIFI_BSSID_FORMAT " on channel %u, RSSI %d", WIFI_BSSID_ARGS(best.bssid),
+                 best.primary, best.rssi);
+        wifi_pin(best.bssid, best.primary);
+    } else {
+        wifi_pin(NULL, 0);
+    }
+    esp_wifi_connect();
+}
+
+// Scans for the strongest AP one channel at a time, going back to the current
+// AP's channel in between. Stops early if something holds the network.
+//
+// Returns true if the scan finished and found the SSID, with the strongest BSS
+// in `out_best`.
+static bool wifi_roam_scan(wifi_ap_record_t* out_best) {
+    wifi_country_t country;
+    if (ESP_OK != esp_wifi_get_country(&country) || 0 == country.schan || 0 == country.nchan) {
+        country.schan = 1;
+        country.nchan = 13;
+    }
+
+    bool found = false;
+    for (uint8_t channel = country.schan; channel < country.schan + country.nchan; channel++) {
+        wifi_ap_record_t best;
+        if (wifi_scan(channel, &best) && (!found || best.rssi > out_best->rssi)) {
+            *out_best = best;
+            found = true;
         }
+
+        taskENTER_CRITICAL();
+        const bool held = 0 != wifi_holds;
+        taskEXIT_CRITICAL();
+        if (held) {
+            ESP_LOGI("wifi", "Roaming scan stopped at channel %u for an access check", channel);
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(WIFI_ROAM_SCAN_GAP_MS));
+    }
+    return found;
+}
+
+// Keeps the RSSI history, and moves to a stronger AP once the signal is weak.
+static void wifi_monitor(void) {
+    wifi_ap_record_t current;
+    if (ESP_OK != esp_wifi_sta_get_ap_info(&current)) {
+        return;
+    }
+
+    wifi_rssi_smoothed = 0 == wifi_rssi_smoothed ? current.rssi * 16
+                                                 : wifi_rssi_smoothed + (current.rssi * 16 - wifi_rssi_smoothed) / 4;
+    wifi_rssi_sum += current.rssi;
+    if (++wifi_rssi_samples >= WIFI_HISTORY_SAMPLES) {
+        taskENTER_CRITICAL();
+        memmove(&wifi_stats.rssi_history[0], &wifi_stats.rssi_history[1], NETWORK_RSSI_HISTORY - 1);
+        wifi_stats.rssi_history[NETWORK_RSSI_HISTORY - 1] = wifi_rssi_sum / wifi_rssi_samples;
+        taskEXIT_CRITICAL();
+        wifi_rssi_sum = 0;
+        wifi_rssi_samples = 0;
+    }
+
+    const int64_t now = esp_timer_get_time();
+    if (wifi_rssi_smoothed / 16 >= WIFI_ROAM_RSSI ||
+        (0 != wifi_roam_scan_time && now - wifi_roam_scan_time < WIFI_ROAM_SCAN_INTERVAL_MS * 1000LL)) {
+        return;
+    }
+
+    // The scan takes the radio off channel, so it waits for any access check,
+    // and gives way to one that starts while it runs
+    taskENTER_CRITICAL();
+    const bool idle = 0 == wifi_holds;
+    if (idle) {
+        wifi_roaming = true;
+        wifi_roam_scanning = true;
+        wifi_roam_start = now;
+    }
+    taskEXIT_CRITICAL();
+    if (!idle) {
+        return;
+    }
+    wifi_roam_scan_time = now;
+
+    wifi_ap_record_t best;
+    const bool found = wifi_roam_scan(&best);
+
+    // Once the scan is over, holds wait for the roam again
+    taskENTER_CRITICAL();
+    wifi_roam_scanning = false;
+    const bool held = 0 != wifi_holds;
+    const bool roam = !held && found && 0 != memcmp(best.bssid, current.bssid, sizeof(best.bssid)) &&
+                      best.rssi >= current.rssi + WIFI_ROAM_HYSTERESIS_DB;
+    if (!roam) {
+        wifi_roaming = false;
+    }
+    taskEXIT_CRITICAL();
+
+    if (roam) {
+        ESP_LOGI("wifi",
+                 "Roaming from " WIFI_BSSID_FORMAT " (RSSI %d) to " WIFI_BSSID_FORMAT " on channel %u (RSSI %d)",
+                 WIFI_BSSID_ARGS(current.bssid), current.rssi, WIFI_BSSID_ARGS(best.bssid), best.primary,
+                 best.rssi);
+        wifi_rssi_smoothed = 0;
+        wifi_pin(best.bssid, best.primary);
+
+        taskENTER_CRITICAL();
+        wifi_roam_start = esp_timer_get_time();
+        taskEXIT_CRITICAL();
+        esp_wifi_disconnect();
+        esp_wifi_connect();
+        return;
+    }
+
+    if (found) {
+        ESP_LOGI("wifi", "RSSI %d, no stronger AP", current.rssi);
     }
 }
 
-// This task is responsible for restarting the WiFi if it disconnects.
-static void wifi_watchdog_task(void* ptr_to_wifi_task_ctx) {
+// This task is responsible for restarting the WiFi if it disconnects, and for
+// roaming.
+static void wifi_task(void* arg) {
     // Random delay to stop all the interlocks hammering the AP at the same time
     const TickType_t random_delay = pdMS_TO_TICKS(esp_random() % 1500);
 
     while (1) {
-        if (!(xEventGroupGetBits(wifi_event_group) & WIFI_EVENT_GROUP_CONNECTED_BIT)) {
-            ESP_LOGI("wifi_watchdog", "Attempting to reconnect to WiFi");
-            esp_wifi_connect();
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WIFI_MONITOR_MS) + random_delay);
+
+        if (xEventGroupGetBits(wifi_event_group) & WIFI_EVENT_GROUP_CONNECTED_BIT) {
+            wifi_monitor();
+            continue;
+        }
+
+        // Give a roam time to finish before starting over
+        taskENTER_CRITICAL();
+        const bool roaming = wifi_roaming && esp_timer_get_time() - wifi_roam_start < WIFI_ROAM_TIMEOUT_MS * 1000LL;
+        if (!roaming) {
+            wifi_roaming = false;
+        }
+        taskEXIT_CRITICAL();
+
+        if (!roaming && !wifi_associated) {
+            wifi_connect();
         }
-        vTaskDelay(pdMS_TO_TICKS(5000) + random_delay);
     }
 }
 
-static void wifi_start(const char* wifi_ssid, const char* wifi_psk) {
+static void wifi_start(const char* ssid, const char* wifi_psk, const config_static_ip_t* static_ip) {
     // Set up event group
     wifi_event_group = xEventGroupCreate();
+    strlcpy(wifi_ssid, ssid, sizeof(wifi_ssid));
 
     // Init Wifi
     wifi_init_config_t wifi_init_config = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&wifi_init_config));
 
+    // A static IP replaces DHCP, and is in place before the station joins
+    if (NULL != static_ip) {
+        tcpip_adapter_ip_info_t ip_info;
+        ip4_addr_set_u32(&ip_info.ip, static_ip->ip);
+        ip4_addr_set_u32(&ip_info.netmask, static_ip->netmask);
+        ip4_addr_set_u32(&ip_info.gw, static_ip->gateway);
+        tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA);
+        ESP_ERROR_CHECK(tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &ip_info));
+
+        ip_addr_t dns;
+        ip_addr_set_ip4_u32(&dns, static_ip->dns);
+        dns_setserver(0, &dns);
+        wifi_static_ip = true;
+    }
+
     // Event handler
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
 
     // Configure WiFi
     wifi_config_t wifi_config = {0};
-    strlcpy((char*)wifi_config.sta.ssid, wifi_ssid, sizeof(wifi_config.sta.ssid));
+    strlcpy((char*)wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid));
     strlcpy((char*)wifi_config.sta.password, wifi_psk, sizeof(wifi_config.sta.password));
+#if CONFIG_INTERLOCK_WIFI_POWER_SAVE
+    wifi_config.sta.listen_interval = CONFIG_INTERLOCK_WIFI_LISTEN_INTERVAL;
+#endif
+
+    // After a warm boot go straight to the last AP instead of scanning
+    if (warm_boot_get_network_state(wifi_config.sta.bssid, &wifi_config.sta.channel)) {
+        wifi_config.sta.bssid_set = true;
+        wifi_using_warm_boot_ap = true;
+    }
+
+    // The task must exist before the start event asks it to scan
+    if (pdPASS == xTaskCreate(wifi_task, "WiFi", 2560, NULL, tskIDLE_PRIORITY + 1, &wifi_task_handle)) {
+        health_watch_task(wifi_task_handle);
+    }
+
+    // Start idle, until something needs the radio
+    const esp_timer_create_args_t wake_timer_args = {
+        .callback = wifi_wake_run,
+        .name = "WiFi Wake",
+    };
+    wifi_ps_lock = xSemaphoreCreateMutex();
+    ESP_ERROR_CHECK(NULL == wifi_ps_lock ? ESP_ERR_NO_MEM : ESP_OK);
+    ESP_ERROR_CHECK(esp_timer_create(&wake_timer_args, &wifi_wake_timer));
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_IDLE));
+    wifi_ps_mode = WIFI_PS_IDLE;
+    wifi_ps_since = esp_timer_get_time();
 
     // Start WiFi
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
-
-    // Start watchdog
-    xTaskCreate(wifi_watchdog_task, "WiFi Watchdog", 1024, NULL, tskIDLE_PRIORITY + 1, NULL);
 }
 
 // =============================================================================
 // Network
 // =============================================================================
 
-void network_start(const char* wifi_ssid, const char* wifi_psk) {
+void network_start(const char* wifi_ssid, const char* wifi_psk, const config_static_ip_t* static_ip) {
     // Net
     tcpip_adapter_init();
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
     // Wifi
-    wifi_start(wifi_ssid, wifi_psk);
-}
\ No newline at end of file
+    wifi_start(wifi_ssid, wifi_psk, static_ip);
+}
+
+bool network_is_connected(void) {
+    return NULL != wifi_event_group && (xEventGroupGetBits(wifi_event_group) & WIFI_EVENT_GROUP_CONNECTED_BIT);
+}
+
+bool network_wait_for_connection(TickType_t timeout) {
+    if (NULL == wifi_event_group) {
+        return false;
+    }
+
+    const EventBits_t bits =
+        xEventGroupWaitBits(wifi_event_group, WIFI_EVENT_GROUP_CONNECTED_BIT, pdFALSE, pdTRUE, timeout);
+    return bits & WIFI_EVENT_GROUP_CONNECTED_BIT;
+}
+
+bool network_get_rssi(int8_t* out_rssi) {
+    wifi_ap_record_t ap;
+    if (!network_is_connected() || ESP_OK != esp_wifi_sta_get_ap_info(&ap)) {
+        return false;
+    }
+    *out_rssi = ap.rssi;
+    return true;
+}
+
+bool network_hold(void) {
+    // A roam that is still scanning stops after the channel it is on
+    taskENTER_CRITICAL();
+    const bool held = !wifi_roaming || wifi_roam_scanning;
+    if (held) {
+        wifi_holds++;
+    }
+    taskEXIT_CRITICAL();
+    if (held) {
+        wifi_ps_apply();
+    }
+    return held;
+}
+
+void network_release(void) {
+    // The last hold ending also ends the wake for the card read that led to
+    // it. The timer is stopped before the wake is cleared, so it can't be left
+    // waking with no timer to end it.
+    taskENTER_CRITICAL();
+    if (wifi_holds > 0) {
+        wifi_holds--;
+    }
+    const bool idle = 0 == wifi_holds;
+    taskEXIT_CRITICAL();
+    if (idle && NULL != wifi_wake_timer) {
+        esp_timer_stop(wifi_wake_timer);
+        taskENTER_CRITICAL();
+        if (0 == wifi_holds) {
+            wifi_waking = false;
+        }
+        taskEXIT_CRITICAL();
+        wifi_ps_apply();
+    }
+}
+
+void network_wake(void) {
+    if (WIFI_PS_NONE == WIFI_PS_IDLE || NULL == wifi_wake_timer) {
+        return;
+    }
+
+    // Called for every frame while a card is held up, so only the first sets
+    // the timer going, and later ones just push the end of the wake back
+    taskENTER_CRITICAL();
+    const bool woken = !wifi_waking;
+    wifi_waking = true;
+    wifi_wake_last = esp_timer_get_time();
+    taskEXIT_CRITICAL();
+    if (woken) {
+        esp_timer_stop(wifi_wake_timer);
+        esp_timer_start_once(wifi_wake_timer, 0);
+    }
+}
+
+void network_get_stats(network_stats_t* out_stats) {
+    const int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL();
+    *out_stats = wifi_stats;
+    int64_t awake_us = wifi_awake_us;
+    int64_t asleep_us = wifi_asleep_us;
+    if (WIFI_PS_NONE == wifi_ps_mode) {
+        awake_us += now - wifi_ps_since;
+    } else {
+        asleep_us += now - wifi_ps_since;
+    }
+    taskEXIT_CRITICAL();
+
+    const int64_t total_us = awake_us + asleep_us;
+    out_stats->current_ua = 0 == total_us ? WIFI_CURRENT_AWAKE_UA
+                                          : (awake_us * WIFI_CURRENT_AWAKE_UA + asleep_us * WIFI_CURRENT_SLEEP_UA) /
+                                                total_us;
+}
@@ -1,3 +1,65 @@
 #pragma once
 
-void network_start(const char* wifi_ssid, const char* wifi_psk);
\ No newline at end of file
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "freertos/FreeRTOS.h"
+
+// Minutes of RSSI kept in network_stats_t
+#define NETWORK_RSSI_HISTORY 8
+
+typedef struct network_stats {
+    uint32_t roams;         // Moves to a stronger AP
+    uint32_t roam_last_ms;  // From leaving one AP to having an IP on the next
+    uint32_t roam_max_ms;
+    int8_t rssi_history[NETWORK_RSSI_HISTORY];  // Average of each minute, oldest first, 0 if none
+    uint32_t wakes;                             // Switches from power save to full power
+    uint32_t wake_max_us;                       // Longest a switch to full power took
+    uint32_t current_ua;                        // Estimated average supply current since boot
+    uint32_t ready_last_ms;                     // From associating to having an IP
+    uint32_t ready_max_ms;
+} network_stats_t;
+
+// Starts the WiFi. The station joins the strongest AP for `wifi_ssid`, and
+// moves to a stronger one if its signal gets weak. With INTERLOCK_WIFI_POWER_SAVE
+// the radio sleeps between beacons unless the network is held or woken.
+//
+// The address comes from DHCP, unless `static_ip` is given, in which case the
+// network is ready as soon as the station associates.
+void network_start(const char* wifi_ssid, const char* wifi_psk, const config_static_ip_t* static_ip);
+
+// Returns true while the WiFi is connected and has an IP.
+bool network_is_connected(void);
+
+// Blocks until the WiFi is connected and has an IP, or `timeout` passes.
+//
+// Returns true if connected.
+bool network_wait_for_connection(TickType_t timeout);
+
+// Gets the signal strength of the AP, in dBm.
+//
+// Returns false if not connected.
+bool network_get_rssi(int8_t* out_rssi);
+
+// Keeps the device on its AP, with the radio at full power, until
+// network_release(), so a roam or power save can't hold up a request that is
+// under way. Holds nest.
+//
+// A roaming scan that is under way stops after the channel it is on. Returns
+// false, without holding, if the device is already moving to another AP. The
+// caller carries on but must not call network_release().
+bool network_hold(void);
+
+// Ends a network_hold(). The last one also ends any network_wake().
+void network_release(void);
+
+// Switches the radio to full power ahead of a request that is likely to
+// follow, such as a card check once a card has been read. It stays there until
+// the request's hold is released, or for a second if none comes. Only marks the
+// wake and leaves the switch to the esp_timer task, so it can be used as the
+// RFID frame hook. Does nothing without power save.
+void network_wake(void);
+
+// Gets a copy of the roaming and power counters and RSSI history.
+void network_get_stats(network_stats_t* out_stats);
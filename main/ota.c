@@ -0,0 +1,556 @@
+#include "ota.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+#include "network.h"
+#include "portal.h"
+
+#define TAG "ota"
+
+// Flash is erased and written a sector at a time, so the image is collected
+// into blocks of this size
+#define OTA_BLOCK_SIZE 4096
+
+#define OTA_HTTP_TIMEOUT_MS 10000
+
+// Log progress every this many bytes
+#define OTA_PROGRESS_BYTES (128 * 1024)
+
+// Time for the result to reach the portal before restarting
+#define OTA_RESTART_DELAY_MS 1000
+
+// Delta patches rebuild the new image from the running one. A patch is:
+//
+//   "ILD1", the build ID of the image it applies to (8 bytes), the size of the
+//   new image (varint), then ops until the new image is complete.
+//
+// Each op starts with a varint of length << 2 | op. Varints are unsigned
+// LEB128, as in the portal's binary messages.
+#define OTA_PATCH_MAGIC "ILD1"
+#define OTA_PATCH_HEADER_SIZE 12
+
+typedef enum ota_patch_op {
+    OTA_PATCH_COPY = 0,     // Zigzag varint moving the old image cursor, then copy `length` bytes from it
+    OTA_PATCH_INSERT = 1,   // `length` new bytes
+    OTA_PATCH_REPLACE = 2,  // `length` new bytes, in place of as many old ones
+} ota_patch_op_t;
+
+// Old image bytes read at a time
+#define OTA_PATCH_READ_SIZE 256
+
+// =============================================================================
+// Types
+// =============================================================================
+
+typedef struct ota_request {
+    char url[OTA_URL_MAX];
+    uint32_t size;  // Of the download
+    uint8_t sha256[32];
+    bool delta;
+} ota_request_t;
+
+// Writes an image into the inactive partition as it arrives
+typedef struct ota_writer {
+    const esp_partition_t* partition;
+    uint8_t* block;
+    size_t block_used;
+    uint32_t offset;   // Of the block in the partition
+    uint32_t written;  // Total bytes given to the writer
+    mbedtls_sha256_context sha;
+
+    // Time spent on each step, for the stats
+    int64_t flash_time;
+    int64_t hash_time;
+} ota_writer_t;
+
+typedef enum ota_patch_state {
+    OTA_PATCH_STATE_HEADER,
+    OTA_PATCH_STATE_SIZE,
+    OTA_PATCH_STATE_OP,
+    OTA_PATCH_STATE_DELTA,  // Varint after a copy
+    OTA_PATCH_STATE_DATA,   // Bytes of an insert or replace
+    OTA_PATCH_STATE_DONE,
+} ota_patch_state_t;
+
+// Applies a patch as it arrives. Only the op in progress is held in RAM.
+typedef struct ota_patch {
+    ota_patch_state_t state;
+    uint8_t header[OTA_PATCH_HEADER_SIZE];
+    size_t header_used;
+    uint64_t varint;  // Varint being decoded
+    uint8_t shift;
+
+    const esp_partition_t* old;
+    uint32_t old_offset;  // Cursor in the old image
+    uint32_t new_size;
+    uint8_t op;
+    uint32_t length;  // Left in the current op
+
+    // Stats
+    uint32_t copied;
+    uint32_t inserted;
+    uint32_t ops;
+    int64_t read_time;
+} ota_patch_t;
+
+// =============================================================================
+// State
+// =============================================================================
+
+static volatile bool ota_running = false;
+static ota_request_t ota_request;
+
+// =============================================================================
+// Writer
+// =============================================================================
+
+static bool ota_writer_begin(ota_writer_t* writer, uint32_t size) {
+    memset(writer, 0, sizeof(*writer));
+    writer->partition = esp_ota_get_next_update_partition(NULL);
+    if (NULL == writer->partition) {
+        ESP_LOGE(TAG, "No OTA partition to update");
+        return false;
+    }
+    if (size > writer->partition->size) {
+        ESP_LOGE(TAG, "Image of %u bytes does not fit in %s (%u bytes)", size, writer->partition->label,
+                 writer->partition->size);
+        return false;
+    }
+
+    writer->block = malloc(OTA_BLOCK_SIZE);
+    if (NULL == writer->block) {
+        return false;
+    }
+    mbedtls_sha256_init(&writer->sha);
+    mbedtls_sha256_starts_ret(&writer->sha, 0);
+    return true;
+}
+
+// Erases the next sector and writes the block to it.
+static bool ota_writer_flush(ota_writer_t* writer) {
+    if (0 == writer->block_used) {
+        return true;
+    }
+
+    const int64_t start_time = esp_timer_get_time();
+    esp_err_t err = esp_partition_erase_range(writer->partition, writer->offset, OTA_BLOCK_SIZE);
+    if (ESP_OK == err) {
+        err = esp_partition_write(writer->partition, writer->offset, writer->block, writer->block_used);
+    }
+    writer->flash_time += esp_timer_get_time() - start_time;
+
+    if (ESP_OK != err) {
+        ESP_LOGE(TAG, "Flash write at 0x%x failed: %s", writer->partition->address + writer->offset,
+                 esp_err_to_name(err));
+        return false;
+    }
+    writer->offset += OTA_BLOCK_SIZE;
+    writer->block_used = 0;
+    return true;
+}
+
+static bool ota_writer_write(ota_writer_t* writer, const uint8_t* data, size_t size) {
+    if (writer->offset + writer->block_used + size > writer->partition->size) {
+        ESP_LOGE(TAG, "Image overflows %s", writer->partition->label);
+        return false;
+    }
+
+    const int64_t start_time = esp_timer_get_time();
+    mbedtls_sha256_update_ret(&writer->sha, data, size);
+    writer->hash_time += esp_timer_get_time() - start_time;
+    writer->written += size;
+
+    while (size > 0) {
+        const size_t space = OTA_BLOCK_SIZE - writer->block_used;
+        const size_t piece = size < space ? size : space;
+        memcpy(&writer->block[writer->block_used], data, piece);
+        writer->block_used += piece;
+        data += piece;
+        size -= piece;
+
+        if (OTA_BLOCK_SIZE == writer->block_used && !ota_writer_flush(writer)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Writes what is left, checks the hash and, if it matches, makes the new image
+// the boot partition. The bootloader's own image checks are run by
+// esp_ota_set_boot_partition().
+static bool ota_writer_finish(ota_writer_t* writer, const uint8_t sha256[32]) {
+    if (!ota_writer_flush(writer)) {
+        return false;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish_ret(&writer->sha, digest);
+    if (0 != memcmp(digest, sha256, sizeof(digest))) {
+        ESP_LOGE(TAG, "Image SHA-256 does not match, discarding it");
+        return false;
+    }
+
+    const esp_err_t err = esp_ota_set_boot_partition(writer->partition);
+    if (ESP_OK != err) {
+        ESP_LOGE(TAG, "Unable to boot from %s: %s", writer->partition->label, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+static void ota_writer_free(ota_writer_t* writer) {
+    mbedtls_sha256_free(&writer->sha);
+    free(writer->block);
+    writer->block = NULL;
+}
+
+// =============================================================================
+// Delta Patches
+// =============================================================================
+
+static void ota_patch_begin(ota_patch_t* patch) {
+    memset(patch, 0, sizeof(*patch));
+    patch->old = esp_ota_get_running_partition();
+}
+
+// Copies `length` bytes from the old image at the cursor.
+static bool ota_patch_copy(ota_patch_t* patch, ota_writer_t* writer, uint32_t length) {
+    if (patch->old_offset > patch->old->size || length > patch->old->size - patch->old_offset) {
+        ESP_LOGE(TAG, "Patch copies past the end of the running image");
+        return false;
+    }
+
+    uint8_t buffer[OTA_PATCH_READ_SIZE];
+    while (length > 0) {
+        const size_t piece = length < sizeof(buffer) ? length : sizeof(buffer);
+        const int64_t start_time = esp_timer_get_time();
+        const esp_err_t err = esp_partition_read(patch->old, patch->old_offset, buffer, piece);
+        patch->read_time += esp_timer_get_time() - start_time;
+        if (ESP_OK != err || !ota_writer_write(writer, buffer, piece)) {
+            return false;
+        }
+        patch->old_offset += piece;
+        patch->copied += piece;
+        length -= piece;
+    }
+    return true;
+}
+
+// Moves on to the next op, or finishes once the new image is complete.
+static void ota_patch_next(ota_patch_t* patch, const ota_writer_t* writer) {
+    patch->state = writer->written == patch->new_size ? OTA_PATCH_STATE_DONE : OTA_PATCH_STATE_OP;
+}
+
+// Handles a complete varint.
+static bool ota_patch_varint(ota_patch_t* patch, ota_writer_t* writer, uint64_t value) {
+    switch (patch->state) {
+        case OTA_PATCH_STATE_SIZE:
+            if (value > writer->partition->size) {
+                ESP_LOGE(TAG, "Patched image of %s bytes won't fit", U64_DEC(value));
+                return false;
+            }
+            patch->new_size = value;
+            ota_patch_next(patch, writer);
+            return true;
+
+        case OTA_PATCH_STATE_OP:
+            patch->op = value & 0x03;
+            value >>= 2;
+            if (0 == value || value > patch->new_size - writer->written || patch->op > OTA_PATCH_REPLACE) {
+                ESP_LOGE(TAG, "Bad patch op");
+                return false;
+            }
+            patch->length = value;
+            patch->ops++;
+            patch->state = OTA_PATCH_COPY == patch->op ? OTA_PATCH_STATE_DELTA : OTA_PATCH_STATE_DATA;
+            return true;
+
+        case OTA_PATCH_STATE_DELTA: {
+            // Zigzag, so small moves either way are short
+            const int64_t delta = (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+            const int64_t offset = (int64_t)patch->old_offset + delta;
+            if (offset < 0 || offset > patch->old->size) {
+                ESP_LOGE(TAG, "Patch moves outside the running image");
+                return false;
+            }
+            patch->old_offset = offset;
+            if (!ota_patch_copy(patch, writer, patch->length)) {
+                return false;
+            }
+            ota_patch_next(patch, writer);
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+static bool ota_patch_feed(ota_patch_t* patch, ota_writer_t* writer, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        switch (patch->state) {
+            case OTA_PATCH_STATE_HEADER: {
+                const size_t piece = OTA_PATCH_HEADER_SIZE - patch->header_used < size
+                                         ? OTA_PATCH_HEADER_SIZE - patch->header_used
+                                         : size;
+                memcpy(&patch->header[patch->header_used], data, piece);
+                patch->header_used += piece;
+                data += piece;
+                size -= piece;
+                if (OTA_PATCH_HEADER_SIZE > patch->header_used) {
+                    break;
+                }
+
+                const esp_app_desc_t* desc = esp_ota_get_app_description();
+                if (0 != memcmp(patch->header, OTA_PATCH_MAGIC, 4)) {
+                    ESP_LOGE(TAG, "Not a patch");
+                    return false;
+                }
+                if (0 != memcmp(&patch->header[4], desc->app_elf_sha256, 8)) {
+                    ESP_LOGE(TAG, "Patch is for a different build");
+                    return false;
+                }
+                patch->state = OTA_PATCH_STATE_SIZE;
+                break;
+            }
+
+            case OTA_PATCH_STATE_SIZE:
+            case OTA_PATCH_STATE_OP:
+            case OTA_PATCH_STATE_DELTA: {
+                const uint8_t byte = *data++;
+                size--;
+                if (patch->shift > 63) {
+                    return false;
+                }
+                patch->varint |= (uint64_t)(byte & 0x7F) << patch->shift;
+                patch->shift += 7;
+                if (byte & 0x80) {
+                    break;
+                }
+
+                const uint64_t value = patch->varint;
+                patch->varint = 0;
+                patch->shift = 0;
+                if (!ota_patch_varint(patch, writer, value)) {
+                    return false;
+                }
+                break;
+            }
+
+            case OTA_PATCH_STATE_DATA: {
+                const size_t piece = patch->length < size ? patch->length : size;
+                if (!ota_writer_write(writer, data, piece)) {
+                    return false;
+                }
+                if (OTA_PATCH_REPLACE == patch->op) {
+                    patch->old_offset += piece;
+                }
+                patch->inserted += piece;
+                patch->length -= piece;
+                data += piece;
+                size -= piece;
+                if (0 == patch->length) {
+                    ota_patch_next(patch, writer);
+                }
+                break;
+            }
+
+            case OTA_PATCH_STATE_DONE:
+                ESP_LOGE(TAG, "Data after the end of the patch");
+                return false;
+        }
+    }
+    return true;
+}
+
+// =============================================================================
+// Download
+// =============================================================================
+
+// Streams the download from an opened request into the writer, through `patch`
+// for a delta update.
+//
+// Returns false on any failure, with `out_reason` set to the step that failed.
+static bool ota_receive(esp_http_client_handle_t client, const ota_request_t* request, ota_writer_t* writer,
+                        ota_patch_t* patch, int64_t* out_network_time, const char** out_reason) {
+    int64_t start_time = esp_timer_get_time();
+    const int length = esp_http_client_fetch_headers(client);
+    const int status = esp_http_client_get_status_code(client);
+    *out_network_time += esp_timer_get_time() - start_time;
+    if (200 != status || (length >= 0 && (uint32_t)length != request->size)) {
+        ESP_LOGE(TAG, "Server answered %d with %d bytes, expected 200 with %u", status, length, request->size);
+        *out_reason = "response";
+        return false;
+    }
+
+    uint8_t buffer[512];
+    uint32_t received = 0;
+    uint32_t next_progress = OTA_PROGRESS_BYTES;
+    while (received < request->size) {
+        const uint32_t left = request->size - received;
+        start_time = esp_timer_get_time();
+        const int ret = esp_http_client_read(client, (char*)buffer, left < sizeof(buffer) ? left : sizeof(buffer));
+        *out_network_time += esp_timer_get_time() - start_time;
+
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "Download stopped after %u of %u bytes", received, request->size);
+            *out_reason = "download";
+            return false;
+        }
+        received += ret;
+
+        const bool written = NULL != patch ? ota_patch_feed(patch, writer, buffer, ret)
+                                           : ota_writer_write(writer, buffer, ret);
+        if (!written) {
+            *out_reason = NULL != patch ? "patch" : "flash";
+            return false;
+        }
+
+        if (received >= next_progress) {
+            ESP_LOGI(TAG, "%u of %u bytes", received, request->size);
+            next_progress += OTA_PROGRESS_BYTES;
+        }
+    }
+
+    if (NULL != patch && OTA_PATCH_STATE_DONE != patch->state) {
+        ESP_LOGE(TAG, "Patch ended early");
+        *out_reason = "patch";
+        return false;
+    }
+    return true;
+}
+
+static bool ota_download(const ota_request_t* request, ota_writer_t* writer, ota_patch_t* patch,
+                         int64_t* out_network_time, const char** out_reason) {
+    const esp_http_client_config_t config = {
+        .url = request->url,
+        .timeout_ms = OTA_HTTP_TIMEOUT_MS,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (NULL == client) {
+        *out_reason = "http";
+        return false;
+    }
+
+    const int64_t start_time = esp_timer_get_time();
+    const bool opened = ESP_OK == esp_http_client_open(client, 0);
+    *out_network_time += esp_timer_get_time() - start_time;
+
+    bool ok = false;
+    if (!opened) {
+        ESP_LOGE(TAG, "Unable to connect to %s", request->url);
+        *out_reason = "connect";
+    } else {
+        ok = ota_receive(client, request, writer, patch, out_network_time, out_reason);
+    }
+
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return ok;
+}
+
+// =============================================================================
+// Task
+// =============================================================================
+
+static void ota_report(const char* status, const char* reason, int64_t time_ms) {
+    char message[PORTAL_MESSAGE_MAX];
+    snprintf(message, sizeof(message),
+             "{\"command\":\"update_status\",\"status\":\"%s\",\"reason\":\"%s\",\"ms\":%s}", status, reason,
+             I64_DEC(time_ms));
+    portal_send(message);
+}
+
+static void ota_task(void* arg) {
+    static ota_writer_t writer;
+    static ota_patch_t patch;
+    const char* reason = "memory";
+    int64_t network_time = 0;
+
+    const int64_t start_time = esp_timer_get_time();
+    ESP_LOGI(TAG, "Updating from %s (%u byte %s)", ota_request.url, ota_request.size,
+             ota_request.delta ? "patch" : "image");
+
+    // A patch's output size is only known from its header. Roaming would cut
+    // the download off.
+    ota_patch_begin(&patch);
+    const bool held = network_hold();
+    bool ok = ota_writer_begin(&writer, ota_request.delta ? 0 : ota_request.size) &&
+              ota_download(&ota_request, &writer, ota_request.delta ? &patch : NULL, &network_time, &reason);
+    if (held) {
+        network_release();
+    }
+    if (ok) {
+        reason = "verify";
+        ok = ota_writer_finish(&writer, ota_request.sha256);
+    }
+    ota_writer_free(&writer);
+
+    const int64_t total_time = esp_timer_get_time() - start_time;
+    if (!ok) {
+        ESP_LOGE(TAG, "Update failed (%s) after %s ms", reason, I64_DEC(total_time / 1000));
+        ota_report("failed", reason, total_time / 1000);
+        ota_running = false;
+        vTaskDelete(NULL);
+        return;
+    }
+
+    const uint32_t kbps = total_time > 0 ? (uint64_t)writer.written * 1000 / total_time : 0;
+    ESP_LOGI(TAG,
+             "Image of %u bytes written to %s in %s ms (%u KB/s): network %s ms, flash %s ms, SHA-256 %s ms",
+             writer.written, writer.partition->label, I64_DEC(total_time / 1000), kbps, I64_DEC(network_time / 1000),
+             I64_DEC(writer.flash_time / 1000), I64_DEC(writer.hash_time / 1000));
+    if (ota_request.delta) {
+        ESP_LOGI(TAG, "Patch of %u bytes, %u ops: %u bytes copied from the running image (read in %s ms), %u new",
+                 ota_request.size, patch.ops, patch.copied, I64_DEC(patch.read_time / 1000), patch.inserted);
+    }
+    ota_report("done", "", total_time / 1000);
+
+    ESP_LOGI(TAG, "Restarting into the new image");
+    vTaskDelay(pdMS_TO_TICKS(OTA_RESTART_DELAY_MS));
+    esp_restart();
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+bool ota_start(const char* url, uint32_t size, const uint8_t sha256[32], bool delta) {
+    if (ota_running || strlcpy(ota_request.url, url, sizeof(ota_request.url)) >= sizeof(ota_request.url)) {
+        return false;
+    }
+    ota_request.size = size;
+    ota_request.delta = delta;
+    memcpy(ota_request.sha256, sha256, sizeof(ota_request.sha256));
+
+    ota_running = true;
+    if (pdPASS != xTaskCreate(ota_task, "OTA", 4096, NULL, tskIDLE_PRIORITY + 1, NULL)) {
+        ota_running = false;
+        return false;
+    }
+    return true;
+}
+
+bool ota_is_running(void) {
+    return ota_running;
+}
+
+void ota_get_build_id(char out[OTA_BUILD_ID_SIZE]) {
+    const esp_app_desc_t* desc = esp_ota_get_app_description();
+    for (size_t i = 0; i < (OTA_BUILD_ID_SIZE - 1) / 2; i++) {
+        snprintf(&out[i * 2], 3, "%02x", desc->app_elf_sha256[i]);
+    }
+}
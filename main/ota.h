@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Longest firmware URL, including the null
+#define OTA_URL_MAX 128
+
+// Size of a build ID string, including the null
+#define OTA_BUILD_ID_SIZE 17
+
+// Starts downloading the image at `url` into the inactive OTA partition, in a
+// background task. The image is hashed as it is written and the device only
+// switches to it, and restarts, if it is `size` bytes with a SHA-256 of
+// `sha256`. The result is reported to the portal.
+//
+// With `delta` the download is instead a patch of `size` bytes against the
+// running build (see tools/ota_delta.py), and `sha256` is that of the image it
+// produces.
+//
+// The hash is what vouches for the image, so it must come from a trusted source
+// (the portal session). The download itself can be plain HTTP.
+//
+// Returns false if an update is already running or the task can't be started.
+bool ota_start(const char* url, uint32_t size, const uint8_t sha256[32], bool delta);
+
+// Returns true while an update is running.
+bool ota_is_running(void);
+
+// Gets the build ID of the running firmware, the first 8 bytes of its ELF
+// SHA-256 in hex. tools/portal_standin.py reads the same ID out of an image
+// file.
+void ota_get_build_id(char out[OTA_BUILD_ID_SIZE]);
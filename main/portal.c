@@ -0,0 +1,1692 @@
+#include "portal.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "access.h"
+#include "card_cache.h"
+#include "card_store.h"
+#include "config.h"
+#include "core.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "file_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "health.h"
+#include "json_stream.h"
+#include "led_animation.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/md.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/sha1.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+#include "network.h"
+#include "ota.h"
+#include "resolver.h"
+#include "sdkconfig.h"
+#include "warm_boot.h"
+
+#define TAG "portal"
+
+// =============================================================================
+// Settings
+// =============================================================================
+
+// WebSocket endpoint on the portal
+#define PORTAL_WS_PATH "/ws/access"
+
+// Message encodings, offered in order of preference. A portal that doesn't pick
+// one gets JSON.
+#define PORTAL_WS_PROTOCOL_BINARY "interlock-binary-1"
+#define PORTAL_WS_PROTOCOL_JSON "interlock-json-1"
+
+// CA certificate for the portal. Sessions are only opened to a portal whose
+// certificate it verifies, so without it the door stays offline.
+#define PORTAL_CA_PATH "/portal_ca.pem"
+
+// Socket reads time out after this long so queued messages can be sent
+#define PORTAL_POLL_MS 50
+
+// Time allowed for the TLS handshake, WebSocket upgrade and authentication
+#define PORTAL_OPEN_TIMEOUT_MS 10000
+
+// WebSocket ping interval, and how long the portal may stay silent before the
+// session is considered dead
+#define PORTAL_KEEPALIVE_MS 30000
+#define PORTAL_DEAD_MS 90000
+
+// Interval between heartbeats, the first is sent as soon as the session opens
+#define PORTAL_HEARTBEAT_MS 60000
+
+// Reconnect backoff, doubled on each failure
+#define PORTAL_BACKOFF_MIN_MS 1000
+#define PORTAL_BACKOFF_MAX_MS 60000
+
+#define PORTAL_QUEUE_LENGTH 8
+
+// Longest remote unlock the portal may ask for
+#define PORTAL_UNLOCK_MAX_MS 60000
+
+// Largest frame sent to the portal. Received messages are parsed as they
+// arrive, so there is no limit on them.
+#define PORTAL_TX_FRAME_MAX 1280
+
+// =============================================================================
+// Types
+// =============================================================================
+
+typedef struct portal_message {
+    bool binary;
+    uint8_t size;
+    char data[PORTAL_MESSAGE_MAX + 1];
+} portal_message_t;
+
+// Binary encoding. Every message is a type byte followed by unsigned LEB128
+// varints. Booleans are 0 or 1. Authentication and sync requests are rare and
+// stay JSON.
+typedef enum portal_bin_type {
+    // Portal to door
+    PORTAL_BIN_PING = 0x01,          // id
+    PORTAL_BIN_CHECK_RESULT = 0x02,  // id, granted
+    PORTAL_BIN_SYNC = 0x03,          // count, then count gaps between ascending card numbers
+
+    // Door to portal
+    PORTAL_BIN_PONG = 0x81,        // id
+    PORTAL_BIN_CHECK = 0x82,       // id, card
+    PORTAL_BIN_LOG_ACCESS = 0x83,  // count, then count triples of card, granted, UTC time (ms, 0 if unknown)
+    PORTAL_BIN_HEARTBEAT = 0x84,   // see portal_heartbeat_binary()
+} portal_bin_type_t;
+
+// Longest LEB128 encoding of a uint64_t
+#define PORTAL_VARINT_MAX 10
+
+typedef enum portal_ws_opcode {
+    PORTAL_WS_CONTINUATION = 0x0,
+    PORTAL_WS_TEXT = 0x1,
+    PORTAL_WS_BINARY = 0x2,
+    PORTAL_WS_CLOSE = 0x8,
+    PORTAL_WS_PING = 0x9,
+    PORTAL_WS_PONG = 0xA,
+} portal_ws_opcode_t;
+
+// Incremental WebSocket frame parser state
+typedef struct portal_ws_rx {
+    uint8_t header[10];
+    uint8_t header_size;    // Header bytes received
+    uint8_t header_needed;  // Full header size, known after the first two bytes
+    uint8_t opcode;         // Of the frame being received
+    bool fin;
+    uint32_t remaining;     // Payload bytes left in the frame
+
+    // Control frame payload
+    uint8_t control[125];
+    uint8_t control_size;
+
+    // Data message spread over one or more frames
+    bool in_message;
+    uint8_t message_opcode;
+} portal_ws_rx_t;
+
+// What has been picked out of the message being received
+typedef struct portal_rx_message {
+    json_stream_t json;
+    bool failed;  // Bad JSON, or content that couldn't be handled
+    char key[16];  // Last top level key
+    char command[24];
+    uint32_t id;
+    bool granted;
+
+    // Card list, streamed into the card store as it arrives
+    bool sync_started;
+    bool syncing;  // Inside the card array
+    int64_t sync_start_time;
+    size_t size;
+
+    // Firmware update
+    char url[OTA_URL_MAX];
+    uint32_t image_size;
+    uint8_t sha256[32];
+    bool sha256_valid;
+    bool delta;  // The image is a patch against the running build
+
+    // Remote unlock
+    uint32_t counter;
+    uint32_t duration_ms;
+    uint8_t mac[32];
+    bool mac_valid;
+
+    // Cache invalidation, of one card or all of them
+    bool has_card;
+    rfid_number_t invalidate_card;
+
+    // Binary messages
+    uint8_t type;     // 0 until the type byte arrives
+    uint32_t fields;  // Varints decoded so far
+    uint64_t varint;  // Varint being decoded
+    uint8_t shift;
+    uint32_t cards_left;
+    rfid_number_t card;  // Last card of a sync, the gaps are relative to it
+} portal_rx_message_t;
+
+typedef struct portal_session {
+    mbedtls_net_context net;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    portal_ws_rx_t rx;
+    portal_rx_message_t message;
+    bool binary;  // The portal chose the binary encoding
+    bool authenticated;
+    int64_t last_received;    // When anything was last received
+    uint32_t rtt_us;          // Smoothed WebSocket ping round trip, 0 until measured
+    char unlock_nonce[17];    // Sent when authenticating, remote unlocks are signed over it
+    uint32_t unlock_counter;  // Of the last remote unlock accepted
+    uint32_t messages_in;
+    uint32_t messages_out;
+} portal_session_t;
+
+// =============================================================================
+// State
+// =============================================================================
+
+static QueueHandle_t portal_queue = NULL;
+static volatile bool portal_connected = false;
+static volatile bool portal_binary = false;  // Encoding of the open session
+
+// Only touched by the portal task
+static portal_session_t portal_session;
+static mbedtls_entropy_context portal_entropy;
+static mbedtls_ctr_drbg_context portal_drbg;
+static mbedtls_x509_crt portal_ca;
+static bool portal_ca_loaded = false;
+static uint8_t portal_tx_frame[14 + PORTAL_TX_FRAME_MAX];
+
+// Outstanding card check
+static SemaphoreHandle_t portal_check_done = NULL;
+static volatile uint32_t portal_check_id = 0;
+static volatile bool portal_check_granted = false;
+
+// =============================================================================
+// JSON Helpers
+// =============================================================================
+
+// Copies `in` into `out` as the contents of a JSON string.
+//
+// Returns false if it doesn't fit.
+static bool portal_json_escape(char* out, size_t size, const char* in) {
+    size_t used = 0;
+    for (; '\0' != *in; in++) {
+        char escaped[7];
+        const unsigned char c = *in;
+        if ('"' == c || '\\' == c) {
+            snprintf(escaped, sizeof(escaped), "\\%c", c);
+        } else if (c < 0x20) {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        } else {
+            escaped[0] = c;
+            escaped[1] = '\0';
+        }
+
+        const size_t length = strlen(escaped);
+        if (used + length >= size) {
+            return false;
+        }
+        memcpy(&out[used], escaped, length);
+        used += length;
+    }
+
+    if (used >= size) {
+        return false;
+    }
+    out[used] = '\0';
+    return true;
+}
+
+// =============================================================================
+// TLS Session Cache
+// =============================================================================
+
+// The last session, offered on reconnect so the portal can resume it instead
+// of doing a full handshake
+static mbedtls_ssl_session portal_tls_session;
+static bool portal_tls_session_valid = false;
+
+// Time spent blocked on the socket, so handshake CPU time can be worked out
+static int64_t portal_io_time = 0;
+
+#if CONFIG_INTERLOCK_PORTAL_TLS_SESSION_RTC
+#define PORTAL_TLS_SESSION_MAGIC 0x53544C49  // "ILTS"
+
+// Enough to resume by session ID. Tickets are too big for RTC memory, so they
+// are only kept in RAM.
+typedef struct portal_rtc_session {
+    uint32_t magic;
+    uint32_t crc;     // CRC of everything after this field
+    uint32_t server;  // Portal address and port the session belongs to
+    uint32_t verify_result;
+    uint16_t ciphersuite;
+    uint8_t compression;
+    uint8_t id_len;
+    uint8_t id[32];
+    uint8_t master[48];
+} portal_rtc_session_t;
+
+static WARM_BOOT_ATTR uint32_t portal_rtc_session[sizeof(portal_rtc_session_t) / sizeof(uint32_t)];
+
+#define PORTAL_RTC_SESSION_CRC_OFFSET (offsetof(portal_rtc_session_t, crc) + sizeof(uint32_t))
+
+static uint32_t portal_rtc_session_crc(const portal_rtc_session_t* s) {
+    return crc32_update(0, (const uint8_t*)s + PORTAL_RTC_SESSION_CRC_OFFSET,
+                        sizeof(*s) - PORTAL_RTC_SESSION_CRC_OFFSET);
+}
+
+static uint32_t portal_rtc_session_server(void) {
+    const char* address = config_get_portal_address();
+    const uint16_t port = config_get_portal_port();
+    return crc32_update(crc32_update(0, address, strlen(address)), &port, sizeof(port));
+}
+#endif
+
+// Picks up a session saved before a soft reset.
+static void portal_tls_session_restore(void) {
+    mbedtls_ssl_session_init(&portal_tls_session);
+
+#if CONFIG_INTERLOCK_PORTAL_TLS_SESSION_RTC
+    portal_rtc_session_t saved;
+    warm_boot_rtc_read(&saved, portal_rtc_session, sizeof(saved));
+    if (PORTAL_TLS_SESSION_MAGIC != saved.magic || portal_rtc_session_crc(&saved) != saved.crc ||
+        portal_rtc_session_server() != saved.server || saved.id_len > sizeof(saved.id)) {
+        return;
+    }
+
+    portal_tls_session.ciphersuite = saved.ciphersuite;
+    portal_tls_session.compression = saved.compression;
+    portal_tls_session.id_len = saved.id_len;
+    memcpy(portal_tls_session.id, saved.id, sizeof(saved.id));
+    memcpy(portal_tls_session.master, saved.master, sizeof(saved.master));
+    portal_tls_session.verify_result = saved.verify_result;
+    portal_tls_session_valid = true;
+    ESP_LOGI(TAG, "Restored the TLS session from RTC memory");
+#endif
+}
+
+static void portal_tls_session_forget(void) {
+    mbedtls_ssl_session_free(&portal_tls_session);
+    mbedtls_ssl_session_init(&portal_tls_session);
+    portal_tls_session_valid = false;
+
+#if CONFIG_INTERLOCK_PORTAL_TLS_SESSION_RTC
+    portal_rtc_session[0] = 0;
+#endif
+}
+
+// Caches the session of a completed handshake.
+//
+// Returns true if it is the session that was offered, i.e. it was resumed.
+static bool portal_tls_session_save(const mbedtls_ssl_context* ssl) {
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if (0 != mbedtls_ssl_get_session(ssl, &session)) {
+        mbedtls_ssl_session_free(&session);
+        portal_tls_session_forget();
+        return false;
+    }
+
+    // A resumed session keeps its master secret, a full handshake makes a new one
+    const bool resumed = portal_tls_session_valid &&
+                         0 == memcmp(session.master, portal_tls_session.master, sizeof(session.master));
+
+    mbedtls_ssl_session_free(&portal_tls_session);
+    portal_tls_session = session;
+    portal_tls_session_valid = true;
+
+#if CONFIG_INTERLOCK_PORTAL_TLS_SESSION_RTC
+    if (!resumed && session.id_len <= sizeof(((portal_rtc_session_t*)0)->id)) {
+        portal_rtc_session_t saved = {
+            .magic = PORTAL_TLS_SESSION_MAGIC,
+            .server = portal_rtc_session_server(),
+            .verify_result = session.verify_result,
+            .ciphersuite = session.ciphersuite,
+            .compression = session.compression,
+            .id_len = session.id_len,
+        };
+        memcpy(saved.id, session.id, sizeof(saved.id));
+        memcpy(saved.master, session.master, sizeof(saved.master));
+        saved.crc = portal_rtc_session_crc(&saved);
+        warm_boot_rtc_write(portal_rtc_session, &saved, sizeof(saved));
+    }
+#endif
+
+    return resumed;
+}
+
+static int portal_net_send(void* ctx, const unsigned char* buf, size_t len) {
+    const int64_t start = esp_timer_get_time();
+    const int ret = mbedtls_net_send(ctx, buf, len);
+    portal_io_time += esp_timer_get_time() - start;
+    return ret;
+}
+
+static int portal_net_recv_timeout(void* ctx, unsigned char* buf, size_t len, uint32_t timeout) {
+    const int64_t start = esp_timer_get_time();
+    const int ret = mbedtls_net_recv_timeout(ctx, buf, len, timeout);
+    portal_io_time += esp_timer_get_time() - start;
+    return ret;
+}
+
+// =============================================================================
+// TLS
+// =============================================================================
+
+static bool portal_ssl_retry(int ret) {
+    return MBEDTLS_ERR_SSL_WANT_READ == ret || MBEDTLS_ERR_SSL_WANT_WRITE == ret || MBEDTLS_ERR_SSL_TIMEOUT == ret;
+}
+
+static bool portal_ssl_write_all(portal_session_t* session, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        const int ret = mbedtls_ssl_write(&session->ssl, data, size);
+        if (ret > 0) {
+            data += ret;
+            size -= ret;
+        } else if (!portal_ssl_retry(ret)) {
+            ESP_LOGW(TAG, "Write failed: -0x%04x", -ret);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Loads the portal CA certificate. Tried again on each connection attempt
+// until it loads, so a CA added later is picked up without a restart.
+//
+// Returns true if the CA is loaded.
+static bool portal_load_ca(void) {
+    if (portal_ca_loaded) {
+        return true;
+    }
+
+    lfs_t* fs = fs_get_and_lock(portMAX_DELAY);
+    if (NULL == fs) {
+        return false;
+    }
+
+    lfs_file_t file;
+    if (0 > lfs_file_open(fs, &file, PORTAL_CA_PATH, LFS_O_RDONLY)) {
+        ESP_LOGE(TAG, "No %s, not connecting to an unverified portal", PORTAL_CA_PATH);
+    } else {
+        // Drop anything a previous bad file left in the chain
+        mbedtls_x509_crt_free(&portal_ca);
+        mbedtls_x509_crt_init(&portal_ca);
+
+        // The PEM parser wants the terminating NUL included in the size
+        const lfs_soff_t size = lfs_file_size(fs, &file);
+        uint8_t* pem = size > 0 ? malloc(size + 1) : NULL;
+        if (NULL != pem && size == lfs_file_read(fs, &file, pem, size)) {
+            pem[size] = '\0';
+            portal_ca_loaded = 0 == mbedtls_x509_crt_parse(&portal_ca, pem, size + 1);
+        }
+        free(pem);
+        lfs_file_close(fs, &file);
+
+        if (!portal_ca_loaded) {
+            ESP_LOGE(TAG, "Unable to load %s", PORTAL_CA_PATH);
+        }
+    }
+    fs_unlock(fs);
+
+    return portal_ca_loaded;
+}
+
+// Connects to `addr` (from the resolver) and runs the TLS handshake.
+static bool portal_tls_open(portal_session_t* session, uint32_t addr, int64_t deadline) {
+    const uint8_t* bytes = (const uint8_t*)&addr;
+    char host[16];
+    char port[6];
+    snprintf(host, sizeof(host), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+    snprintf(port, sizeof(port), "%u", config_get_portal_port());
+
+    int ret = mbedtls_net_connect(&session->net, host, port, MBEDTLS_NET_PROTO_TCP);
+    if (0 != ret) {
+        ESP_LOGW(TAG, "Unable to connect to %s (%s):%s: -0x%04x", config_get_portal_address(), host, port, -ret);
+        // The address may have moved
+        resolver_failed(config_get_portal_address());
+        return false;
+    }
+
+    ret = mbedtls_ssl_config_defaults(&session->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (0 != ret) {
+        return false;
+    }
+    // The portal is trusted with the API key, access decisions and updates
+    mbedtls_ssl_conf_authmode(&session->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&session->conf, &portal_ca, NULL);
+    mbedtls_ssl_conf_rng(&session->conf, mbedtls_ctr_drbg_random, &portal_drbg);
+    mbedtls_ssl_conf_read_timeout(&session->conf, PORTAL_POLL_MS);
+
+    if (0 != mbedtls_ssl_setup(&session->ssl, &session->conf) ||
+        0 != mbedtls_ssl_set_hostname(&session->ssl, config_get_portal_address())) {
+        return false;
+    }
+    mbedtls_ssl_set_bio(&session->ssl, &session->net, portal_net_send, NULL, portal_net_recv_timeout);
+
+    // Offer the last session
+    const bool offered = portal_tls_session_valid && 0 == mbedtls_ssl_set_session(&session->ssl, &portal_tls_session);
+
+    const int64_t start_time = esp_timer_get_time();
+    portal_io_time = 0;
+    while (0 != (ret = mbedtls_ssl_handshake(&session->ssl))) {
+        if (!portal_ssl_retry(ret) || esp_timer_get_time() > deadline) {
+            ESP_LOGW(TAG, "TLS handshake failed: -0x%04x", -ret);
+            if (MBEDTLS_ERR_X509_CERT_VERIFY_FAILED == ret) {
+                char info[128];
+                mbedtls_x509_crt_verify_info(info, sizeof(info), "", mbedtls_ssl_get_verify_result(&session->ssl));
+                ESP_LOGE(TAG, "Portal certificate not verified: %s", info);
+            }
+
+            // Don't keep offering a session that may be the problem
+            if (offered) {
+                portal_tls_session_forget();
+            }
+            return false;
+        }
+    }
+    const int64_t handshake_time = esp_timer_get_time() - start_time;
+
+    const bool resumed = portal_tls_session_save(&session->ssl);
+    ESP_LOGI(TAG, "%s TLS handshake in %s ms, %s ms of it CPU", resumed ? "Resumed" : "Full",
+             I64_DEC(handshake_time / 1000), I64_DEC((handshake_time - portal_io_time) / 1000));
+    return true;
+}
+
+// Checks the session's certificate was verified. Sessions are only opened to a
+// verified portal, but commands that open the door or replace the firmware
+// check again rather than rely on that.
+static bool portal_tls_verified(portal_session_t* session) {
+    return 0 == mbedtls_ssl_get_verify_result(&session->ssl);
+}
+
+// =============================================================================
+// WebSocket
+// =============================================================================
+
+#define PORTAL_WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static bool portal_ws_send(portal_session_t* session, portal_ws_opcode_t opcode, const void* payload, size_t size) {
+    if (size > PORTAL_TX_FRAME_MAX) {
+        return false;
+    }
+
+    // Header
+    size_t used = 0;
+    portal_tx_frame[used++] = 0x80 | opcode;
+    if (size < 126) {
+        portal_tx_frame[used++] = 0x80 | size;
+    } else {
+        portal_tx_frame[used++] = 0x80 | 126;
+        portal_tx_frame[used++] = size >> 8;
+        portal_tx_frame[used++] = size & 0xFF;
+    }
+
+    // Client frames are always masked
+    const uint32_t mask = esp_random();
+    const uint8_t* key = &portal_tx_frame[used];
+    memcpy(&portal_tx_frame[used], &mask, sizeof(mask));
+    used += sizeof(mask);
+
+    const uint8_t* bytes = payload;
+    for (size_t i = 0; i < size; i++) {
+        portal_tx_frame[used + i] = bytes[i] ^ key[i & 3];
+    }
+    used += size;
+
+    // One write, so the frame goes out in a single TLS record
+    return portal_ssl_write_all(session, portal_tx_frame, used);
+}
+
+static bool portal_ws_send_text(portal_session_t* session, const char* text) {
+    if (!portal_ws_send(session, PORTAL_WS_TEXT, text, strlen(text))) {
+        return false;
+    }
+    session->messages_out++;
+    return true;
+}
+
+static void portal_message_start(portal_session_t* session);
+static void portal_message_data(portal_session_t* session, const uint8_t* data, size_t size);
+static void portal_message_end(portal_session_t* session);
+
+static bool portal_ws_frame_start(portal_session_t* session) {
+    portal_ws_rx_t* rx = &session->rx;
+    const uint8_t* header = rx->header;
+
+    if (header[1] & 0x80) {
+        ESP_LOGW(TAG, "Masked frame from the portal");
+        return false;
+    }
+
+    uint64_t length = header[1] & 0x7F;
+    if (126 == length) {
+        length = ((uint16_t)header[2] << 8) | header[3];
+    } else if (127 == length) {
+        length = 0;
+        for (int i = 2; i < 10; i++) {
+            length = (length << 8) | header[i];
+        }
+    }
+    if (length > UINT32_MAX) {
+        return false;
+    }
+    rx->remaining = length;
+    rx->fin = header[0] & 0x80;
+    rx->opcode = header[0] & 0x0F;
+
+    switch (rx->opcode) {
+        case PORTAL_WS_CLOSE:
+        case PORTAL_WS_PING:
+        case PORTAL_WS_PONG:
+            rx->control_size = 0;
+            return rx->fin && length <= sizeof(rx->control);
+
+        case PORTAL_WS_TEXT:
+        case PORTAL_WS_BINARY:
+            if (rx->in_message) {
+                return false;
+            }
+            rx->in_message = true;
+            rx->message_opcode = rx->opcode;
+            portal_message_start(session);
+            return true;
+
+        case PORTAL_WS_CONTINUATION:
+            return rx->in_message;
+
+        default:
+            return false;
+    }
+}
+
+static void portal_ws_frame_data(portal_session_t* session, const uint8_t* data, size_t size) {
+    portal_ws_rx_t* rx = &session->rx;
+
+    if (rx->opcode & 0x08) {
+        memcpy(&rx->control[rx->control_size], data, size);
+        rx->control_size += size;
+        return;
+    }
+
+    portal_message_data(session, data, size);
+}
+
+static bool portal_ws_frame_end(portal_session_t* session) {
+    portal_ws_rx_t* rx = &session->rx;
+
+    switch (rx->opcode) {
+        case PORTAL_WS_CLOSE:
+            ESP_LOGI(TAG, "Portal closed the session");
+            portal_ws_send(session, PORTAL_WS_CLOSE, rx->control, rx->control_size < 2 ? 0 : 2);
+            return false;
+
+        case PORTAL_WS_PING:
+            return portal_ws_send(session, PORTAL_WS_PONG, rx->control, rx->control_size);
+
+        case PORTAL_WS_PONG:
+            // Our pings carry the time they were sent
+            if (sizeof(int64_t) == rx->control_size) {
+                int64_t sent;
+                memcpy(&sent, rx->control, sizeof(sent));
+                const int32_t rtt = esp_timer_get_time() - sent;
+                ESP_LOGD(TAG, "Round trip %d us", rtt);
+
+                // Smoothed as TCP does, so one slow pong doesn't dominate
+                if (0 == session->rtt_us) {
+                    session->rtt_us = rtt;
+                } else {
+                    session->rtt_us += (rtt - (int32_t)session->rtt_us) / 8;
+                }
+            }
+            return true;
+
+        default:
+            break;
+    }
+
+    if (!rx->fin) {
+        return true;
+    }
+    rx->in_message = false;
+    session->messages_in++;
+
+    portal_message_end(session);
+    return true;
+}
+
+// Feeds received bytes through the frame parser.
+//
+// Returns false if the session must be closed.
+static bool portal_ws_receive(portal_session_t* session, const uint8_t* data, size_t size) {
+    portal_ws_rx_t* rx = &session->rx;
+
+    while (size > 0) {
+        if (rx->header_size < rx->header_needed) {
+            rx->header[rx->header_size++] = *data++;
+            size--;
+
+            // The second byte tells us how long the rest of the header is
+            if (2 == rx->header_size) {
+                const uint8_t length = rx->header[1] & 0x7F;
+                rx->header_needed = 2 + (126 == length ? 2 : 127 == length ? 8 : 0);
+            }
+            if (rx->header_size < rx->header_needed) {
+                continue;
+            }
+            if (!portal_ws_frame_start(session)) {
+                ESP_LOGW(TAG, "Bad frame from the portal");
+                return false;
+            }
+        } else {
+            const size_t chunk = size < rx->remaining ? size : rx->remaining;
+            portal_ws_frame_data(session, data, chunk);
+            data += chunk;
+            size -= chunk;
+            rx->remaining -= chunk;
+        }
+
+        if (0 == rx->remaining) {
+            rx->header_size = 0;
+            rx->header_needed = 2;
+            if (!portal_ws_frame_end(session)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Upgrades the TLS connection to a WebSocket.
+static bool portal_ws_upgrade(portal_session_t* session, int64_t deadline) {
+    // Random key, and the accept value the portal must answer with
+    uint8_t nonce[16];
+    char key[32];
+    size_t key_size;
+    mbedtls_ctr_drbg_random(&portal_drbg, nonce, sizeof(nonce));
+    mbedtls_base64_encode((unsigned char*)key, sizeof(key), &key_size, nonce, sizeof(nonce));
+
+    uint8_t digest[20];
+    char accept[32];
+    size_t accept_size;
+    mbedtls_sha1_context sha1;
+    mbedtls_sha1_init(&sha1);
+    mbedtls_sha1_starts_ret(&sha1);
+    mbedtls_sha1_update_ret(&sha1, (const unsigned char*)key, key_size);
+    mbedtls_sha1_update_ret(&sha1, (const unsigned char*)PORTAL_WS_GUID, strlen(PORTAL_WS_GUID));
+    mbedtls_sha1_finish_ret(&sha1, digest);
+    mbedtls_sha1_free(&sha1);
+    mbedtls_base64_encode((unsigned char*)accept, sizeof(accept), &accept_size, digest, sizeof(digest));
+
+    char buffer[384];
+    const int request_size = snprintf(buffer, sizeof(buffer),
+                                      "GET " PORTAL_WS_PATH " HTTP/1.1\r\n"
+                                      "Host: %s\r\n"
+                                      "Upgrade: websocket\r\n"
+                                      "Connection: Upgrade\r\n"
+                                      "Sec-WebSocket-Key: %s\r\n"
+                                      "Sec-WebSocket-Version: 13\r\n"
+                                      // Offer both encodings, binary preferred
+                                      "Sec-WebSocket-Protocol: " PORTAL_WS_PROTOCOL_BINARY
+                                      ", " PORTAL_WS_PROTOCOL_JSON "\r\n"
+                                      "\r\n",
+                                      config_get_portal_address(), key);
+    if (request_size < 0 || (size_t)request_size >= sizeof(buffer) ||
+        !portal_ssl_write_all(session, (const uint8_t*)buffer, request_size)) {
+        return false;
+    }
+
+    // Read up to the end of the response headers
+    size_t size = 0;
+    char* end = NULL;
+    while (NULL == end) {
+        if (size == sizeof(buffer) - 1 || esp_timer_get_time() > deadline) {
+            return false;
+        }
+
+        const int ret = mbedtls_ssl_read(&session->ssl, (uint8_t*)&buffer[size], sizeof(buffer) - 1 - size);
+        if (ret > 0) {
+            size += ret;
+            buffer[size] = '\0';
+            end = strstr(buffer, "\r\n\r\n");
+        } else if (!portal_ssl_retry(ret)) {
+            return false;
+        }
+    }
+    end[2] = '\0';
+
+    if (0 != strncmp(buffer, "HTTP/1.1 101", 12)) {
+        ESP_LOGW(TAG, "Upgrade refused: %.*s", (int)strcspn(buffer, "\r"), buffer);
+        return false;
+    }
+
+    bool accepted = false;
+    session->binary = false;
+    for (char* line = strstr(buffer, "\r\n"); NULL != line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (0 == strncasecmp(line, "Sec-WebSocket-Accept:", 21)) {
+            const char* value = line + 21 + strspn(line + 21, " ");
+            accepted = 0 == strncmp(value, accept, accept_size) && '\r' == value[accept_size];
+        } else if (0 == strncasecmp(line, "Sec-WebSocket-Protocol:", 23)) {
+            const char* value = line + 23 + strspn(line + 23, " ");
+            const size_t length = strlen(PORTAL_WS_PROTOCOL_BINARY);
+            session->binary = 0 == strncmp(value, PORTAL_WS_PROTOCOL_BINARY, length) && '\r' == value[length];
+        }
+    }
+    if (!accepted) {
+        ESP_LOGW(TAG, "Bad Sec-WebSocket-Accept from the portal");
+        return false;
+    }
+
+    // Anything after the headers is already WebSocket data
+    const char* leftover = end + 4;
+    return portal_ws_receive(session, (const uint8_t*)leftover, &buffer[size] - leftover);
+}
+
+// =============================================================================
+// Messages
+// =============================================================================
+
+// Handlers shared by both encodings
+
+static void portal_check_answered(uint32_t id, bool granted) {
+    if (id == portal_check_id) {
+        portal_check_granted = granted;
+        xSemaphoreGive(portal_check_done);
+    }
+}
+
+// Remote unlock. The portal signs each one with HMAC-SHA256, keyed with the API
+// key, over "<nonce>:unlock:<id>:<counter>:<duration_ms>". The nonce is new for
+// each session and the counter must go up, so a command can't be replayed. The
+// API key is sent when authenticating, so unlocks are only taken over a session
+// whose certificate was verified, where nobody else can have learnt it.
+//
+// The answer carries when the relay switched on, in esp_timer time, and how
+// long after the command arrived that was.
+static void portal_unlock(portal_session_t* session, const portal_rx_message_t* message) {
+    const int64_t received = session->last_received;
+    const char* reason = NULL;
+    int64_t actuated = 0;
+
+    char text[80];
+    snprintf(text, sizeof(text), "%s:unlock:%u:%u:%u", session->unlock_nonce, message->id, message->counter,
+             message->duration_ms);
+    const char* key = config_get_portal_api_key();
+    uint8_t expected[32];
+    uint8_t difference = 0;
+    if (!message->mac_valid ||
+        0 != mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const unsigned char*)key, strlen(key),
+                             (const unsigned char*)text, strlen(text), expected)) {
+        difference = 1;
+    }
+    // In constant time, so the MAC can't be guessed a byte at a time
+    for (size_t i = 0; i < sizeof(expected); i++) {
+        difference |= expected[i] ^ message->mac[i];
+    }
+
+    if (!portal_tls_verified(session)) {
+        reason = "unverified";
+    } else if (0 != difference) {
+        reason = "signature";
+    } else if (message->counter <= session->unlock_counter) {
+        reason = "replayed";
+    } else if (0 == message->duration_ms || message->duration_ms > PORTAL_UNLOCK_MAX_MS) {
+        reason = "duration";
+    } else {
+        session->unlock_counter = message->counter;
+        if (!access_unlock_remote(message->duration_ms, &actuated)) {
+            reason = "relay";
+        }
+    }
+
+    char reply[160];
+    if (NULL == reason) {
+        snprintf(reply, sizeof(reply),
+                 "{\"command\":\"unlock_result\",\"id\":%u,\"ok\":true,\"actuated_us\":%s,\"latency_us\":%s}",
+                 message->id, I64_DEC(actuated), I64_DEC(actuated - received));
+        ESP_LOGI(TAG, "Remote unlock for %u ms, relay on %s us after the command arrived", message->duration_ms,
+                 I64_DEC(actuated - received));
+    } else {
+        snprintf(reply, sizeof(reply), "{\"command\":\"unlock_result\",\"id\":%u,\"ok\":false,\"reason\":\"%s\"}",
+                 message->id, reason);
+        ESP_LOGW(TAG, "Refused a remote unlock (%s)", reason);
+    }
+    portal_ws_send_text(session, reply);
+}
+
+static void portal_sync_commit(const portal_rx_message_t* message) {
+    // Answers cached from before the sync may no longer hold
+    card_cache_clear();
+    const int32_t cards = card_store_update_commit();
+    const int64_t sync_time = esp_timer_get_time() - message->sync_start_time;
+    if (cards >= 0) {
+        ESP_LOGI(TAG, "Card list synced, %d cards, %u bytes in %s ms", cards, message->size,
+                 I64_DEC(sync_time / 1000));
+    }
+}
+
+// JSON messages
+
+// Copies the value of `token` as a null terminated string.
+static bool portal_token_copy(const json_token_t* token, char* out, size_t size) {
+    if (token->truncated || token->length >= size) {
+        return false;
+    }
+    memcpy(out, token->value, token->length);
+    out[token->length] = '\0';
+    return true;
+}
+
+// Decodes a string of exactly `size` bytes in hex.
+static bool portal_token_hex(const json_token_t* token, uint8_t* out, size_t size) {
+    if (JSON_TOKEN_STRING != token->type || token->truncated || token->length != size * 2) {
+        return false;
+    }
+    for (size_t i = 0; i < size; i++) {
+        rfid_number_t byte;
+        if (!rfid_number_from_hex(&token->value[i * 2], 2, &byte)) {
+            return false;
+        }
+        out[i] = byte;
+    }
+    return true;
+}
+
+static bool portal_token_u32(const json_token_t* token, uint32_t* out) {
+    rfid_number_t value;
+    if (JSON_TOKEN_NUMBER != token->type || !rfid_number_from_dec(token->value, token->length, &value) ||
+        value > UINT32_MAX) {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+static bool portal_token_card(const json_token_t* token, rfid_number_t* out) {
+    if (JSON_TOKEN_NUMBER == token->type) {
+        return rfid_number_from_dec(token->value, token->length, out);
+    }
+    if (JSON_TOKEN_STRING == token->type && token->length > 2 && '0' == token->value[0] &&
+        'x' == (token->value[1] | 0x20)) {
+        return rfid_number_from_hex(token->value + 2, token->length - 2, out);
+    }
+    return JSON_TOKEN_STRING == token->type && rfid_number_from_dec(token->value, token->length, out);
+}
+
+// Picks the fields we use out of a message as it is parsed. The card array of a
+// sync goes straight to the card store.
+static bool portal_message_token(void* ctx, const json_token_t* token) {
+    portal_rx_message_t* message = ctx;
+
+    if (2 == token->depth && message->syncing) {
+        rfid_number_t card;
+        return portal_token_card(token, &card) && card_store_update_add(card);
+    }
+    if (1 != token->depth) {
+        return true;
+    }
+
+    if (JSON_TOKEN_KEY == token->type) {
+        // Unknown long keys are simply not matched
+        if (!portal_token_copy(token, message->key, sizeof(message->key))) {
+            message->key[0] = '\0';
+        }
+        return true;
+    }
+
+    if (0 == strcmp(message->key, "command")) {
+        return JSON_TOKEN_STRING == token->type && portal_token_copy(token, message->command, sizeof(message->command));
+    }
+    if (0 == strcmp(message->key, "id")) {
+        return portal_token_u32(token, &message->id);
+    }
+    if (0 == strcmp(message->key, "granted")) {
+        message->granted = JSON_TOKEN_TRUE == token->type;
+        return true;
+    }
+    if (0 == strcmp(message->key, "url")) {
+        return JSON_TOKEN_STRING == token->type && portal_token_copy(token, message->url, sizeof(message->url));
+    }
+    if (0 == strcmp(message->key, "size")) {
+        return portal_token_u32(token, &message->image_size);
+    }
+    if (0 == strcmp(message->key, "sha256")) {
+        message->sha256_valid = portal_token_hex(token, message->sha256, sizeof(message->sha256));
+        return message->sha256_valid;
+    }
+    if (0 == strcmp(message->key, "delta")) {
+        message->delta = JSON_TOKEN_TRUE == token->type;
+        return true;
+    }
+    if (0 == strcmp(message->key, "counter")) {
+        return portal_token_u32(token, &message->counter);
+    }
+    if (0 == strcmp(message->key, "duration_ms")) {
+        return portal_token_u32(token, &message->duration_ms);
+    }
+    if (0 == strcmp(message->key, "mac")) {
+        message->mac_valid = portal_token_hex(token, message->mac, sizeof(message->mac));
+        return message->mac_valid;
+    }
+    if (0 == strcmp(message->key, "card")) {
+        message->has_card = portal_token_card(token, &message->invalidate_card);
+        return message->has_card;
+    }
+    if (0 == strcmp(message->key, "cards")) {
+        if (JSON_TOKEN_ARRAY_START == token->type && !message->sync_started) {
+            message->sync_started = true;
+            message->syncing = true;
+            message->sync_start_time = esp_timer_get_time();
+            return card_store_update_begin();
+        }
+        if (JSON_TOKEN_ARRAY_END == token->type) {
+            message->syncing = false;
+        }
+        return true;
+    }
+    return true;
+}
+
+static void portal_json_start(portal_session_t* session) {
+    portal_rx_message_t* message = &session->message;
+    json_stream_init(&message->json, portal_message_token, message);
+    message->failed = false;
+    message->key[0] = '\0';
+    message->command[0] = '\0';
+    message->id = 0;
+    message->granted = false;
+    message->sync_started = false;
+    message->syncing = false;
+    message->size = 0;
+    message->url[0] = '\0';
+    message->image_size = 0;
+    message->sha256_valid = false;
+    message->delta = false;
+    message->counter = 0;
+    message->duration_ms = 0;
+    message->mac_valid = false;
+    message->has_card = false;
+}
+
+static void portal_json_data(portal_session_t* session, const uint8_t* data, size_t size) {
+    portal_rx_message_t* message = &session->message;
+    message->size += size;
+    if (!message->failed) {
+        message->failed = !json_stream_feed(&message->json, (const char*)data, size);
+    }
+}
+
+static void portal_json_end(portal_session_t* session) {
+    portal_rx_message_t* message = &session->message;
+    const char* command = message->command;
+
+    if (message->failed || !json_stream_finish(&message->json)) {
+        ESP_LOGW(TAG, "Unable to handle a message from the portal (\"%s\")", command);
+        card_store_update_abort();
+        return;
+    }
+
+    if (0 == strcmp(command, "sync") && message->sync_started) {
+        portal_sync_commit(message);
+        return;
+    }
+
+    // Cards only belong in a sync
+    card_store_update_abort();
+
+    if (0 == strcmp(command, "authenticated")) {
+        // Invalidations sent while disconnected were missed
+        card_cache_clear();
+        session->authenticated = true;
+        return;
+    }
+
+    // Application level ping, used by the portal to measure latency
+    if (0 == strcmp(command, "ping")) {
+        char reply[48];
+        snprintf(reply, sizeof(reply), "{\"command\":\"pong\",\"id\":%u}", message->id);
+        portal_ws_send_text(session, reply);
+        return;
+    }
+
+    if (0 == strcmp(command, "check_result")) {
+        portal_check_answered(message->id, message->granted);
+        return;
+    }
+
+    // A member's access changed. Without a card, everyone's may have.
+    if (0 == strcmp(command, "invalidate")) {
+        if (message->has_card) {
+            card_cache_invalidate(message->invalidate_card);
+        } else {
+            card_cache_clear();
+        }
+        return;
+    }
+
+    if (0 == strcmp(command, "unlock")) {
+        portal_unlock(session, message);
+        return;
+    }
+
+    // Firmware update. The image hash comes over this session, so the image
+    // itself can be fetched from anywhere, but only if the session's
+    // certificate was verified.
+    if (0 == strcmp(command, "update")) {
+        if (!portal_tls_verified(session)) {
+            ESP_LOGE(TAG, "Refused an update over an unverified session");
+        } else if ('\0' == message->url[0] || 0 == message->image_size || !message->sha256_valid) {
+            ESP_LOGW(TAG, "Incomplete update command");
+        } else if (!ota_start(message->url, message->image_size, message->sha256, message->delta)) {
+            ESP_LOGW(TAG, "Unable to start an update%s", ota_is_running() ? ", one is already running" : "");
+        }
+        return;
+    }
+
+    ESP_LOGW(TAG, "Unknown command \"%s\"", command);
+}
+
+// Binary messages
+
+static size_t portal_varint_put(uint8_t* out, uint64_t value) {
+    size_t size = 0;
+    do {
+        out[size] = value & 0x7F;
+        value >>= 7;
+        out[size++] |= value ? 0x80 : 0;
+    } while (0 != value);
+    return size;
+}
+
+// Signed values are zigzag encoded, so small negative numbers stay short
+static uint64_t portal_zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+// Handles a decoded field of a binary message.
+//
+// Returns false if the message is bad.
+static bool portal_binary_field(portal_rx_message_t* message, uint64_t value) {
+    const uint32_t field = message->fields++;
+
+    switch (message->type) {
+        case PORTAL_BIN_PING:
+        case PORTAL_BIN_CHECK_RESULT:
+            if (0 == field && value <= UINT32_MAX) {
+                message->id = value;
+                return true;
+            }
+            if (1 == field && PORTAL_BIN_CHECK_RESULT == message->type) {
+                message->granted = 0 != value;
+                return true;
+            }
+            return false;
+
+        case PORTAL_BIN_SYNC: {
+            if (0 == field) {
+                if (value > UINT32_MAX) {
+                    return false;
+                }
+                message->cards_left = value;
+                message->card = 0;
+                message->sync_started = true;
+                message->sync_start_time = esp_timer_get_time();
+                return card_store_update_begin();
+            }
+
+            const rfid_number_t card = message->card + value;
+            if (0 == message->cards_left || card < message->card) {
+                return false;
+            }
+            message->cards_left--;
+            message->card = card;
+            return card_store_update_add(card);
+        }
+
+        default:
+            return false;
+    }
+}
+
+static void portal_binary_start(portal_session_t* session) {
+    portal_rx_message_t* message = &session->message;
+    message->failed = false;
+    message->size = 0;
+    message->type = 0;
+    message->fields = 0;
+    message->varint = 0;
+    message->shift = 0;
+    message->sync_started = false;
+}
+
+static void portal_binary_data(portal_session_t* session, const uint8_t* data, size_t size) {
+    portal_rx_message_t* message = &session->message;
+    message->size += size;
+
+    for (size_t i = 0; i < size && !message->failed; i++) {
+        const uint8_t byte = data[i];
+        if (0 == message->type) {
+            message->type = byte;
+            message->failed = 0 == byte;
+            continue;
+        }
+
+        // Only one more bit fits after 63
+        if (message->shift > 63 || (63 == message->shift && (byte & 0x7E))) {
+            message->failed = true;
+            break;
+        }
+        message->varint |= (uint64_t)(byte & 0x7F) << message->shift;
+        message->shift += 7;
+        if (byte & 0x80) {
+            continue;
+        }
+
+        message->failed = !portal_binary_field(message, message->varint);
+        message->varint = 0;
+        message->shift = 0;
+    }
+}
+
+static void portal_binary_end(portal_session_t* session) {
+    portal_rx_message_t* message = &session->message;
+    const uint8_t type = message->type;
+
+    const bool complete = !message->failed && 0 == message->shift &&
+                          ((PORTAL_BIN_PING == type && 1 == message->fields) ||
+                           (PORTAL_BIN_CHECK_RESULT == type && 2 == message->fields) ||
+                           (PORTAL_BIN_SYNC == type && 0 != message->fields && 0 == message->cards_left));
+    if (!complete) {
+        ESP_LOGW(TAG, "Unable to handle a binary message from the portal (type 0x%02x)", type);
+        card_store_update_abort();
+        return;
+    }
+
+    switch (type) {
+        case PORTAL_BIN_PING: {
+            uint8_t reply[1 + PORTAL_VARINT_MAX] = {PORTAL_BIN_PONG};
+            const size_t size = 1 + portal_varint_put(&reply[1], message->id);
+            if (portal_ws_send(session, PORTAL_WS_BINARY, reply, size)) {
+                session->messages_out++;
+            }
+            break;
+        }
+
+        case PORTAL_BIN_CHECK_RESULT:
+            portal_check_answered(message->id, message->granted);
+            break;
+
+        case PORTAL_BIN_SYNC:
+            portal_sync_commit(message);
+            break;
+    }
+}
+
+// Either encoding
+
+static void portal_message_start(portal_session_t* session) {
+    if (PORTAL_WS_TEXT == session->rx.message_opcode) {
+        portal_json_start(session);
+    } else {
+        portal_binary_start(session);
+    }
+}
+
+static void portal_message_data(portal_session_t* session, const uint8_t* data, size_t size) {
+    if (PORTAL_WS_TEXT == session->rx.message_opcode) {
+        portal_json_data(session, data, size);
+    } else {
+        portal_binary_data(session, data, size);
+    }
+}
+
+static void portal_message_end(portal_session_t* session) {
+    if (PORTAL_WS_TEXT == session->rx.message_opcode) {
+        portal_json_end(session);
+    } else {
+        portal_binary_end(session);
+    }
+}
+
+static bool portal_authenticate(portal_session_t* session) {
+    char api_key[192];
+    char name[192];
+    if (!portal_json_escape(api_key, sizeof(api_key), config_get_portal_api_key()) ||
+        !portal_json_escape(name, sizeof(name), config_get_device_name())) {
+        return false;
+    }
+
+    char build[OTA_BUILD_ID_SIZE];
+    ota_get_build_id(build);
+
+    // A fresh nonce for remote unlocks, see portal_unlock()
+    uint8_t nonce[8];
+    mbedtls_ctr_drbg_random(&portal_drbg, nonce, sizeof(nonce));
+    for (size_t i = 0; i < sizeof(nonce); i++) {
+        snprintf(&session->unlock_nonce[i * 2], 3, "%02x", nonce[i]);
+    }
+    session->unlock_counter = 0;
+
+    char message[PORTAL_TX_FRAME_MAX];
+    const int size = snprintf(message, sizeof(message),
+                              "{\"command\":\"authenticate\",\"api_key\":\"%s\",\"device\":\"%s\",\"type\":\"%s\","
+                              "\"build\":\"%s\",\"nonce\":\"%s\"}",
+                              api_key, name, DEVICE_TYPE_DOOR == config_get_device_type() ? "door" : "interlock",
+                              build, session->unlock_nonce);
+    if (size < 0 || (size_t)size >= sizeof(message)) {
+        return false;
+    }
+    return portal_ws_send_text(session, message);
+}
+
+// =============================================================================
+// Heartbeat
+// =============================================================================
+
+// Type byte then varints: uptime (s), RTT (us, 0 if not yet measured), -RSSI
+// (0 if unknown), free heap, lowest free heap, flash reads, bytes read, writes,
+// bytes written, erases, errors, access decisions, granted, total latency (us),
+// last latency, highest latency, roams, last roam (ms), longest roam, card
+// cache hits, misses, time saved (ms), wakes from power save, longest wake
+// (us), estimated current (uA), last time from associating to ready (ms),
+// longest, UTC time (s, 0 if unknown), clock syncs, sync accuracy (us), offset
+// at the last sync (us, zigzag), drift (ppb, zigzag), NETWORK_RSSI_HISTORY
+// negated RSSIs, task count. Then for each task
+// its name length, the name's characters (ASCII, so each is a varint) and its
+// least spare stack in bytes.
+static bool portal_heartbeat_binary(portal_session_t* session, const health_t* health) {
+    const uint64_t fields[] = {
+        health->uptime_s,
+        session->rtt_us,
+        (uint8_t)-health->rssi,
+        health->heap_free,
+        health->heap_min,
+        health->flash.reads,
+        health->flash.read_bytes,
+        health->flash.writes,
+        health->flash.write_bytes,
+        health->flash.erases,
+        health->flash.errors,
+        health->access.decisions,
+        health->access.granted,
+        health->access.latency_total_us,
+        health->access.latency_last_us,
+        health->access.latency_max_us,
+        health->wifi.roams,
+        health->wifi.roam_last_ms,
+        health->wifi.roam_max_ms,
+        health->cache.hits,
+        health->cache.misses,
+        health->cache.saved_us / 1000,
+        health->wifi.wakes,
+        health->wifi.wake_max_us,
+        health->wifi.current_ua,
+        health->wifi.ready_last_ms,
+        health->wifi.ready_max_ms,
+        health->time_s,
+        health->clock.syncs,
+        health->clock.accuracy_us,
+        portal_zigzag(health->clock.offset_us),
+        portal_zigzag(health->clock.drift_ppb),
+    };
+
+    uint8_t message[PORTAL_TX_FRAME_MAX];
+    size_t size = 0;
+    message[size++] = PORTAL_BIN_HEARTBEAT;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        size += portal_varint_put(&message[size], fields[i]);
+    }
+    for (size_t i = 0; i < NETWORK_RSSI_HISTORY; i++) {
+        size += portal_varint_put(&message[size], (uint8_t)-health->wifi.rssi_history[i]);
+    }
+    size += portal_varint_put(&message[size], health->stack_count);
+
+    // Task names are at most configMAX_TASK_NAME_LEN, well inside the frame
+    for (uint8_t i = 0; i < health->stack_count; i++) {
+        const char* name = health->stacks[i].name;
+        const size_t length = strnlen(name, 16);
+        size += portal_varint_put(&message[size], length);
+        for (size_t c = 0; c < length; c++) {
+            message[size++] = name[c] & 0x7F;
+        }
+        size += portal_varint_put(&message[size], health->stacks[i].free);
+    }
+
+    if (!portal_ws_send(session, PORTAL_WS_BINARY, message, size)) {
+        return false;
+    }
+    session->messages_out++;
+    return true;
+}
+
+static bool portal_heartbeat_json(portal_session_t* session, const health_t* health) {
+    char message[PORTAL_TX_FRAME_MAX];
+    int used = snprintf(
+        message, sizeof(message),
+        "{\"command\":\"heartbeat\",\"uptime\":%u,\"rtt_us\":%u,\"rssi\":%d,\"heap\":%u,\"heap_min\":%u,"
+        "\"flash\":{\"reads\":%u,\"read_bytes\":%u,\"writes\":%u,\"write_bytes\":%u,\"erases\":%u,\"errors\":%u},"
+        "\"access\":{\"decisions\":%u,\"granted\":%u,\"latency_total_us\":%s,\"latency_last_us\":%u,"
+        "\"latency_max_us\":%u},\"cache\":{\"hits\":%u,\"misses\":%u,\"saved_ms\":%s},"
+        "\"clock\":{\"time\":%u,\"syncs\":%u,\"accuracy_us\":%u,\"offset_us\":%d,\"drift_ppb\":%d},"
+        "\"wifi\":{\"roams\":%u,\"roam_last_ms\":%u,\"roam_max_ms\":%u,\"wakes\":%u,\"wake_max_us\":%u,"
+        "\"current_ua\":%u,\"ready_last_ms\":%u,\"ready_max_ms\":%u,\"rssi_history\":[",
+        health->uptime_s, session->rtt_us, health->rssi, health->heap_free, health->heap_min, health->flash.reads,
+        health->flash.read_bytes, health->flash.writes, health->flash.write_bytes, health->flash.erases,
+        health->flash.errors, health->access.decisions, health->access.granted,
+        U64_DEC(health->access.latency_total_us), health->access.latency_last_us, health->access.latency_max_us,
+        health->cache.hits, health->cache.misses, U64_DEC(health->cache.saved_us / 1000), health->time_s,
+        health->clock.syncs, health->clock.accuracy_us, health->clock.offset_us, health->clock.drift_ppb,
+        health->wifi.roams, health->wifi.roam_last_ms, health->wifi.roam_max_ms, health->wifi.wakes,
+        health->wifi.wake_max_us, health->wifi.current_ua, health->wifi.ready_last_ms, health->wifi.ready_max_ms);
+
+    for (size_t i = 0; i < NETWORK_RSSI_HISTORY && used > 0 && (size_t)used < sizeof(message); i++) {
+        used += snprintf(&message[used], sizeof(message) - used, "%s%d", 0 == i ? "" : ",",
+                         health->wifi.rssi_history[i]);
+    }
+    if (used > 0 && (size_t)used < sizeof(message)) {
+        used += snprintf(&message[used], sizeof(message) - used, "]},\"stacks\":{");
+    }
+    for (uint8_t i = 0; i < health->stack_count && used > 0 && (size_t)used < sizeof(message); i++) {
+        char name[32];
+        if (!portal_json_escape(name, sizeof(name), health->stacks[i].name)) {
+            return false;
+        }
+        used += snprintf(&message[used], sizeof(message) - used, "%s\"%s\":%u", 0 == i ? "" : ",", name,
+                         health->stacks[i].free);
+    }
+    if (used > 0 && (size_t)used < sizeof(message)) {
+        used += snprintf(&message[used], sizeof(message) - used, "}}");
+    }
+
+    if (used < 0 || (size_t)used >= sizeof(message)) {
+        return false;
+    }
+    return portal_ws_send_text(session, message);
+}
+
+// Sends the device's health, so the portal can spot one going downhill.
+static bool portal_heartbeat(portal_session_t* session) {
+    health_t health;
+    health_get(&health);
+    return session->binary ? portal_heartbeat_binary(session, &health) : portal_heartbeat_json(session, &health);
+}
+
+// =============================================================================
+// Session
+// =============================================================================
+
+static void portal_session_close(portal_session_t* session) {
+    if (portal_connected) {
+        portal_connected = false;
+        ESP_LOGI(TAG, "Session closed, %u messages in, %u out", session->messages_in, session->messages_out);
+    }
+
+    // A sync cut off part way must not replace the card list
+    card_store_update_abort();
+
+    mbedtls_ssl_close_notify(&session->ssl);
+    mbedtls_net_free(&session->net);
+    mbedtls_ssl_free(&session->ssl);
+    mbedtls_ssl_config_free(&session->conf);
+
+    // Whatever was queued was meant for this session
+    xQueueReset(portal_queue);
+}
+
+// Connects, upgrades and authenticates.
+static bool portal_session_open(portal_session_t* session) {
+    memset(&session->rx, 0, sizeof(session->rx));
+    session->rx.header_needed = 2;
+    session->authenticated = false;
+    session->messages_in = 0;
+    session->rtt_us = 0;
+    session->messages_out = 0;
+    mbedtls_net_init(&session->net);
+    mbedtls_ssl_init(&session->ssl);
+    mbedtls_ssl_config_init(&session->conf);
+
+    const int64_t start_time = esp_timer_get_time();
+    const int64_t deadline = start_time + PORTAL_OPEN_TIMEOUT_MS * 1000LL;
+
+    uint32_t addr;
+    bool cached;
+    if (!resolver_get(config_get_portal_address(), &addr, &cached)) {
+        ESP_LOGW(TAG, "Unable to resolve %s", config_get_portal_address());
+        return false;
+    }
+    const int64_t dns_time = esp_timer_get_time();
+
+    if (!portal_tls_open(session, addr, deadline)) {
+        return false;
+    }
+    const int64_t tls_time = esp_timer_get_time();
+
+    if (!portal_ws_upgrade(session, deadline) || !portal_authenticate(session)) {
+        return false;
+    }
+
+    while (!session->authenticated) {
+        uint8_t buffer[128];
+        const int ret = mbedtls_ssl_read(&session->ssl, buffer, sizeof(buffer));
+        if (ret > 0) {
+            if (!portal_ws_receive(session, buffer, ret)) {
+                return false;
+            }
+        } else if (!portal_ssl_retry(ret) || esp_timer_get_time() > deadline) {
+            ESP_LOGW(TAG, "Portal did not accept the API key");
+            return false;
+        }
+    }
+
+    const int64_t end_time = esp_timer_get_time();
+    ESP_LOGI(TAG, "Session open using %s in %s ms (DNS %s ms %s, TLS %s ms, upgrade and authentication %s ms)",
+             session->binary ? PORTAL_WS_PROTOCOL_BINARY : PORTAL_WS_PROTOCOL_JSON,
+             I64_DEC((end_time - start_time) / 1000), I64_DEC((dns_time - start_time) / 1000),
+             cached ? "cached" : "looked up", I64_DEC((tls_time - dns_time) / 1000),
+             I64_DEC((end_time - tls_time) / 1000));
+    session->last_received = end_time;
+    return true;
+}
+
+// Runs an open session until it fails or the WiFi drops.
+static void portal_session_run(portal_session_t* session) {
+    int64_t last_ping = esp_timer_get_time();
+    int64_t last_heartbeat = last_ping;
+
+    portal_binary = session->binary;
+    portal_connected = true;
+    led_animation_set_status(LED_STATUS_IDLE);
+
+    // The card list may have changed while we were away
+    if (!portal_ws_send_text(session, "{\"command\":\"request_sync\"}") || !portal_heartbeat(session)) {
+        return;
+    }
+
+    while (network_is_connected()) {
+        // Incoming, waits up to PORTAL_POLL_MS
+        uint8_t buffer[256];
+        const int ret = mbedtls_ssl_read(&session->ssl, buffer, sizeof(buffer));
+        if (ret > 0) {
+            session->last_received = esp_timer_get_time();
+            if (!portal_ws_receive(session, buffer, ret)) {
+                return;
+            }
+        } else if (!portal_ssl_retry(ret)) {
+            ESP_LOGW(TAG, "Read failed: -0x%04x", -ret);
+            return;
+        }
+
+        // Outgoing
+        portal_message_t message;
+        while (pdTRUE == xQueueReceive(portal_queue, &message, 0)) {
+            const portal_ws_opcode_t opcode = message.binary ? PORTAL_WS_BINARY : PORTAL_WS_TEXT;
+            if (!portal_ws_send(session, opcode, message.data, message.size)) {
+                return;
+            }
+            session->messages_out++;
+        }
+
+        // Keepalive
+        const int64_t now = esp_timer_get_time();
+        if (now - session->last_received > PORTAL_DEAD_MS * 1000LL) {
+            ESP_LOGW(TAG, "Portal stopped responding");
+            return;
+        }
+        if (now - last_ping > PORTAL_KEEPALIVE_MS * 1000LL) {
+            last_ping = now;
+            if (!portal_ws_send(session, PORTAL_WS_PING, &now, sizeof(now))) {
+                return;
+            }
+        }
+        if (now - last_heartbeat > PORTAL_HEARTBEAT_MS * 1000LL) {
+            last_heartbeat = now;
+            if (!portal_heartbeat(session)) {
+                return;
+            }
+        }
+    }
+}
+
+static void portal_task(void* arg) {
+    uint32_t backoff_ms = PORTAL_BACKOFF_MIN_MS;
+
+    while (1) {
+        network_wait_for_connection(portMAX_DELAY);
+
+        if (portal_load_ca()) {
+            if (portal_session_open(&portal_session)) {
+                backoff_ms = PORTAL_BACKOFF_MIN_MS;
+                portal_session_run(&portal_session);
+            }
+            portal_session_close(&portal_session);
+        }
+
+        if (network_is_connected()) {
+            led_animation_set_status(LED_STATUS_OFFLINE);
+        }
+
+        // Jittered so a portal restart isn't met by every door at once
+        const uint32_t delay_ms = backoff_ms / 2 + esp_random() % (backoff_ms / 2 + 1);
+        ESP_LOGI(TAG, "Reconnecting in %u ms", delay_ms);
+        vTaskDelay(pdMS_TO_TICKS(delay_ms));
+        backoff_ms = backoff_ms * 2 < PORTAL_BACKOFF_MAX_MS ? backoff_ms * 2 : PORTAL_BACKOFF_MAX_MS;
+    }
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+bool portal_start(void) {
+    portal_queue = xQueueCreate(PORTAL_QUEUE_LENGTH, sizeof(portal_message_t));
+    portal_check_done = xSemaphoreCreateBinary();
+    if (NULL == portal_queue || NULL == portal_check_done) {
+        return false;
+    }
+
+    mbedtls_entropy_init(&portal_entropy);
+    mbedtls_ctr_drbg_init(&portal_drbg);
+    mbedtls_x509_crt_init(&portal_ca);
+    portal_tls_session_restore();
+    if (!resolver_start()) {
+        return false;
+    }
+    const char* personalisation = "interlock_portal";
+    if (0 != mbedtls_ctr_drbg_seed(&portal_drbg, mbedtls_entropy_func, &portal_entropy,
+                                   (const unsigned char*)personalisation, strlen(personalisation))) {
+        return false;
+    }
+
+    // TLS handshakes need a large stack
+    TaskHandle_t task;
+    if (pdPASS != xTaskCreate(portal_task, "Portal", 8192, NULL, tskIDLE_PRIORITY + 3, &task)) {
+        return false;
+    }
+    health_watch_task(task);
+    return true;
+}
+
+bool portal_is_connected(void) {
+    return portal_connected;
+}
+
+bool portal_send(const char* message) {
+    portal_message_t queued = {.binary = false};
+    const size_t size = strlcpy(queued.data, message, sizeof(queued.data));
+    if (!portal_connected || size >= sizeof(queued.data)) {
+        return false;
+    }
+    queued.size = size;
+    return pdTRUE == xQueueSend(portal_queue, &queued, 0);
+}
+
+// Queues a binary message of type `type` with up to four varint fields.
+static bool portal_send_binary(uint8_t type, size_t fields, uint64_t a, uint64_t b, uint64_t c, uint64_t d) {
+    portal_message_t queued = {.binary = true};
+    const uint64_t values[] = {a, b, c, d};
+    size_t size = 0;
+    queued.data[size++] = type;
+    for (size_t i = 0; i < fields; i++) {
+        size += portal_varint_put((uint8_t*)&queued.data[size], values[i]);
+    }
+    queued.size = size;
+    return portal_connected && pdTRUE == xQueueSend(portal_queue, &queued, 0);
+}
+
+bool portal_check_card(rfid_number_t card, TickType_t timeout, bool* out_granted) {
+    if (!portal_connected) {
+        return false;
+    }
+
+    // Forget any answer to an earlier check that timed out
+    xSemaphoreTake(portal_check_done, 0);
+    const uint32_t id = portal_check_id + 1;
+    portal_check_id = id;
+
+    bool sent;
+    if (portal_binary) {
+        sent = portal_send_binary(PORTAL_BIN_CHECK, 2, id, card, 0, 0);
+    } else {
+        char message[PORTAL_MESSAGE_MAX];
+        snprintf(message, sizeof(message), "{\"command\":\"check\",\"id\":%u,\"card\":%s}", id, U64_DEC(card));
+        sent = portal_send(message);
+    }
+    if (!sent || pdTRUE != xSemaphoreTake(portal_check_done, timeout)) {
+        return false;
+    }
+
+    *out_granted = portal_check_granted;
+    return true;
+}
+
+void portal_log_access(rfid_number_t card, bool granted, int64_t time) {
+    if (portal_binary) {
+        portal_send_binary(PORTAL_BIN_LOG_ACCESS, 4, 1, card, granted, time / 1000);
+        return;
+    }
+
+    char time_field[32] = "";
+    if (0 != time) {
+        snprintf(time_field, sizeof(time_field), ",\"time\":%s", I64_DEC(time / 1000));
+    }
+    char message[PORTAL_MESSAGE_MAX];
+    snprintf(message, sizeof(message), "{\"command\":\"log_access\",\"card\":%s,\"granted\":%s%s}", U64_DEC(card),
+             granted ? "true" : "false", time_field);
+    portal_send(message);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "core.h"
+#include "freertos/FreeRTOS.h"
+
+// Longest message that can be sent to the portal
+#define PORTAL_MESSAGE_MAX 192
+
+// Starts the portal client. It keeps a WebSocket session to the portal open
+// while the WiFi is connected, reconnecting when either drops.
+//
+// Must come after config_init() and network_start().
+//
+// Returns true on success.
+bool portal_start(void);
+
+// Returns true while a session is open and authenticated.
+bool portal_is_connected(void);
+
+// Queues a JSON text message for the portal. Never blocks.
+//
+// Returns false if there is no session or the queue is full.
+bool portal_send(const char* message);
+
+// Asks the portal whether `card` is allowed in. Only one check may be
+// outstanding at a time.
+//
+// Returns true and sets `out_granted` if the portal answered within `timeout`.
+bool portal_check_card(rfid_number_t card, TickType_t timeout, bool* out_granted);
+
+// Reports an access decision to the portal, made at `time` (microseconds since
+// 1970 UTC, 0 if not known). Dropped if there is no session.
+void portal_log_access(rfid_number_t card, bool granted, int64_t time);
@@ -0,0 +1,452 @@
+#include "resolver.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "core.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "file_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "health.h"
+#include "lwip/dns.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+
+#define TAG "resolver"
+
+// Last good address, so it survives a restart
+#define RESOLVER_PATH "/dns_cache.bin"
+#define RESOLVER_MAGIC 0x534E4449  // "IDNS"
+
+#define RESOLVER_QUERY_TIMEOUT_MS 2000
+#define RESOLVER_QUERY_ATTEMPTS 2
+
+// TTLs are clamped to this range. Addresses from the lwIP fallback, which
+// doesn't give a TTL, get the default.
+#define RESOLVER_TTL_MIN_S 30
+#define RESOLVER_TTL_MAX_S (24 * 60 * 60)
+#define RESOLVER_TTL_DEFAULT_S 300
+
+// After a failed refresh the cached address is kept and the lookup retried this
+// much later
+#define RESOLVER_RETRY_S 30
+
+#define RESOLVER_DNS_PORT 53
+#define RESOLVER_PACKET_MAX 512
+
+// Record types and class
+#define RESOLVER_TYPE_A 1
+#define RESOLVER_CLASS_IN 1
+
+// =============================================================================
+// Types
+// =============================================================================
+
+// As saved on the file system
+typedef struct resolver_record {
+    uint32_t magic;
+    uint32_t host;  // CRC of the host name
+    uint32_t addr;
+} resolver_record_t;
+
+// =============================================================================
+// State
+// =============================================================================
+
+static SemaphoreHandle_t resolver_mutex = NULL;
+static TaskHandle_t resolver_task_handle = NULL;
+
+// The cache, guarded by resolver_mutex
+static char resolver_host[RESOLVER_HOST_MAX];
+static bool resolver_loaded = false;  // The saved address has been read
+static uint32_t resolver_addr = 0;    // 0 if there is none
+static int64_t resolver_expires = 0;  // When the TTL runs out
+static bool resolver_suspect = false; // Connecting to the address failed
+
+// =============================================================================
+// DNS
+// =============================================================================
+
+static void resolver_format(uint32_t addr, char out[16]) {
+    const uint8_t* bytes = (const uint8_t*)&addr;
+    snprintf(out, 16, "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+}
+
+static uint16_t resolver_read_u16(const uint8_t* data) {
+    return data[0] << 8 | data[1];
+}
+
+// Builds a recursive query for the A record of `host`.
+//
+// Returns the size of the query, or 0 if `host` is not a valid name.
+static size_t resolver_build_query(uint8_t* packet, uint16_t id, const char* host) {
+    // ID, recursion desired, one question
+    const uint8_t header[12] = {id >> 8, id & 0xFF, 0x01, 0x00, 0x00, 0x01};
+    memcpy(packet, header, sizeof(header));
+    size_t used = sizeof(header);
+
+    // Name, as length prefixed labels
+    const char* label = host;
+    while ('\0' != *label) {
+        const size_t length = strcspn(label, ".");
+        if (0 == length || length > 63) {
+            return 0;
+        }
+        packet[used++] = length;
+        memcpy(&packet[used], label, length);
+        used += length;
+        label += length;
+        if ('.' == *label) {
+            label++;
+        }
+    }
+    packet[used++] = 0;
+
+    const uint8_t question[4] = {0, RESOLVER_TYPE_A, 0, RESOLVER_CLASS_IN};
+    memcpy(&packet[used], question, sizeof(question));
+    return used + sizeof(question);
+}
+
+// Returns the offset after the name at `pos`, or 0 if it runs off the end.
+static size_t resolver_skip_name(const uint8_t* packet, size_t size, size_t pos) {
+    while (pos < size) {
+        const uint8_t length = packet[pos];
+        if (0 == length) {
+            return pos + 1;
+        }
+        if (0xC0 == (length & 0xC0)) {
+            // Compressed, the rest of the name is elsewhere
+            return pos + 2 <= size ? pos + 2 : 0;
+        }
+        pos += 1 + length;
+    }
+    return 0;
+}
+
+// Checks `reply` answers `query`: the same ID and the same single question, so
+// a spoofed reply has to have seen the query. Names are compared ignoring case,
+// which servers needn't keep. The label lengths, type and class are never
+// letters, so the whole question can be compared that way.
+static bool resolver_answers(const uint8_t* reply, size_t reply_size, const uint8_t* query, size_t query_size) {
+    if (reply_size < query_size || 0 != memcmp(reply, query, 2) || 1 != resolver_read_u16(&reply[4])) {
+        return false;
+    }
+    for (size_t i = 12; i < query_size; i++) {
+        if (tolower(reply[i]) != tolower(query[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Picks the first address out of a reply. The TTL is the shortest in the
+// answer, so a CNAME that expires first counts.
+static bool resolver_parse(const uint8_t* packet, size_t size, uint32_t* out_addr, uint32_t* out_ttl) {
+    // Must be a reply with no error
+    if (size < 12 || !(packet[2] & 0x80) || 0 != (packet[3] & 0x0F)) {
+        return false;
+    }
+
+    size_t pos = 12;
+    const uint16_t questions = resolver_read_u16(&packet[4]);
+    for (uint16_t i = 0; i < questions; i++) {
+        pos = resolver_skip_name(packet, size, pos);
+        if (0 == pos || pos + 4 > size) {
+            return false;
+        }
+        pos += 4;
+    }
+
+    bool found = false;
+    uint32_t ttl = UINT32_MAX;
+    const uint16_t answers = resolver_read_u16(&packet[6]);
+    for (uint16_t i = 0; i < answers; i++) {
+        pos = resolver_skip_name(packet, size, pos);
+        if (0 == pos || pos + 10 > size) {
+            return false;
+        }
+        const uint16_t type = resolver_read_u16(&packet[pos]);
+        const uint16_t class = resolver_read_u16(&packet[pos + 2]);
+        const uint32_t record_ttl = (uint32_t)resolver_read_u16(&packet[pos + 4]) << 16 |
+                                    resolver_read_u16(&packet[pos + 6]);
+        const uint16_t length = resolver_read_u16(&packet[pos + 8]);
+        pos += 10;
+        if (pos + length > size) {
+            return false;
+        }
+
+        if (RESOLVER_CLASS_IN == class && record_ttl < ttl) {
+            ttl = record_ttl;
+        }
+        if (RESOLVER_TYPE_A == type && RESOLVER_CLASS_IN == class && 4 == length && !found) {
+            memcpy(out_addr, &packet[pos], 4);
+            found = true;
+        }
+        pos += length;
+    }
+
+    *out_ttl = ttl;
+    return found;
+}
+
+// Asks the DNS server lwIP got from DHCP directly, as lwIP's own resolver
+// doesn't give out the TTL.
+static bool resolver_query(const char* host, uint32_t* out_addr, uint32_t* out_ttl) {
+    const ip_addr_t* server = dns_getserver(0);
+    if (NULL == server || ip_addr_isany(server)) {
+        return false;
+    }
+
+    uint8_t query[RESOLVER_PACKET_MAX];
+    const uint16_t id = esp_random();
+    const size_t query_size = resolver_build_query(query, id, host);
+    if (0 == query_size) {
+        return false;
+    }
+
+    const int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        return false;
+    }
+    const struct timeval timeout = {
+        .tv_sec = RESOLVER_QUERY_TIMEOUT_MS / 1000,
+        .tv_usec = (RESOLVER_QUERY_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(RESOLVER_DNS_PORT),
+    };
+    to.sin_addr.s_addr = ip4_addr_get_u32(ip_2_ip4(server));
+
+    bool ok = false;
+    bool answered = false;
+    for (int attempt = 0; attempt < RESOLVER_QUERY_ATTEMPTS && !answered; attempt++) {
+        if ((int)query_size != sendto(sock, query, query_size, 0, (struct sockaddr*)&to, sizeof(to))) {
+            break;
+        }
+
+        // Skip anything that isn't from the server or isn't the reply to this
+        // query, until the timeout
+        uint8_t reply[RESOLVER_PACKET_MAX];
+        struct sockaddr_in from;
+        socklen_t from_size = sizeof(from);
+        int received;
+        while (!answered &&
+               (received = recvfrom(sock, reply, sizeof(reply), 0, (struct sockaddr*)&from, &from_size)) >= 0) {
+            if (sizeof(from) == from_size && to.sin_addr.s_addr == from.sin_addr.s_addr &&
+                to.sin_port == from.sin_port && resolver_answers(reply, received, query, query_size)) {
+                answered = true;
+                ok = resolver_parse(reply, received, out_addr, out_ttl);
+            }
+            from_size = sizeof(from);
+        }
+    }
+
+    close(sock);
+    return ok;
+}
+
+// lwIP's resolver, in case the server's replies can't be parsed.
+static bool resolver_fallback(const char* host, uint32_t* out_addr) {
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo* result = NULL;
+    if (0 != getaddrinfo(host, NULL, &hints, &result) || NULL == result) {
+        return false;
+    }
+    *out_addr = ((const struct sockaddr_in*)result->ai_addr)->sin_addr.s_addr;
+    freeaddrinfo(result);
+    return true;
+}
+
+static bool resolver_lookup(const char* host, uint32_t* out_addr, uint32_t* out_ttl) {
+    const int64_t start_time = esp_timer_get_time();
+    bool ok = resolver_query(host, out_addr, out_ttl);
+    if (!ok && (ok = resolver_fallback(host, out_addr))) {
+        *out_ttl = RESOLVER_TTL_DEFAULT_S;
+    }
+    const int64_t lookup_time = esp_timer_get_time() - start_time;
+
+    if (!ok) {
+        ESP_LOGW(TAG, "Unable to look up %s (%s ms)", host, I64_DEC(lookup_time / 1000));
+        return false;
+    }
+
+    *out_ttl = *out_ttl < RESOLVER_TTL_MIN_S ? RESOLVER_TTL_MIN_S
+               : *out_ttl > RESOLVER_TTL_MAX_S ? RESOLVER_TTL_MAX_S
+                                               : *out_ttl;
+    char text[16];
+    resolver_format(*out_addr, text);
+    ESP_LOGI(TAG, "%s is %s, TTL %u s, looked up in %s ms", host, text, *out_ttl, I64_DEC(lookup_time / 1000));
+    return true;
+}
+
+// =============================================================================
+// Cache
+// =============================================================================
+
+// Reads the saved address. Must hold resolver_mutex.
+static void resolver_load(void) {
+    lfs_t* fs = fs_get_and_lock(pdMS_TO_TICKS(1000));
+    if (NULL == fs) {
+        // Not mounted yet (warm boot), try again next time
+        return;
+    }
+
+    lfs_file_t file;
+    resolver_record_t record;
+    if (0 <= lfs_file_open(fs, &file, RESOLVER_PATH, LFS_O_RDONLY)) {
+        if (sizeof(record) == lfs_file_read(fs, &file, &record, sizeof(record)) && RESOLVER_MAGIC == record.magic &&
+            crc32_update(0, resolver_host, strlen(resolver_host)) == record.host) {
+            // Unknown age, so it is used but refreshed straight away
+            resolver_addr = record.addr;
+            resolver_expires = 0;
+        }
+        lfs_file_close(fs, &file);
+    }
+    fs_unlock(fs);
+    resolver_loaded = true;
+}
+
+static void resolver_save(const char* host, uint32_t addr) {
+    const resolver_record_t record = {
+        .magic = RESOLVER_MAGIC,
+        .host = crc32_update(0, host, strlen(host)),
+        .addr = addr,
+    };
+
+    lfs_t* fs = fs_get_and_lock(portMAX_DELAY);
+    if (NULL == fs) {
+        return;
+    }
+    lfs_file_t file;
+    if (0 <= lfs_file_open(fs, &file, RESOLVER_PATH, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC)) {
+        lfs_file_write(fs, &file, &record, sizeof(record));
+        lfs_file_close(fs, &file);
+    }
+    fs_unlock(fs);
+}
+
+// Takes the result of a lookup.
+static void resolver_store(const char* host, uint32_t addr, uint32_t ttl) {
+    xSemaphoreTake(resolver_mutex, portMAX_DELAY);
+    if (0 != strcmp(host, resolver_host)) {
+        // The host changed during the lookup
+        xSemaphoreGive(resolver_mutex);
+        return;
+    }
+    const bool changed = addr != resolver_addr;
+    resolver_addr = addr;
+    resolver_expires = esp_timer_get_time() + ttl * 1000000LL;
+    resolver_suspect = false;
+    xSemaphoreGive(resolver_mutex);
+
+    // Only written when it changes, to spare the flash
+    if (changed) {
+        resolver_save(host, addr);
+    }
+}
+
+static void resolver_task(void* arg) {
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        char host[RESOLVER_HOST_MAX];
+        xSemaphoreTake(resolver_mutex, portMAX_DELAY);
+        strlcpy(host, resolver_host, sizeof(host));
+        xSemaphoreGive(resolver_mutex);
+
+        uint32_t addr;
+        uint32_t ttl;
+        if (resolver_lookup(host, &addr, &ttl)) {
+            resolver_store(host, addr, ttl);
+        } else {
+            xSemaphoreTake(resolver_mutex, portMAX_DELAY);
+            resolver_expires = esp_timer_get_time() + RESOLVER_RETRY_S * 1000000LL;
+            xSemaphoreGive(resolver_mutex);
+        }
+    }
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+bool resolver_start(void) {
+    resolver_mutex = xSemaphoreCreateMutex();
+    if (NULL == resolver_mutex) {
+        return false;
+    }
+    if (pdPASS != xTaskCreate(resolver_task, "Resolver", 3072, NULL, tskIDLE_PRIORITY + 1, &resolver_task_handle)) {
+        return false;
+    }
+    health_watch_task(resolver_task_handle);
+    return true;
+}
+
+bool resolver_get(const char* host, uint32_t* out_addr, bool* out_cached) {
+    struct in_addr literal;
+    if (inet_aton(host, &literal)) {
+        *out_addr = literal.s_addr;
+        *out_cached = true;
+        return true;
+    }
+    if (strlen(host) >= RESOLVER_HOST_MAX) {
+        return false;
+    }
+
+    xSemaphoreTake(resolver_mutex, portMAX_DELAY);
+    if (0 != strcmp(host, resolver_host)) {
+        strlcpy(resolver_host, host, sizeof(resolver_host));
+        resolver_addr = 0;
+        resolver_suspect = false;
+        resolver_loaded = false;
+    }
+    if (!resolver_loaded) {
+        resolver_load();
+    }
+    const uint32_t cached = resolver_addr;
+    const bool usable = 0 != cached && !resolver_suspect;
+    const bool stale = esp_timer_get_time() >= resolver_expires;
+    xSemaphoreGive(resolver_mutex);
+
+    // Connect now, refresh behind it
+    if (usable) {
+        if (stale) {
+            xTaskNotifyGive(resolver_task_handle);
+        }
+        *out_addr = cached;
+        *out_cached = true;
+        return true;
+    }
+
+    uint32_t ttl;
+    if (resolver_lookup(host, out_addr, &ttl)) {
+        resolver_store(host, *out_addr, ttl);
+        *out_cached = false;
+        return true;
+    }
+
+    // A suspect address is still better than none
+    *out_addr = cached;
+    *out_cached = true;
+    return 0 != cached;
+}
+
+void resolver_failed(const char* host) {
+    xSemaphoreTake(resolver_mutex, portMAX_DELAY);
+    if (0 == strcmp(host, resolver_host)) {
+        resolver_suspect = true;
+    }
+    xSemaphoreGive(resolver_mutex);
+}
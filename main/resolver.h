@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// =============================================================================
+// Resolver
+// =============================================================================
+//
+// Caches the address of one host (the portal), so reconnecting doesn't wait on
+// a slow DNS server. Lookups honour the record's TTL, and the last good address
+// is kept on the file system so it survives a restart.
+//
+// A cached address is handed out even once its TTL has run out, and refreshed
+// in the background, so connecting never waits on DNS unless there is no
+// address at all or the cached one stopped working.
+
+// Longest host name that can be looked up, including the null
+#define RESOLVER_HOST_MAX 254
+
+// Starts the background refresh task.
+//
+// Returns true on success.
+bool resolver_start(void);
+
+// Gets an IPv4 address (network byte order) for `host`. Host names that are
+// already an address are simply converted.
+//
+// Sets `out_cached` if the address came from the cache rather than a lookup
+// made during the call.
+//
+// Returns false if there is no cached address and the lookup failed.
+bool resolver_get(const char* host, uint32_t* out_addr, bool* out_cached);
+
+// Reports that connecting to the address from resolver_get() failed. The next
+// resolver_get() looks the host up again before using the cache.
+void resolver_failed(const char* host);
@@ -0,0 +1,170 @@
+#include "rfid.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+// Only the drivers selected by INTERLOCK_RFID_DRIVER are built
+#if defined(CONFIG_INTERLOCK_RFID_DRIVER_LEGACY)
+#define RFID_HAS_RF125PS 0
+#else
+#define RFID_HAS_RF125PS 1
+#endif
+
+#if defined(CONFIG_INTERLOCK_RFID_DRIVER_RF125PS)
+#define RFID_HAS_LEGACY 0
+#else
+#define RFID_HAS_LEGACY 1
+#endif
+
+#if RFID_HAS_RF125PS
+#include "rfid_rf125ps.h"
+#endif
+#if RFID_HAS_LEGACY
+#include "rfid_legacy.h"
+#endif
+
+#define TAG "rfid"
+
+// Number of events that can be waiting to be handled
+#define RFID_QUEUE_LENGTH 4
+
+static QueueHandle_t rfid_queue = NULL;
+static void (*rfid_frame_hook)(void) = NULL;
+
+// =============================================================================
+// Coalescing
+// =============================================================================
+
+// A card not read for this long has been removed from the reader
+#define RFID_COALESCE_WINDOW_MS 500
+
+// Minimum time between RFID_EVENT_CARD_STILL_PRESENT events for a card
+#define RFID_STILL_PRESENT_INTERVAL_MS 1000
+
+// Number of recently read cards remembered. More than one so two cards
+// fighting over the reader don't each look new on every read.
+#define RFID_RECENT_SLOTS 4
+
+typedef struct rfid_recent {
+    rfid_number_t card;
+    TickType_t last_read;      // When the card was last read
+    TickType_t last_reported;  // When an event was last sent for the card
+    bool used;
+} rfid_recent_t;
+
+static rfid_recent_t rfid_recent[RFID_RECENT_SLOTS] = {0};
+static rfid_stats_t rfid_stats = {0};
+
+static void rfid_send(rfid_event_type_t type, rfid_number_t card) {
+    const rfid_event_t event = {.type = type, .card = card, .time = esp_timer_get_time()};
+
+    // Drop the event if nobody is keeping up, the card will be read again
+    if (pdTRUE != xQueueSend(rfid_queue, &event, 0)) {
+        ESP_LOGW(TAG, "Event queue full, dropping read");
+    }
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+void rfid_console_init(void) {
+#if RFID_HAS_RF125PS
+    rfid_rf125ps_console_init();
+#endif
+}
+
+bool rfid_start(rfid_reader_type_t type) {
+    rfid_queue = xQueueCreate(RFID_QUEUE_LENGTH, sizeof(rfid_event_t));
+    if (NULL == rfid_queue) {
+        return false;
+    }
+
+    switch (type) {
+#if RFID_HAS_LEGACY
+        case RFID_READER_TYPE_LEGACY:
+            return rfid_legacy_start();
+#endif
+#if RFID_HAS_RF125PS
+        case RFID_READER_TYPE_RF125PS:
+            return rfid_rf125ps_start();
+#endif
+        default:
+            ESP_LOGE(TAG, "This firmware was built without a driver for the configured reader");
+            return false;
+    }
+}
+
+bool rfid_wait_for_event(rfid_event_t* out_event, TickType_t timeout) {
+    if (NULL == rfid_queue) {
+        vTaskDelay(timeout);
+        return false;
+    }
+    return pdTRUE == xQueueReceive(rfid_queue, out_event, timeout);
+}
+
+void rfid_get_stats(rfid_stats_t* out_stats) {
+    taskENTER_CRITICAL();
+    *out_stats = rfid_stats;
+    taskEXIT_CRITICAL();
+}
+
+void rfid_set_frame_hook(void (*hook)(void)) {
+    rfid_frame_hook = hook;
+}
+
+void rfid_frame_started(void) {
+    if (NULL != rfid_frame_hook) {
+        rfid_frame_hook();
+    }
+}
+
+void rfid_submit(rfid_number_t card) {
+    const TickType_t now = xTaskGetTickCount();
+    rfid_recent_t* oldest = &rfid_recent[0];
+
+    // Only the driver task writes the counters
+    rfid_stats.reads++;
+
+    for (int i = 0; i < RFID_RECENT_SLOTS; i++) {
+        rfid_recent_t* recent = &rfid_recent[i];
+
+        // Repeat of a card that is still at the reader
+        if (recent->used && recent->card == card &&
+            now - recent->last_read < pdMS_TO_TICKS(RFID_COALESCE_WINDOW_MS)) {
+            recent->last_read = now;
+            const bool report = now - recent->last_reported >= pdMS_TO_TICKS(RFID_STILL_PRESENT_INTERVAL_MS);
+
+            if (report) {
+                rfid_stats.still_present++;
+                recent->last_reported = now;
+                rfid_send(RFID_EVENT_CARD_STILL_PRESENT, card);
+            } else {
+                rfid_stats.collapsed++;
+            }
+            return;
+        }
+
+        // Track the least recently read slot, preferring unused ones
+        if (oldest->used && (!recent->used || now - recent->last_read > now - oldest->last_read)) {
+            oldest = recent;
+        }
+    }
+
+    // A new card, it replaces the least recently read one
+    oldest->card = card;
+    oldest->last_read = now;
+    oldest->last_reported = now;
+    oldest->used = true;
+
+    rfid_stats.presented++;
+
+    rfid_send(RFID_EVENT_CARD_PRESENTED, card);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "freertos/FreeRTOS.h"
+
+// =============================================================================
+// Types
+// =============================================================================
+
+typedef enum rfid_event_type {
+    RFID_EVENT_CARD_PRESENTED,      // A card was presented to the reader
+    RFID_EVENT_CARD_STILL_PRESENT,  // A card is still being held at the reader
+} rfid_event_type_t;
+
+typedef struct rfid_event {
+    rfid_event_type_t type;
+    rfid_number_t card;
+    int64_t time;  // esp_timer time of the read
+} rfid_event_t;
+
+typedef struct rfid_stats {
+    uint32_t reads;          // Reads decoded by the driver
+    uint32_t presented;      // RFID_EVENT_CARD_PRESENTED events sent
+    uint32_t still_present;  // RFID_EVENT_CARD_STILL_PRESENT events sent
+    uint32_t collapsed;      // Repeated reads that were dropped
+} rfid_stats_t;
+
+// =============================================================================
+// Interface
+// =============================================================================
+
+// Sets up log output for the drivers that share a UART with the console. Call
+// first thing, before anything else hooks log output, as it must stay next to
+// the UART.
+void rfid_console_init(void);
+
+// Starts the RFID reader driver for `type`.
+//
+// Returns true if the reader was started.
+bool rfid_start(rfid_reader_type_t type);
+
+// Waits up to `timeout` for a card event.
+//
+// Readers repeat a card many times a second while it is held at the reader.
+// Repeats are coalesced: the first read of a card produces
+// RFID_EVENT_CARD_PRESENTED, and further reads at most one
+// RFID_EVENT_CARD_STILL_PRESENT per second.
+//
+// Returns true if there was an event, in which case it is placed in
+// `out_event`.
+bool rfid_wait_for_event(rfid_event_t* out_event, TickType_t timeout);
+
+// Gets a copy of the read counters.
+void rfid_get_stats(rfid_stats_t* out_stats);
+
+// Sets a function called, from the driver's task, whenever a frame starts
+// arriving from the reader. It runs before the frame is decoded, let alone
+// checked, so must be quick: set a flag or start a timer, and leave anything
+// that can block or take a lock to another task.
+void rfid_set_frame_hook(void (*hook)(void));
+
+// =============================================================================
+// Driver Interface
+// =============================================================================
+
+// Called by reader drivers, from a task, each time a card is decoded.
+void rfid_submit(rfid_number_t card);
+
+// Called by reader drivers, from a task, when the first data of a frame
+// arrives.
+void rfid_frame_started(void);
@@ -0,0 +1,212 @@
+#include "rfid_legacy.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "health.h"
+#include "rfid.h"
+#include "sdkconfig.h"
+
+#define TAG "rfid_legacy"
+
+// =============================================================================
+// Hardware
+// =============================================================================
+
+#define RFID_LEGACY_D0_GPIO GPIO_NUM_4
+#define RFID_LEGACY_D1_GPIO GPIO_NUM_5
+
+// Timestamps are CPU cycle counts
+#define RFID_LEGACY_CYCLES_PER_US CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ
+
+// Wiegand pulses are at least ~1 ms apart. Edges closer than this are noise.
+#define RFID_LEGACY_MIN_EDGE_GAP_US 200
+
+// A frame ends when no edges arrive for this long.
+#define RFID_LEGACY_FRAME_GAP_US 25000
+
+// How often the decoder task drains the edge ring.
+#define RFID_LEGACY_POLL_MS 10
+
+// The host simulator (host/sim/sim_wiegand.c) builds this file with its own
+// clock in place of the CPU's.
+#ifndef RFID_LEGACY_SIMULATOR
+static inline uint32_t rfid_legacy_ccount(void) {
+    uint32_t ccount;
+    __asm__ __volatile__("rsr %0, ccount" : "=a"(ccount));
+    return ccount;
+}
+#endif
+
+// =============================================================================
+// Edge Ring
+// =============================================================================
+
+// Single producer (the ISR), single consumer (the decoder task) ring of edges.
+// Each entry is the cycle count of a falling edge, with bit 0 replaced by the
+// line (0 for D0, 1 for D1). The head is only written by the ISR and the tail
+// only by the task, so no locking is needed on this single core CPU.
+#define RFID_LEGACY_RING_SIZE 128  // Must be a power of 2
+
+static volatile uint32_t rfid_legacy_ring[RFID_LEGACY_RING_SIZE];
+static volatile uint32_t rfid_legacy_ring_head = 0;
+static volatile uint32_t rfid_legacy_ring_tail = 0;
+static volatile bool rfid_legacy_ring_overrun = false;
+
+static void IRAM_ATTR rfid_legacy_isr(void* line) {
+    const uint32_t head = rfid_legacy_ring_head;
+    if (head - rfid_legacy_ring_tail < RFID_LEGACY_RING_SIZE) {
+        rfid_legacy_ring[head & (RFID_LEGACY_RING_SIZE - 1)] = (rfid_legacy_ccount() & ~1u) | (uint32_t)(uintptr_t)line;
+        rfid_legacy_ring_head = head + 1;
+    } else {
+        rfid_legacy_ring_overrun = true;
+    }
+}
+
+// =============================================================================
+// Decoder
+// =============================================================================
+
+#define RFID_LEGACY_MAX_BITS 64
+
+typedef struct rfid_legacy_decoder {
+    uint64_t bits;       // Received bits, first bit is the most significant
+    uint8_t n_bits;      // Number of bits received in the current frame
+    bool error;          // The current frame is corrupt and must be dropped
+    uint32_t last_edge;  // Timestamp of the last edge in the current frame
+} rfid_legacy_decoder_t;
+
+static void rfid_legacy_decoder_edge(rfid_legacy_decoder_t* decoder, uint32_t edge) {
+    const uint32_t timestamp = edge & ~1u;
+    const uint32_t bit = edge & 1u;
+
+    if (decoder->n_bits > 0 &&
+        timestamp - decoder->last_edge < RFID_LEGACY_MIN_EDGE_GAP_US * RFID_LEGACY_CYCLES_PER_US) {
+        decoder->error = true;
+    }
+
+    if (decoder->n_bits >= RFID_LEGACY_MAX_BITS) {
+        decoder->error = true;
+    } else {
+        decoder->bits = (decoder->bits << 1) | bit;
+        decoder->n_bits++;
+    }
+    decoder->last_edge = timestamp;
+}
+
+// Checks the parity of a 26 or 34 bit Wiegand frame and extracts the card
+// number. The first bit is even parity over the first half of the data, the
+// last bit is odd parity over the second half.
+static bool rfid_legacy_decode_frame(uint64_t bits, uint8_t n_bits, rfid_number_t* out_card) {
+    if (26 != n_bits && 34 != n_bits) {
+        return false;
+    }
+
+    const uint8_t n_data = n_bits - 2;
+    const uint8_t half = n_data / 2;
+    // Each half includes its parity bit
+    const uint64_t first_half = bits >> (half + 1);
+    const uint64_t second_half = bits & ((UINT64_C(1) << (half + 1)) - 1);
+
+    if (0 != (__builtin_popcountll(first_half) & 1) || 1 != (__builtin_popcountll(second_half) & 1)) {
+        return false;
+    }
+
+    *out_card = (bits >> 1) & ((UINT64_C(1) << n_data) - 1);
+    return true;
+}
+
+// Completes the current frame if the line has been idle long enough.
+//
+// Returns true if a valid card was decoded.
+static bool rfid_legacy_decoder_poll(rfid_legacy_decoder_t* decoder, uint32_t now, rfid_number_t* out_card) {
+    if (0 == decoder->n_bits) {
+        decoder->error = false;
+        return false;
+    }
+
+    if (now - decoder->last_edge < RFID_LEGACY_FRAME_GAP_US * RFID_LEGACY_CYCLES_PER_US) {
+        return false;
+    }
+
+    bool ok = !decoder->error && rfid_legacy_decode_frame(decoder->bits, decoder->n_bits, out_card);
+    if (!ok) {
+        ESP_LOGW(TAG, "Dropped bad %u bit frame", decoder->n_bits);
+    }
+
+    decoder->bits = 0;
+    decoder->n_bits = 0;
+    decoder->error = false;
+    return ok;
+}
+
+static void rfid_legacy_task(void* arg) {
+    rfid_legacy_decoder_t decoder = {0};
+    uint32_t tail = rfid_legacy_ring_tail;
+
+    while (1) {
+        // Edges were lost, so the frame they belonged to can't be trusted
+        if (rfid_legacy_ring_overrun) {
+            rfid_legacy_ring_overrun = false;
+            decoder.error = true;
+        }
+
+        // Drain the ring
+        while (tail != rfid_legacy_ring_head) {
+            const uint32_t edge = rfid_legacy_ring[tail & (RFID_LEGACY_RING_SIZE - 1)];
+            tail++;
+            rfid_legacy_ring_tail = tail;
+            if (0 == decoder.n_bits) {
+                rfid_frame_started();
+            }
+            rfid_legacy_decoder_edge(&decoder, edge);
+        }
+
+        rfid_number_t card;
+        if (rfid_legacy_decoder_poll(&decoder, rfid_legacy_ccount(), &card)) {
+            rfid_submit(card);
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(RFID_LEGACY_POLL_MS));
+    }
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+bool rfid_legacy_start(void) {
+    const gpio_config_t io_config = {
+        .pin_bit_mask = (1 << RFID_LEGACY_D0_GPIO) | (1 << RFID_LEGACY_D1_GPIO),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    if (ESP_OK != gpio_config(&io_config)) {
+        return false;
+    }
+
+    // The ISR service may already have been installed by another driver
+    const esp_err_t err = gpio_install_isr_service(0);
+    if (ESP_OK != err && ESP_ERR_INVALID_STATE != err) {
+        return false;
+    }
+
+    if (ESP_OK != gpio_isr_handler_add(RFID_LEGACY_D0_GPIO, rfid_legacy_isr, (void*)0) ||
+        ESP_OK != gpio_isr_handler_add(RFID_LEGACY_D1_GPIO, rfid_legacy_isr, (void*)1)) {
+        return false;
+    }
+
+    TaskHandle_t task;
+    if (pdPASS != xTaskCreate(rfid_legacy_task, "RFID Legacy", 2048, NULL, tskIDLE_PRIORITY + 3, &task)) {
+        return false;
+    }
+    health_watch_task(task);
+    return true;
+}
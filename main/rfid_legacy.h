@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Driver for the legacy Wiegand RFID reader.
+//
+// The reader pulls D0 low for a 0 bit and D1 low for a 1 bit. The GPIO ISR only
+// records a timestamp for each falling edge; bits are decoded and checked in a
+// task, so the ISR stays short and a late ISR (e.g. behind the WiFi NMI) can't
+// corrupt a frame.
+
+// Starts the legacy reader driver. Decoded cards are passed to rfid_submit().
+//
+// Returns true on success.
+bool rfid_legacy_start(void);
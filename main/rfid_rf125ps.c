@@ -0,0 +1,151 @@
+#include "rfid_rf125ps.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "driver/uart.h"
+#include "esp8266/eagle_soc.h"
+#include "esp8266/uart_register.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "health.h"
+#include "rfid.h"
+
+#define TAG "rfid_rf125ps"
+
+// =============================================================================
+// Hardware
+// =============================================================================
+
+// The reader is wired to UART0 RX. The console shares UART0, so log output
+// drops to the reader's baud rate once the driver starts, see
+// rfid_rf125ps_console_init().
+#define RFID_RF125PS_UART UART_NUM_0
+#define RFID_RF125PS_BAUD 9600
+#define RFID_RF125PS_RX_BUFFER_SIZE 256  // Must be larger than the 128 byte FIFO
+#define RFID_RF125PS_TX_FIFO_SIZE 128
+
+// =============================================================================
+// Console
+// =============================================================================
+
+static putchar_like_t rfid_rf125ps_console_next = NULL;  // The UART, before the driver starts
+static volatile bool rfid_rf125ps_console_shared = false;
+
+static int rfid_rf125ps_console_putchar(int c) {
+    if (!rfid_rf125ps_console_shared) {
+        return NULL != rfid_rf125ps_console_next ? rfid_rf125ps_console_next(c) : c;
+    }
+    // Dropped rather than waited for, see rfid_rf125ps_console_init()
+    const uint32_t queued = (READ_PERI_REG(UART_STATUS(RFID_RF125PS_UART)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT;
+    if (queued < RFID_RF125PS_TX_FIFO_SIZE) {
+        WRITE_PERI_REG(UART_FIFO(RFID_RF125PS_UART), c);
+    }
+    return c;
+}
+
+// =============================================================================
+// Frames
+// =============================================================================
+
+// A frame is STX, 10 hex digits of card data, 2 hex digits of checksum, then
+// ETX. Some readers add CR/LF before the ETX, which is ignored.
+#define RFID_RF125PS_STX 0x02
+#define RFID_RF125PS_ETX 0x03
+#define RFID_RF125PS_DATA_LENGTH 10
+#define RFID_RF125PS_CHECKSUM_LENGTH 2
+#define RFID_RF125PS_FRAME_LENGTH (RFID_RF125PS_DATA_LENGTH + RFID_RF125PS_CHECKSUM_LENGTH)
+
+// Decodes the hex digits of a frame. Returns true if the frame is valid.
+static bool rfid_rf125ps_decode(const char* frame, rfid_number_t* out_card) {
+    rfid_number_t data;
+    rfid_number_t checksum;
+    if (!rfid_number_from_hex(frame, RFID_RF125PS_DATA_LENGTH, &data) ||
+        !rfid_number_from_hex(frame + RFID_RF125PS_DATA_LENGTH, RFID_RF125PS_CHECKSUM_LENGTH, &checksum)) {
+        return false;
+    }
+
+    // The checksum is the XOR of the 5 data bytes
+    uint8_t expected = 0;
+    for (int i = 0; i < RFID_RF125PS_DATA_LENGTH / 2; i++) {
+        expected ^= (data >> (8 * i)) & 0xFF;
+    }
+    if (expected != checksum) {
+        return false;
+    }
+
+    // The first byte is a version / manufacturer code. Cards are identified by
+    // the remaining 32 bits, which is the number printed on most fobs.
+    *out_card = data & UINT32_MAX;
+    return true;
+}
+
+static void rfid_rf125ps_task(void* arg) {
+    uint8_t rx[32];
+    char frame[RFID_RF125PS_FRAME_LENGTH];
+    size_t length = 0;
+    bool in_frame = false;
+
+    while (1) {
+        const int n_read = uart_read_bytes(RFID_RF125PS_UART, rx, sizeof(rx), pdMS_TO_TICKS(20));
+        for (int i = 0; i < n_read; i++) {
+            const uint8_t c = rx[i];
+
+            if (RFID_RF125PS_STX == c) {
+                in_frame = true;
+                length = 0;
+                rfid_frame_started();
+            } else if (!in_frame || '\r' == c || '\n' == c) {
+                continue;
+            } else if (RFID_RF125PS_ETX == c) {
+                rfid_number_t card;
+                if (RFID_RF125PS_FRAME_LENGTH == length && rfid_rf125ps_decode(frame, &card)) {
+                    rfid_submit(card);
+                } else {
+                    ESP_LOGW(TAG, "Dropped bad frame");
+                }
+                in_frame = false;
+            } else if (length < RFID_RF125PS_FRAME_LENGTH) {
+                frame[length++] = c;
+            } else {
+                // Too long, wait for the next STX
+                in_frame = false;
+            }
+        }
+    }
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+void rfid_rf125ps_console_init(void) {
+    rfid_rf125ps_console_next = esp_log_set_putchar(rfid_rf125ps_console_putchar);
+}
+
+bool rfid_rf125ps_start(void) {
+    const uart_config_t uart_config = {
+        .baud_rate = RFID_RF125PS_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
+    if (ESP_OK != uart_param_config(RFID_RF125PS_UART, &uart_config)) {
+        return false;
+    }
+    rfid_rf125ps_console_shared = true;
+
+    if (ESP_OK != uart_driver_install(RFID_RF125PS_UART, RFID_RF125PS_RX_BUFFER_SIZE, 0, 0, NULL, 0)) {
+        return false;
+    }
+
+    TaskHandle_t task;
+    if (pdPASS != xTaskCreate(rfid_rf125ps_task, "RFID RF125PS", 2048, NULL, tskIDLE_PRIORITY + 3, &task)) {
+        return false;
+    }
+    health_watch_task(task);
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Driver for the RF125PS serial RFID reader.
+//
+// The reader sends a frame on UART0 RX each time it reads a card, and repeats
+// it continuously while the card is held at the reader.
+
+// Hooks log output, which goes to the console on UART0. Until the driver starts
+// it is passed straight on. After that UART0 runs at the reader's 9600 baud,
+// so a character takes about 1 ms to send, and output that doesn't fit in the
+// TX FIFO is dropped rather than waited for. Logging then never holds up the
+// access path.
+//
+// Call before anything else uses esp_log_set_putchar(), so this stays next to
+// the UART.
+void rfid_rf125ps_console_init(void);
+
+// Starts the RF125PS reader driver. Decoded cards are passed to rfid_submit().
+//
+// Returns true on success.
+bool rfid_rf125ps_start(void);
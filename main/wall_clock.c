@@ -0,0 +1,331 @@
+#include "wall_clock.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "core.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "health.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include "network.h"
+#include "sdkconfig.h"
+#include "warm_boot.h"
+
+#define TAG "wall_clock"
+
+#define WALL_CLOCK_NTP_PORT 123
+#define WALL_CLOCK_NTP_PACKET 48
+#define WALL_CLOCK_NTP_TIMEOUT_MS 1000
+
+// Queries per sync. The one with the shortest round trip is used, as it leaves
+// the least room for error.
+#define WALL_CLOCK_NTP_QUERIES 4
+
+#define WALL_CLOCK_SYNC_S (60 * 60)
+#define WALL_CLOCK_RETRY_S 60
+
+// Drift is only measured over long enough that the error of the syncs
+// themselves doesn't swamp it. Anything past what a working crystal could do is
+// the server's time stepping, not drift.
+#define WALL_CLOCK_DRIFT_MIN_S (10 * 60)
+#define WALL_CLOCK_DRIFT_MAX_PPB 200000
+
+// How often the time is saved to RTC memory. After a warm reset the restored
+// time is out by up to this, plus however long the reset took.
+#define WALL_CLOCK_SAVE_MS 1000
+#define WALL_CLOCK_RESET_MS 300
+
+// The mapping is rebased before the multiply in wall_clock_map() can overflow
+#define WALL_CLOCK_REBASE_US (1LL << 36)
+
+#define WALL_CLOCK_MAGIC 0x4B4C4349  // "ICLK"
+
+// Seconds from 1900, the NTP epoch, to 1970
+#define WALL_CLOCK_NTP_TO_UNIX_S 2208988800LL
+
+// =============================================================================
+// Mapping
+// =============================================================================
+
+// As kept in RTC memory
+typedef struct wall_clock_rtc {
+    uint32_t magic;
+    uint32_t crc;  // CRC of everything after this field
+    int64_t utc;   // When saved
+    int32_t drift_ppb;
+    uint32_t accuracy_us;
+} wall_clock_rtc_t;
+
+static WARM_BOOT_ATTR uint32_t wall_clock_rtc[sizeof(wall_clock_rtc_t) / sizeof(uint32_t)];
+
+#define WALL_CLOCK_RTC_CRC_OFFSET (offsetof(wall_clock_rtc_t, crc) + sizeof(uint32_t))
+
+// Guarded by critical sections, as any task can ask for the time
+static int64_t wall_clock_base_time = 0;    // esp_timer time the mapping starts from
+static int64_t wall_clock_base_utc = 0;     // UTC at wall_clock_base_time, 0 if unknown
+static int64_t wall_clock_rate = 0;         // drift_ppb as a 32.32 fraction, so mapping needs no division
+static int64_t wall_clock_synced_time = 0;  // esp_timer time of the last sync since boot, 0 if none
+static wall_clock_stats_t wall_clock_stats = {0};
+
+static esp_timer_handle_t wall_clock_save_timer = NULL;
+
+static uint32_t wall_clock_rtc_crc(const wall_clock_rtc_t* s) {
+    return crc32_update(0, (const uint8_t*)s + WALL_CLOCK_RTC_CRC_OFFSET, sizeof(*s) - WALL_CLOCK_RTC_CRC_OFFSET);
+}
+
+// Must be in a critical section
+static int64_t wall_clock_map(int64_t time) {
+    if (0 == wall_clock_base_utc) {
+        return 0;
+    }
+    const int64_t elapsed = time - wall_clock_base_time;
+    return wall_clock_base_utc + elapsed + ((elapsed * wall_clock_rate) >> 32);
+}
+
+// Must be in a critical section
+static void wall_clock_set_drift(int64_t drift_ppb) {
+    drift_ppb = drift_ppb > WALL_CLOCK_DRIFT_MAX_PPB    ? WALL_CLOCK_DRIFT_MAX_PPB
+                : drift_ppb < -WALL_CLOCK_DRIFT_MAX_PPB ? -WALL_CLOCK_DRIFT_MAX_PPB
+                                                        : drift_ppb;
+    wall_clock_stats.drift_ppb = drift_ppb;
+    wall_clock_rate = drift_ppb * (1LL << 32) / 1000000000;
+}
+
+// Keeps the time in RTC memory, for after a warm reset.
+static void wall_clock_save(void* arg) {
+    const int64_t now = esp_timer_get_time();
+    wall_clock_rtc_t saved = {.magic = WALL_CLOCK_MAGIC};
+
+    taskENTER_CRITICAL();
+    if (0 != wall_clock_base_utc && now - wall_clock_base_time > WALL_CLOCK_REBASE_US) {
+        wall_clock_base_utc = wall_clock_map(now);
+        wall_clock_base_time = now;
+    }
+    saved.utc = wall_clock_map(now);
+    saved.drift_ppb = wall_clock_stats.drift_ppb;
+    saved.accuracy_us = wall_clock_stats.accuracy_us;
+    taskEXIT_CRITICAL();
+
+    if (0 != saved.utc) {
+        saved.crc = wall_clock_rtc_crc(&saved);
+        warm_boot_rtc_write(wall_clock_rtc, &saved, sizeof(saved));
+    }
+}
+
+// Picks up the time saved before a warm reset. The esp_timer starts again from
+// zero, roughly when the reset happened.
+static void wall_clock_restore(void) {
+    wall_clock_rtc_t saved;
+    warm_boot_rtc_read(&saved, wall_clock_rtc, sizeof(saved));
+    if (WALL_CLOCK_MAGIC != saved.magic || wall_clock_rtc_crc(&saved) != saved.crc || 0 == saved.utc) {
+        return;
+    }
+
+    const uint32_t lost_us = (WALL_CLOCK_SAVE_MS / 2 + WALL_CLOCK_RESET_MS) * 1000;
+    taskENTER_CRITICAL();
+    wall_clock_base_time = 0;
+    wall_clock_base_utc = saved.utc + lost_us;
+    wall_clock_set_drift(saved.drift_ppb);
+    wall_clock_stats.accuracy_us = saved.accuracy_us + lost_us;
+    taskEXIT_CRITICAL();
+    ESP_LOGI(TAG, "Restored the time from RTC memory, to within %u ms", (saved.accuracy_us + lost_us) / 1000);
+}
+
+// Moves the mapping to a sync, learning the drift from how far off it was.
+static void wall_clock_apply(int64_t time, int64_t utc, uint32_t accuracy_us) {
+    taskENTER_CRITICAL();
+    const int64_t predicted = wall_clock_map(time);
+    const int64_t offset = 0 == predicted ? 0 : utc - predicted;
+
+    // Only the error built up since a sync made this boot says anything about
+    // the crystal. Half of it is corrected, so one noisy sync can't throw the
+    // rate far off.
+    const int64_t since = time - wall_clock_synced_time;
+    const int64_t step_limit = since / 1000000 * (WALL_CLOCK_DRIFT_MAX_PPB / 1000);
+    if (0 != wall_clock_synced_time && since >= WALL_CLOCK_DRIFT_MIN_S * 1000000LL && offset < step_limit &&
+        offset > -step_limit) {
+        wall_clock_set_drift(wall_clock_stats.drift_ppb + offset * 1000000000 / since / 2);
+    }
+
+    wall_clock_base_time = time;
+    wall_clock_base_utc = utc;
+    wall_clock_synced_time = time;
+    wall_clock_stats.syncs++;
+    wall_clock_stats.accuracy_us = accuracy_us;
+    wall_clock_stats.offset_us = offset > INT32_MAX ? INT32_MAX : offset < INT32_MIN ? INT32_MIN : offset;
+    const int32_t drift_ppb = wall_clock_stats.drift_ppb;
+    taskEXIT_CRITICAL();
+
+    ESP_LOGI(TAG, "Synced to within %u us, was %s us out, drift %d ppb", accuracy_us, I64_DEC(offset), drift_ppb);
+}
+
+// =============================================================================
+// SNTP
+// =============================================================================
+
+static uint32_t wall_clock_read_u32(const uint8_t* data) {
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+// NTP timestamps are seconds since 1900 and a 32 bit fraction. The seconds
+// roll over in 2036, so times that would be before 1970 are after that.
+static int64_t wall_clock_ntp_to_utc(const uint8_t* data) {
+    int64_t seconds = wall_clock_read_u32(data);
+    if (seconds < WALL_CLOCK_NTP_TO_UNIX_S) {
+        seconds += 1LL << 32;
+    }
+    const uint64_t fraction = wall_clock_read_u32(&data[4]);
+    return (seconds - WALL_CLOCK_NTP_TO_UNIX_S) * 1000000 + (int64_t)((fraction * 1000000) >> 32);
+}
+
+// One SNTP exchange. Gives the esp_timer time half way through it and the
+// server's UTC at that moment.
+static bool wall_clock_query(int sock, const struct sockaddr_in* server, int64_t* out_time, int64_t* out_utc,
+                             uint32_t* out_round_trip_us) {
+    uint8_t packet[WALL_CLOCK_NTP_PACKET] = {0};
+    packet[0] = 0x23;  // Version 4, client
+
+    // A random transmit time, which the reply has to echo back
+    const uint32_t cookie[2] = {esp_random(), esp_random()};
+    memcpy(&packet[40], cookie, sizeof(cookie));
+
+    const int64_t sent = esp_timer_get_time();
+    const struct sockaddr* to = (const struct sockaddr*)server;
+    if ((int)sizeof(packet) != sendto(sock, packet, sizeof(packet), 0, to, sizeof(*server))) {
+        return false;
+    }
+
+    // Skip late replies to earlier queries, until the timeout
+    uint8_t reply[WALL_CLOCK_NTP_PACKET];
+    int received;
+    while ((received = recv(sock, reply, sizeof(reply), 0)) >= 0) {
+        const int64_t answered = esp_timer_get_time();
+        if (received < WALL_CLOCK_NTP_PACKET || 0 != memcmp(&reply[24], cookie, sizeof(cookie))) {
+            continue;
+        }
+
+        // Must be from a server, and synced itself (stratum 0 is a refusal)
+        if (4 != (reply[0] & 0x07) || 0 == reply[1] || reply[1] > 15) {
+            return false;
+        }
+
+        const int64_t server_received = wall_clock_ntp_to_utc(&reply[32]);
+        const int64_t server_sent = wall_clock_ntp_to_utc(&reply[40]);
+        const int64_t round_trip = (answered - sent) - (server_sent - server_received);
+        *out_time = sent + (answered - sent) / 2;
+        *out_utc = server_received + (server_sent - server_received) / 2;
+        *out_round_trip_us = round_trip < 0 ? 0 : round_trip;
+        return true;
+    }
+    return false;
+}
+
+static bool wall_clock_sync(void) {
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo* result = NULL;
+    if (0 != getaddrinfo(CONFIG_INTERLOCK_NTP_SERVER, NULL, &hints, &result) || NULL == result) {
+        ESP_LOGW(TAG, "Unable to look up %s", CONFIG_INTERLOCK_NTP_SERVER);
+        return false;
+    }
+    struct sockaddr_in server = *(const struct sockaddr_in*)result->ai_addr;
+    server.sin_port = htons(WALL_CLOCK_NTP_PORT);
+    freeaddrinfo(result);
+
+    const int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        return false;
+    }
+    const struct timeval timeout = {
+        .tv_sec = WALL_CLOCK_NTP_TIMEOUT_MS / 1000,
+        .tv_usec = (WALL_CLOCK_NTP_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    bool ok = false;
+    int64_t time = 0;
+    int64_t utc = 0;
+    uint32_t round_trip_us = UINT32_MAX;
+    for (int i = 0; i < WALL_CLOCK_NTP_QUERIES; i++) {
+        int64_t query_time;
+        int64_t query_utc;
+        uint32_t query_round_trip_us;
+        if (wall_clock_query(sock, &server, &query_time, &query_utc, &query_round_trip_us) &&
+            query_round_trip_us < round_trip_us) {
+            ok = true;
+            time = query_time;
+            utc = query_utc;
+            round_trip_us = query_round_trip_us;
+        }
+    }
+    close(sock);
+
+    if (!ok) {
+        ESP_LOGW(TAG, "No answer from %s", CONFIG_INTERLOCK_NTP_SERVER);
+        return false;
+    }
+    wall_clock_apply(time, utc, round_trip_us / 2);
+    return true;
+}
+
+static void wall_clock_task(void* arg) {
+    while (1) {
+        network_wait_for_connection(portMAX_DELAY);
+
+        const bool synced = wall_clock_sync();
+        if (!synced) {
+            taskENTER_CRITICAL();
+            wall_clock_stats.failures++;
+            taskEXIT_CRITICAL();
+        }
+        vTaskDelay(pdMS_TO_TICKS((synced ? WALL_CLOCK_SYNC_S : WALL_CLOCK_RETRY_S) * 1000));
+    }
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+bool wall_clock_start(void) {
+    wall_clock_restore();
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = wall_clock_save,
+        .name = "Wall Clock Save",
+    };
+    if (ESP_OK != esp_timer_create(&timer_args, &wall_clock_save_timer) ||
+        ESP_OK != esp_timer_start_periodic(wall_clock_save_timer, WALL_CLOCK_SAVE_MS * 1000)) {
+        return false;
+    }
+
+    TaskHandle_t task;
+    if (pdPASS != xTaskCreate(wall_clock_task, "Wall Clock", 2560, NULL, tskIDLE_PRIORITY + 1, &task)) {
+        return false;
+    }
+    health_watch_task(task);
+    return true;
+}
+
+int64_t wall_clock_now(void) {
+    return wall_clock_at(esp_timer_get_time());
+}
+
+int64_t wall_clock_at(int64_t time) {
+    taskENTER_CRITICAL();
+    const int64_t utc = wall_clock_map(time);
+    taskEXIT_CRITICAL();
+    return utc;
+}
+
+void wall_clock_get_stats(wall_clock_stats_t* out_stats) {
+    taskENTER_CRITICAL();
+    *out_stats = wall_clock_stats;
+    taskEXIT_CRITICAL();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// =============================================================================
+// Wall Clock
+// =============================================================================
+//
+// Maps esp_timer time to UTC, so events can be given real timestamps. The
+// mapping comes from SNTP once the network is up and is resynced hourly. The
+// rate of the esp_timer's crystal against UTC is learnt between syncs and
+// corrected for, and the mapping is kept in RTC memory so a soft or watchdog
+// reset doesn't lose the time.
+
+typedef struct wall_clock_stats {
+    uint32_t syncs;
+    uint32_t failures;     // Syncs where no server answered
+    uint32_t accuracy_us;  // Bound on the error of the last sync, half its round trip
+    int32_t offset_us;     // How far the clock was off when last synced
+    int32_t drift_ppb;     // How much faster UTC runs than the esp_timer
+} wall_clock_stats_t;
+
+// Restores the mapping left in RTC memory by a warm reset, and starts the
+// sync task. Call after network_start().
+//
+// Returns true on success.
+bool wall_clock_start(void);
+
+// Gets the time in microseconds since 1970 UTC, or 0 if it isn't known yet.
+// Cheap enough for the access path.
+int64_t wall_clock_now(void);
+
+// Converts an esp_timer time, such as when a card was read, to microseconds
+// since 1970 UTC. Returns 0 if the time isn't known yet.
+int64_t wall_clock_at(int64_t time);
+
+// Gets a copy of the sync counters.
+void wall_clock_get_stats(wall_clock_stats_t* out_stats);
@@ -0,0 +1,173 @@
+#include "warm_boot.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include "core.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "file_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TAG "warm_boot"
+
+// =============================================================================
+// Snapshot
+// =============================================================================
+
+#define WARM_BOOT_MAGIC 0x57334C49  // "IL3W"
+
+// Space reserved for the serialised config. RTC user memory is only 512 bytes
+// and is shared with other modules, so configs with very long strings simply
+// won't be snapshotted.
+#define WARM_BOOT_CONFIG_SIZE 288
+
+typedef struct warm_boot_snapshot {
+    uint32_t magic;
+    uint32_t build_id;
+    uint32_t crc;  // CRC of everything after this field
+
+    // Network
+    uint8_t bssid[6];
+    uint8_t channel;  // 0 if unknown
+
+    // Config
+    uint8_t config_valid;
+    uint16_t config_size;
+    uint8_t config[WARM_BOOT_CONFIG_SIZE];
+} warm_boot_snapshot_t;
+
+// The snapshot in RTC memory, and a working copy in RAM. The struct contains
+// uint32_t members, so its size is always a whole number of words.
+static WARM_BOOT_ATTR uint32_t rtc_snapshot[sizeof(warm_boot_snapshot_t) / sizeof(uint32_t)];
+static warm_boot_snapshot_t snapshot = {0};
+
+#define WARM_BOOT_CRC_OFFSET (offsetof(warm_boot_snapshot_t, crc) + sizeof(uint32_t))
+
+static uint32_t warm_boot_crc(const warm_boot_snapshot_t* s) {
+    return crc32_update(0, (const uint8_t*)s + WARM_BOOT_CRC_OFFSET, sizeof(*s) - WARM_BOOT_CRC_OFFSET);
+}
+
+// Identifies the running build, so a snapshot from a different firmware is
+// never restored.
+static uint32_t warm_boot_build_id(void) {
+    const esp_app_desc_t* desc = esp_ota_get_app_description();
+    uint32_t id;
+    memcpy(&id, desc->app_elf_sha256, sizeof(id));
+    return id;
+}
+
+static void warm_boot_commit(void) {
+    snapshot.magic = WARM_BOOT_MAGIC;
+    snapshot.build_id = warm_boot_build_id();
+    snapshot.crc = warm_boot_crc(&snapshot);
+    warm_boot_rtc_write(rtc_snapshot, &snapshot, sizeof(snapshot));
+}
+
+// Only resets that leave RTC memory intact count as warm boots.
+static bool warm_boot_is_warm_reset(void) {
+    switch (esp_reset_reason()) {
+        case ESP_RST_SW:
+        case ESP_RST_PANIC:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// =============================================================================
+// Verification
+// =============================================================================
+
+static void warm_boot_verification_task(void* arg) {
+    const char* fs_status = "";
+    if (!fs_init(&fs_status)) {
+        // The cold boot path handles a file system that won't mount
+        ESP_LOGE(TAG, "%s, restarting", fs_status);
+        warm_boot_invalidate();
+        esp_restart();
+    } else if (!config_verify()) {
+        ESP_LOGE(TAG, "Config on flash does not match the snapshot, restarting");
+        warm_boot_invalidate();
+        esp_restart();
+    } else {
+        ESP_LOGI(TAG, "Snapshot matches the config on flash");
+    }
+
+    vTaskDelete(NULL);
+}
+
+// =============================================================================
+// Public Interface
+// =============================================================================
+
+void warm_boot_rtc_read(void* dst, const volatile uint32_t* src, size_t size) {
+    uint32_t* words = dst;
+    for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+        words[i] = src[i];
+    }
+}
+
+void warm_boot_rtc_write(volatile uint32_t* dst, const void* src, size_t size) {
+    const uint32_t* words = src;
+    for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+        dst[i] = words[i];
+    }
+}
+
+bool warm_boot_restore(void) {
+    warm_boot_rtc_read(&snapshot, rtc_snapshot, sizeof(snapshot));
+
+    const bool valid = warm_boot_is_warm_reset() && WARM_BOOT_MAGIC == snapshot.magic &&
+                       warm_boot_build_id() == snapshot.build_id && warm_boot_crc(&snapshot) == snapshot.crc;
+    if (!valid) {
+        memset(&snapshot, 0, sizeof(snapshot));
+        return false;
+    }
+
+    if (!snapshot.config_valid || !config_snapshot_restore(snapshot.config, snapshot.config_size)) {
+        return false;
+    }
+
+    return true;
+}
+
+void warm_boot_start_verification(void) {
+    xTaskCreate(warm_boot_verification_task, "Warm Boot Verify", 3072, NULL, tskIDLE_PRIORITY + 1, NULL);
+}
+
+void warm_boot_save_config(void) {
+    const size_t size = config_snapshot_save(snapshot.config, sizeof(snapshot.config));
+    if (0 == size) {
+        ESP_LOGW(TAG, "Config is too large to snapshot, warm boots will be slower");
+    }
+    snapshot.config_size = size;
+    snapshot.config_valid = 0 != size;
+    warm_boot_commit();
+}
+
+void warm_boot_save_network_state(const uint8_t bssid[6], uint8_t channel) {
+    memcpy(snapshot.bssid, bssid, sizeof(snapshot.bssid));
+    snapshot.channel = channel;
+    warm_boot_commit();
+}
+
+bool warm_boot_get_network_state(uint8_t out_bssid[6], uint8_t* out_channel) {
+    if (0 == snapshot.channel) {
+        return false;
+    }
+    memcpy(out_bssid, snapshot.bssid, sizeof(snapshot.bssid));
+    *out_channel = snapshot.channel;
+    return true;
+}
+
+void warm_boot_invalidate(void) {
+    memset(&snapshot, 0, sizeof(snapshot));
+    warm_boot_rtc_write(rtc_snapshot, &snapshot, sizeof(snapshot));
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_attr.h"
+
+// Places a variable in RTC memory that survives soft resets and watchdog
+// resets, but not power loss. It is never initialised, so its contents must be
+// validated (e.g. with a magic number and CRC) before use.
+#ifdef RTC_NOINIT_ATTR
+#define WARM_BOOT_ATTR RTC_NOINIT_ATTR
+#else
+#define WARM_BOOT_ATTR __attribute__((section(".rtc.bss")))
+#endif
+
+// Copy `size` bytes between RAM and RTC memory. RTC memory only supports 32 bit
+// accesses, so `size` must be a multiple of 4 and RTC variables must be
+// declared as uint32_t arrays.
+void warm_boot_rtc_read(void* dst, const volatile uint32_t* src, size_t size);
+void warm_boot_rtc_write(volatile uint32_t* dst, const void* src, size_t size);
+
+// Attempts to restore the config from the snapshot in RTC memory.
+//
+// This only succeeds after a soft or watchdog reset, with a snapshot made by
+// the same build. If it fails the caller must do a cold boot (fs_init() and
+// config_init()) and then call warm_boot_save_config().
+//
+// Returns true if the config was restored.
+bool warm_boot_restore(void);
+
+// Re-validates a restored config against the file system in a background task.
+// Also initialises the file system. If the config on flash differs from the
+// snapshot the snapshot is discarded and the device restarts.
+void warm_boot_start_verification(void);
+
+// Saves the config in use to the snapshot.
+void warm_boot_save_config(void);
+
+// Records the AP the device is connected to, so a warm boot can skip the scan.
+void warm_boot_save_network_state(const uint8_t bssid[6], uint8_t channel);
+
+// Gets the AP recorded by warm_boot_save_network_state(). Returns false if
+// there is none.
+bool warm_boot_get_network_state(uint8_t out_bssid[6], uint8_t* out_channel);
+
+// Discards the snapshot so the next boot is a cold boot.
+void warm_boot_invalidate(void);
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Receives and prints the log lines doors send with INTERLOCK_LOG_SINK.
+
+Each UDP packet carries a batch of lines:
+
+  "IL", version 1, then unsigned LEB128 varints of the packet's sequence
+  number, the door's uptime (ms), its UTC time (ms since 1970, 0 if it has no
+  time yet), lines dropped since boot at each level (error, warning, info,
+  debug) and the line count. Each line is then its level letter, varints of
+  its uptime (ms) and length, and its text.
+
+Lines are printed with their UTC time where the door knows it, or its uptime
+otherwise. Packets missing from the sequence, and lines the door had to drop
+because it couldn't send them fast enough, are reported as they are noticed.
+
+  tools/log_receiver.py --port 5514
+
+Only the standard library is used.
+"""
+
+import argparse
+import socket
+import sys
+import time
+
+MAGIC = b"IL"
+VERSION = 1
+LEVELS = "EWID"
+
+
+class LogError(Exception):
+    pass
+
+
+def decode_packet(data):
+    """Decodes a packet into its header fields and a list of (level, uptime_ms, text)."""
+    if len(data) < 3 or data[:2] != MAGIC:
+        raise LogError("not a log packet")
+    if data[2] != VERSION:
+        raise LogError(f"unknown version {data[2]}")
+    pos = 3
+
+    def varint():
+        nonlocal pos
+        value = shift = 0
+        while True:
+            if pos >= len(data):
+                raise LogError("truncated varint")
+            byte = data[pos]
+            pos += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value
+
+    header = {
+        "sequence": varint(),
+        "uptime_ms": varint(),
+        "utc_ms": varint(),
+        "dropped": {level: varint() for level in LEVELS},
+    }
+    lines = []
+    for _ in range(varint()):
+        if pos >= len(data):
+            raise LogError("truncated line")
+        level = chr(data[pos])
+        pos += 1
+        uptime_ms = varint()
+        length = varint()
+        if pos + length > len(data):
+            raise LogError("truncated line")
+        lines.append((level, uptime_ms, data[pos : pos + length].decode("utf-8", "replace")))
+        pos += length
+    if pos != len(data):
+        raise LogError("data after the last line")
+    return header, lines
+
+
+def format_time(header, uptime_ms):
+    if not header["utc_ms"]:
+        return f"+{uptime_ms / 1000:.3f}"
+    utc_ms = header["utc_ms"] - (header["uptime_ms"] - uptime_ms)
+    return time.strftime("%Y-%m-%d %H:%M:%S", time.gmtime(utc_ms / 1000)) + f".{utc_ms % 1000:03d}"
+
+
+class Door:
+    def __init__(self):
+        self.sequence = None
+        self.dropped = {level: 0 for level in LEVELS}
+
+    def notice(self, name, header):
+        """Reports packets and lines lost since the last packet from the door."""
+        if self.sequence is not None and header["sequence"] > self.sequence + 1:
+            print(f"{name} -- {header['sequence'] - self.sequence - 1} packets lost", flush=True)
+        elif self.sequence is not None and header["sequence"] <= self.sequence:
+            print(f"{name} -- restarted", flush=True)
+            self.dropped = {level: 0 for level in LEVELS}
+        self.sequence = header["sequence"]
+
+        new = {level: header["dropped"][level] - self.dropped[level] for level in LEVELS}
+        if any(count > 0 for count in new.values()):
+            counts = ", ".join(f"{count} {level}" for level, count in new.items() if count > 0)
+            print(f"{name} -- dropped {counts} lines", flush=True)
+        self.dropped = header["dropped"]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0", help="address to listen on")
+    parser.add_argument("--port", type=int, default=5514, help="UDP port to listen on")
+    parser.add_argument("--level", default="D", choices=LEVELS, help="least severe level to print")
+    args = parser.parse_args()
+    shown = LEVELS[: LEVELS.index(args.level) + 1]
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.host, args.port))
+    print(f"Listening on udp://{args.host}:{args.port}", flush=True)
+
+    doors = {}
+    try:
+        while True:
+            data, peer = sock.recvfrom(2048)
+            name = peer[0]
+            try:
+                header, lines = decode_packet(data)
+            except LogError as error:
+                print(f"{name} -- bad packet: {error}", file=sys.stderr, flush=True)
+                continue
+
+            doors.setdefault(name, Door()).notice(name, header)
+            for level, uptime_ms, text in lines:
+                if level in shown:
+                    print(f"{name} {format_time(header, uptime_ms)} {text}", flush=True)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,286 @@
+#!/usr/bin/env python3
+"""Delta patches for over the air updates.
+
+A patch rebuilds a new firmware image from the one a device is running, so
+only the parts that changed cross the WiFi. The device applies it as it
+downloads, reading the old image from flash (see ota.c for the format).
+
+  tools/ota_delta.py make old.bin new.bin patch.bin
+  tools/ota_delta.py apply old.bin patch.bin out.bin
+  tools/ota_delta.py bench old.bin new.bin
+
+Patches are made against a build ID, which is read from the old image, so a
+device only accepts a patch for the build it is running.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import time
+
+MAGIC = b"ILD1"
+
+OP_COPY = 0
+OP_INSERT = 1
+OP_REPLACE = 2
+
+APP_DESC_MAGIC = struct.pack("<I", 0xABCD5432)
+APP_DESC_ELF_SHA256_OFFSET = 144
+
+# Shortest match looked up anywhere in the old image
+MIN_MATCH = 16
+# Shortest match that resumes the old image where the last one left off, e.g.
+# after a changed address
+MIN_RESUME = 4
+# Bytes hashed to find matches
+KEY_SIZE = 8
+
+
+class PatchError(Exception):
+    pass
+
+
+def build_id(image):
+    """The first 8 bytes of the ELF SHA-256 from the image's app description.
+    Images without one (e.g. test data) get the start of their SHA-256."""
+    offset = image.find(APP_DESC_MAGIC, 0, 1024)
+    if offset < 0:
+        return hashlib.sha256(image).digest()[:8]
+    start = offset + APP_DESC_ELF_SHA256_OFFSET
+    return image[start : start + 8]
+
+
+# =============================================================================
+# Varints
+# =============================================================================
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return value * 2 if value >= 0 else -value * 2 - 1
+
+
+def read_varint(data, pos):
+    value = shift = 0
+    while True:
+        if pos >= len(data):
+            raise PatchError("truncated varint")
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+# =============================================================================
+# Making patches
+# =============================================================================
+
+
+def common_length(old, old_pos, new, new_pos):
+    """Length of the run of equal bytes at old[old_pos:] and new[new_pos:]."""
+    limit = min(len(old) - old_pos, len(new) - new_pos)
+    length = 0
+    step = 64
+    while length < limit:
+        step = min(step, limit - length)
+        if old[old_pos + length : old_pos + length + step] == new[new_pos + length : new_pos + length + step]:
+            length += step
+            step *= 2
+        elif step > 1:
+            step //= 2
+        else:
+            break
+    return length
+
+
+class Stats:
+    def __init__(self):
+        self.ops = {OP_COPY: 0, OP_INSERT: 0, OP_REPLACE: 0}
+        self.copied = 0
+        self.literal = 0
+
+
+def make_patch(old, new, stats=None):
+    stats = stats or Stats()
+    index = {}
+    for i in range(len(old) - KEY_SIZE + 1):
+        index.setdefault(old[i : i + KEY_SIZE], i)
+
+    out = bytearray(MAGIC + build_id(old) + varint(len(new)))
+
+    def op(kind, length):
+        out.extend(varint(length << 2 | kind))
+        stats.ops[kind] += 1
+
+    cursor = 0  # Old image position after the last op
+    literal_start = 0
+    new_pos = 0
+
+    def flush_literal(kind):
+        nonlocal cursor
+        length = new_pos - literal_start
+        if length:
+            op(kind, length)
+            out.extend(new[literal_start:new_pos])
+            stats.literal += length
+            if kind == OP_REPLACE:
+                cursor += length
+
+    while new_pos < len(new):
+        # Carry on through the old image as though the bytes since the last
+        # match replaced as many old ones
+        aligned = cursor + (new_pos - literal_start)
+        length = common_length(old, aligned, new, new_pos) if aligned < len(old) else 0
+        source = aligned
+        kind = OP_REPLACE
+        if length < MIN_RESUME and length < len(new) - new_pos:
+            length = 0
+            found = index.get(new[new_pos : new_pos + KEY_SIZE])
+            if found is not None:
+                length = common_length(old, found, new, new_pos)
+                source = found
+                kind = OP_INSERT
+            if length < MIN_MATCH:
+                new_pos += 1
+                continue
+
+        flush_literal(kind)
+        op(OP_COPY, length)
+        out.extend(varint(zigzag(source - cursor)))
+        stats.copied += length
+        cursor = source + length
+        new_pos += length
+        literal_start = new_pos
+
+    flush_literal(OP_INSERT)
+    return bytes(out)
+
+
+# =============================================================================
+# Applying patches
+# =============================================================================
+
+
+def apply_patch(old, patch):
+    """Reference implementation of what the device does."""
+    if patch[:4] != MAGIC:
+        raise PatchError("not a patch")
+    if patch[4:12] != build_id(old):
+        raise PatchError("patch is for a different build")
+    size, pos = read_varint(patch, 12)
+
+    out = bytearray()
+    cursor = 0
+    while len(out) < size:
+        value, pos = read_varint(patch, pos)
+        kind, length = value & 3, value >> 2
+        if length == 0 or length > size - len(out):
+            raise PatchError("bad op length")
+        if kind == OP_COPY:
+            delta, pos = read_varint(patch, pos)
+            cursor += (delta >> 1) ^ -(delta & 1)
+            if cursor < 0 or cursor + length > len(old):
+                raise PatchError("copy outside the old image")
+            out += old[cursor : cursor + length]
+            cursor += length
+        elif kind in (OP_INSERT, OP_REPLACE):
+            if pos + length > len(patch):
+                raise PatchError("truncated data")
+            out += patch[pos : pos + length]
+            pos += length
+            if kind == OP_REPLACE:
+                cursor += length
+        else:
+            raise PatchError("bad op")
+    if pos != len(patch):
+        raise PatchError("data after the end of the patch")
+    return bytes(out)
+
+
+# =============================================================================
+# Commands
+# =============================================================================
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def command_make(args):
+    patch = make_patch(read(args.old), read(args.new))
+    with open(args.patch, "wb") as f:
+        f.write(patch)
+
+
+def command_apply(args):
+    with open(args.out, "wb") as f:
+        f.write(apply_patch(read(args.old), read(args.patch)))
+
+
+def command_bench(args):
+    old, new = read(args.old), read(args.new)
+    stats = Stats()
+    start = time.perf_counter()
+    patch = make_patch(old, new, stats)
+    make_time = time.perf_counter() - start
+
+    start = time.perf_counter()
+    rebuilt = apply_patch(old, patch)
+    apply_time = time.perf_counter() - start
+    if rebuilt != new:
+        sys.exit("patch does not rebuild the new image")
+
+    print(f"old {len(old)} bytes, new {len(new)} bytes")
+    print(f"patch {len(patch)} bytes, {len(patch) / len(new) * 100:.1f}% of the new image")
+    print(
+        f"ops: {stats.ops[OP_COPY]} copy ({stats.copied} bytes), {stats.ops[OP_INSERT]} insert, "
+        f"{stats.ops[OP_REPLACE]} replace ({stats.literal} literal bytes)"
+    )
+    print(f"made in {make_time * 1000:.0f} ms, applied in {apply_time * 1000:.1f} ms on this host")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    make = commands.add_parser("make", help="make a patch from old to new")
+    make.add_argument("old")
+    make.add_argument("new")
+    make.add_argument("patch")
+    make.set_defaults(run=command_make)
+
+    apply = commands.add_parser("apply", help="apply a patch, as the device would")
+    apply.add_argument("old")
+    apply.add_argument("patch")
+    apply.add_argument("out")
+    apply.set_defaults(run=command_apply)
+
+    bench = commands.add_parser("bench", help="report patch size and timings")
+    bench.add_argument("old")
+    bench.add_argument("new")
+    bench.set_defaults(run=command_bench)
+
+    args = parser.parse_args()
+    try:
+        args.run(args)
+    except PatchError as error:
+        sys.exit(str(error))
+
+
+if __name__ == "__main__":
+    main()
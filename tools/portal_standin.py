@@ -0,0 +1,565 @@
+#!/usr/bin/env python3
+"""Stand-in for the portal's door WebSocket endpoint.
+
+Speaks the same protocol as the firmware's portal client so a door can be
+exercised without the real portal, and measures the session while it runs:
+
+  * round trip latency, using application level pings the door must answer
+  * message throughput, with --bench flooding pings for a fixed time
+  * remote unlock latency, with --unlock sending signed unlock commands. The
+    door acknowledges each once its relay is on, so the round trip to the
+    acknowledgement bounds push-to-actuation. Combine with --bench to measure
+    it under load.
+  * the door's card cache, from its heartbeats. --invalidate-interval pushes
+    invalidations, so repeat cards go back to the portal.
+
+The binary encoding from portal_wire.py is used when the door offers it,
+unless --json-only is given.
+
+With --firmware the image is served over HTTP on --http-port and every door
+running a different build is told to update to it. Doors running the build of
+a --base image get a delta patch (see ota_delta.py) instead of the full image.
+The time from the update command to the door coming back on the new build is
+logged.
+
+Only the standard library is used. The firmware always uses TLS, so for a real
+door pass a certificate and key, e.g.
+
+  openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj /CN=standin \\
+      -keyout standin.key -out standin.pem
+  tools/portal_standin.py --cert standin.pem --key standin.key --grant 714456
+
+and point PORTAL_ADDRESS/PORTAL_PORT at this machine.
+"""
+
+import argparse
+import asyncio
+import base64
+import hashlib
+import hmac
+import json
+import random
+import ssl
+import statistics
+import struct
+import time
+
+import ota_delta
+import portal_wire
+
+WS_PATH = "/ws/access"
+WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+OP_CONTINUATION = 0x0
+OP_TEXT = 0x1
+OP_BINARY = 0x2
+OP_CLOSE = 0x8
+OP_PING = 0x9
+OP_PONG = 0xA
+
+# Device name -> (build being updated to, time the update was sent)
+pending_updates = {}
+
+
+class ProtocolError(Exception):
+    pass
+
+
+# =============================================================================
+# WebSocket
+# =============================================================================
+
+
+async def ws_accept(reader, writer, json_only):
+    """Reads the upgrade request and answers it. Returns true if the binary
+    encoding was chosen."""
+    request = await reader.readuntil(b"\r\n\r\n")
+    lines = request.decode("latin-1").split("\r\n")
+    method, path, _ = lines[0].split(" ", 2)
+    headers = {}
+    for line in lines[1:]:
+        if ":" in line:
+            name, value = line.split(":", 1)
+            headers[name.strip().lower()] = value.strip()
+
+    key = headers.get("sec-websocket-key")
+    if method != "GET" or path != WS_PATH or key is None:
+        writer.write(b"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n")
+        await writer.drain()
+        raise ProtocolError(f"bad upgrade request for {path}")
+
+    offered = [name.strip() for name in headers.get("sec-websocket-protocol", "").split(",")]
+    binary = portal_wire.PROTOCOL_BINARY in offered and not json_only
+    protocol = portal_wire.PROTOCOL_BINARY if binary else portal_wire.PROTOCOL_JSON
+    protocol_header = f"Sec-WebSocket-Protocol: {protocol}\r\n" if protocol in offered else ""
+
+    accept = base64.b64encode(hashlib.sha1((key + WS_GUID).encode()).digest()).decode()
+    writer.write(
+        (
+            "HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            f"Sec-WebSocket-Accept: {accept}\r\n"
+            f"{protocol_header}"
+            "\r\n"
+        ).encode()
+    )
+    await writer.drain()
+    return binary
+
+
+def ws_frame(opcode, payload):
+    """Builds an unmasked server frame."""
+    header = bytes([0x80 | opcode])
+    if len(payload) < 126:
+        header += bytes([len(payload)])
+    elif len(payload) < 0x10000:
+        header += bytes([126]) + struct.pack(">H", len(payload))
+    else:
+        header += bytes([127]) + struct.pack(">Q", len(payload))
+    return header + payload
+
+
+async def ws_read_frame(reader):
+    """Reads one client frame. Returns (fin, opcode, payload)."""
+    first, second = await reader.readexactly(2)
+    if not second & 0x80:
+        raise ProtocolError("unmasked client frame")
+
+    length = second & 0x7F
+    if length == 126:
+        (length,) = struct.unpack(">H", await reader.readexactly(2))
+    elif length == 127:
+        (length,) = struct.unpack(">Q", await reader.readexactly(8))
+
+    mask = await reader.readexactly(4)
+    payload = bytearray(await reader.readexactly(length))
+    for i in range(length):
+        payload[i] ^= mask[i & 3]
+    return bool(first & 0x80), first & 0x0F, bytes(payload)
+
+
+# =============================================================================
+# Firmware
+# =============================================================================
+
+
+def read_file(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+class Firmware:
+    def __init__(self, path, base_paths):
+        self.image = read_file(path)
+        self.sha256 = hashlib.sha256(self.image).hexdigest()
+        self.build = ota_delta.build_id(self.image).hex()
+
+        # Build -> patch from it to this image
+        self.patches = {}
+        for base_path in base_paths:
+            base = read_file(base_path)
+            patch = ota_delta.make_patch(base, self.image)
+            self.patches[ota_delta.build_id(base).hex()] = patch
+            print(f"Patch from {base_path}: {len(patch)} bytes", flush=True)
+
+    def files(self):
+        """URL path -> content"""
+        files = {"/firmware.bin": self.image}
+        for build, patch in self.patches.items():
+            files[f"/patch/{build}.bin"] = patch
+        return files
+
+
+async def serve_firmware(firmware, reader, writer):
+    """Answers GETs for the image and patches."""
+    try:
+        request = await reader.readuntil(b"\r\n\r\n")
+        method, path = request.decode("latin-1").split(" ", 2)[:2]
+        content = firmware.files().get(path)
+        if content is None:
+            writer.write(b"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n")
+            return
+        writer.write(
+            (
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: application/octet-stream\r\n"
+                f"Content-Length: {len(content)}\r\n"
+                "Connection: close\r\n"
+                "\r\n"
+            ).encode()
+        )
+        if method == "GET":
+            start = time.perf_counter()
+            writer.write(content)
+            await writer.drain()
+            peer = writer.get_extra_info("peername")
+            print(
+                f"[{time.strftime('%H:%M:%S')}] served {path}, {len(content)} bytes, to {peer[0]} "
+                f"in {time.perf_counter() - start:.1f} s",
+                flush=True,
+            )
+    except (asyncio.IncompleteReadError, ConnectionError):
+        pass
+    finally:
+        writer.close()
+
+
+# =============================================================================
+# Session
+# =============================================================================
+
+
+class Session:
+    def __init__(self, args, reader, writer):
+        self.args = args
+        self.reader = reader
+        self.writer = writer
+        self.name = "?"
+        self.authenticated = False
+        self.binary = False
+        self.next_ping_id = 0
+        self.pings = {}  # id -> send time
+        self.rtts = []
+        self.received = 0
+        self.sent = 0
+        self.pong_event = asyncio.Event()
+        self.nonce = ""
+        self.unlock_counter = 0
+        self.unlocks = {}  # id -> send time
+        self.unlock_results = []  # (round trip, door's command to relay latency)
+
+    def log(self, message):
+        print(f"[{time.strftime('%H:%M:%S')}] {self.name}: {message}", flush=True)
+
+    async def send(self, message):
+        data = portal_wire.encode_binary(message) if self.binary else None
+        if data is None:
+            self.writer.write(ws_frame(OP_TEXT, portal_wire.encode_json(message)))
+        else:
+            self.writer.write(ws_frame(OP_BINARY, data))
+        self.sent += 1
+        await self.writer.drain()
+
+    async def ping(self):
+        ping_id = self.next_ping_id
+        self.next_ping_id += 1
+        self.pings[ping_id] = time.perf_counter()
+        await self.send({"command": "ping", "id": ping_id})
+
+    # Messages from the door
+
+    async def on_authenticate(self, message):
+        if message.get("api_key") != self.args.api_key:
+            self.log("wrong API key")
+            self.writer.write(ws_frame(OP_CLOSE, struct.pack(">H", 1008)))
+            raise ProtocolError("authentication failed")
+        self.name = message.get("device", "?")
+        self.nonce = message.get("nonce", "")
+        self.authenticated = True
+        build = message.get("build", "?")
+        self.log(f"authenticated as a {message.get('type')} on build {build}")
+        await self.send({"command": "authenticated"})
+
+        pending = pending_updates.pop(self.name, None)
+        if pending and pending[0] == build:
+            self.log(f"back on the new build {time.perf_counter() - pending[1]:.1f} s after the update was sent")
+
+        firmware = self.args.firmware
+        if firmware and build != firmware.build:
+            host = self.writer.get_extra_info("sockname")[0]
+            patch = firmware.patches.get(build)
+            path = f"/patch/{build}.bin" if patch else "/firmware.bin"
+            url = f"http://{host}:{self.args.http_port}{path}"
+            pending_updates[self.name] = (firmware.build, time.perf_counter())
+            self.log(f"updating to build {firmware.build} from {url}")
+            await self.send(
+                {
+                    "command": "update",
+                    "url": url,
+                    "size": len(patch or firmware.image),
+                    "sha256": firmware.sha256,
+                    "delta": patch is not None,
+                }
+            )
+
+    async def on_update_status(self, message):
+        reason = f" ({message['reason']})" if message.get("reason") else ""
+        self.log(f"update {message.get('status')}{reason} after {message.get('ms')} ms")
+
+    async def on_check(self, message):
+        card = message.get("card")
+        granted = card in self.args.grant
+        self.log(f"check card {card}: {'granted' if granted else 'denied'}")
+        await self.send({"command": "check_result", "id": message.get("id"), "granted": granted})
+
+    async def on_request_sync(self, message):
+        start = time.perf_counter()
+        message = {"command": "sync", "cards": self.args.card_list}
+        size = len(portal_wire.encode_binary(message) if self.binary else portal_wire.encode_json(message))
+        await self.send(message)
+        elapsed = time.perf_counter() - start
+        self.log(f"sent {len(self.args.card_list)} cards, {size} bytes in {elapsed * 1000:.1f} ms")
+
+    async def on_log_access(self, message):
+        at = message.get("time")
+        when = f" at {time.strftime('%H:%M:%S', time.gmtime(at / 1000))}.{at % 1000:03d} UTC" if at else ""
+        self.log(f"card {message.get('card')} {'granted' if message.get('granted') else 'denied'}{when}")
+
+    async def on_heartbeat(self, message):
+        access = message.get("access", {})
+        decisions = access.get("decisions", 0)
+        average = access.get("latency_total_us", 0) / decisions / 1000 if decisions else 0
+        wifi = message.get("wifi", {})
+        cache = message.get("cache", {})
+        clock = message.get("clock", {})
+        lookups = cache.get("hits", 0) + cache.get("misses", 0)
+        hit_rate = cache.get("hits", 0) / lookups * 100 if lookups else 0
+        stacks = message.get("stacks", {})
+        tightest = min(stacks.items(), key=lambda item: item[1]) if stacks else ("?", 0)
+        self.log(
+            f"heartbeat: up {message.get('uptime')} s, RTT {message.get('rtt_us', 0) / 1000:.1f} ms, "
+            f"RSSI {message.get('rssi')} ({wifi.get('roams', 0)} roams, ~{wifi.get('current_ua', 0) / 1000:.0f} mA), "
+            f"heap {message.get('heap')} (lowest {message.get('heap_min')}), "
+            f"{decisions} cards ({average:.0f} ms average), cache hit {hit_rate:.0f}% saving "
+            f"{cache.get('saved_ms', 0)} ms, clock within {clock.get('accuracy_us', 0) / 1000:.1f} ms "
+            f"(drift {clock.get('drift_ppb', 0) / 1000:.1f} ppm), least stack {tightest[0]} {tightest[1]} bytes"
+        )
+
+    async def on_unlock_result(self, message):
+        sent = self.unlocks.pop(message.get("id"), None)
+        if not message.get("ok"):
+            self.log(f"unlock {message.get('id')} refused: {message.get('reason')}")
+        elif sent is not None:
+            rtt = time.perf_counter() - sent
+            latency = message.get("latency_us", 0) / 1000
+            self.unlock_results.append((rtt, latency))
+            self.log(f"unlock {message.get('id')} acknowledged in {rtt * 1000:.1f} ms, relay on {latency:.1f} ms "
+                     "after the command reached the door")
+
+    async def on_pong(self, message):
+        sent = self.pings.pop(message.get("id"), None)
+        if sent is not None:
+            self.rtts.append(time.perf_counter() - sent)
+            self.pong_event.set()
+
+    async def on_message(self, opcode, payload):
+        if opcode == OP_BINARY:
+            decoded = portal_wire.decode_binary(payload)
+            for message in decoded if isinstance(decoded, list) else [decoded]:
+                await self.on_command(message)
+        else:
+            await self.on_command(json.loads(payload.decode()))
+
+    async def on_command(self, message):
+        self.received += 1
+        command = message.get("command")
+        if not self.authenticated and command != "authenticate":
+            raise ProtocolError(f"{command} before authentication")
+
+        handler = getattr(self, f"on_{command}", None)
+        if handler is None:
+            self.log(f"unknown command {command}")
+        else:
+            await handler(message)
+
+    # Loops
+
+    async def receive_loop(self):
+        fragments = []
+        message_opcode = None
+        while True:
+            fin, opcode, payload = await ws_read_frame(self.reader)
+            if opcode == OP_PING:
+                self.writer.write(ws_frame(OP_PONG, payload))
+            elif opcode == OP_PONG:
+                pass
+            elif opcode == OP_CLOSE:
+                self.writer.write(ws_frame(OP_CLOSE, payload[:2]))
+                return
+            else:
+                if opcode != OP_CONTINUATION:
+                    message_opcode = opcode
+                fragments.append(payload)
+                if fin:
+                    await self.on_message(message_opcode, b"".join(fragments))
+                    fragments = []
+
+    async def probe_loop(self):
+        """Measures latency every --ping-interval seconds."""
+        while True:
+            await asyncio.sleep(self.args.ping_interval)
+            if self.authenticated:
+                await self.ping()
+                if len(self.rtts) % 10 == 0 and self.rtts:
+                    self.report()
+
+    async def bench(self):
+        """Keeps --window pings in flight for --bench seconds."""
+        while not self.authenticated:
+            await asyncio.sleep(0.05)
+
+        self.log(f"benchmarking for {self.args.bench} s with {self.args.window} messages in flight")
+        self.rtts.clear()
+        start = time.perf_counter()
+        end = start + self.args.bench
+        while time.perf_counter() < end:
+            while len(self.pings) < self.args.window:
+                await self.ping()
+            self.pong_event.clear()
+            try:
+                await asyncio.wait_for(self.pong_event.wait(), timeout=5)
+            except asyncio.TimeoutError:
+                self.log("door stopped answering")
+                break
+        elapsed = time.perf_counter() - start
+
+        self.log(f"{len(self.rtts)} round trips in {elapsed:.1f} s, {len(self.rtts) / elapsed:.1f} messages/s each way")
+        self.report()
+
+    async def unlock(self, unlock_id):
+        """Sends a signed unlock, see portal_unlock() in the firmware."""
+        self.unlock_counter += 1
+        duration_ms = self.args.unlock_ms
+        text = f"{self.nonce}:unlock:{unlock_id}:{self.unlock_counter}:{duration_ms}"
+        mac = hmac.new(self.args.api_key.encode(), text.encode(), hashlib.sha256).hexdigest()
+        self.unlocks[unlock_id] = time.perf_counter()
+        await self.send(
+            {
+                "command": "unlock",
+                "id": unlock_id,
+                "counter": self.unlock_counter,
+                "duration_ms": duration_ms,
+                "mac": mac,
+            }
+        )
+
+    async def unlock_loop(self):
+        """Sends --unlock unlocks, --unlock-interval seconds apart."""
+        while not self.authenticated:
+            await asyncio.sleep(0.05)
+        for unlock_id in range(1, self.args.unlock + 1):
+            await asyncio.sleep(self.args.unlock_interval)
+            await self.unlock(unlock_id)
+        await asyncio.sleep(2)
+        self.report_unlocks()
+
+    async def invalidate_loop(self):
+        """Tells the door to forget every cached answer, as the portal does
+        when access changes, every --invalidate-interval seconds."""
+        while True:
+            await asyncio.sleep(self.args.invalidate_interval)
+            if self.authenticated:
+                self.log("invalidating cached answers")
+                await self.send({"command": "invalidate"})
+
+    def report_unlocks(self):
+        if not self.unlock_results:
+            return
+        rtts = sorted(rtt * 1000 for rtt, _ in self.unlock_results)
+        latencies = sorted(latency for _, latency in self.unlock_results)
+        p95 = rtts[min(len(rtts) - 1, int(len(rtts) * 0.95))]
+        self.log(
+            f"unlocks acknowledged {len(rtts)}/{self.args.unlock}: round trip median {statistics.median(rtts):.1f} ms, "
+            f"p95 {p95:.1f} ms, max {rtts[-1]:.1f} ms; on the door median {statistics.median(latencies):.1f} ms, "
+            f"max {latencies[-1]:.1f} ms"
+        )
+
+    def report(self):
+        if not self.rtts:
+            return
+        ms = sorted(rtt * 1000 for rtt in self.rtts)
+        p95 = ms[min(len(ms) - 1, int(len(ms) * 0.95))]
+        self.log(
+            f"RTT over {len(ms)}: min {ms[0]:.1f} ms, median {statistics.median(ms):.1f} ms, "
+            f"p95 {p95:.1f} ms, max {ms[-1]:.1f} ms"
+        )
+
+
+async def handle(args, reader, writer):
+    peer = writer.get_extra_info("peername")
+    session = Session(args, reader, writer)
+    session.name = f"{peer[0]}:{peer[1]}"
+    try:
+        session.binary = await ws_accept(reader, writer, args.json_only)
+        protocol = portal_wire.PROTOCOL_BINARY if session.binary else portal_wire.PROTOCOL_JSON
+        session.log(f"connected using {protocol}")
+        # The session lasts as long as the door keeps it open
+        measures = []
+        if args.bench:
+            measures.append(session.bench())
+        elif args.ping_interval > 0:
+            measures.append(session.probe_loop())
+        if args.unlock:
+            measures.append(session.unlock_loop())
+        if args.invalidate_interval > 0:
+            measures.append(session.invalidate_loop())
+        measures = [asyncio.ensure_future(measure) for measure in measures]
+        try:
+            await session.receive_loop()
+        finally:
+            for measure in measures:
+                measure.cancel()
+    except (asyncio.IncompleteReadError, ConnectionError):
+        pass
+    except (ProtocolError, portal_wire.WireError) as error:
+        session.log(f"protocol error: {error}")
+    finally:
+        session.log(f"closed, {session.received} messages in, {session.sent} out")
+        session.report()
+        writer.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--cert", help="PEM certificate, enables TLS")
+    parser.add_argument("--key", help="PEM private key for --cert")
+    parser.add_argument("--api-key", default="123456789abcdefg", help="PORTAL_API_KEY the doors must present")
+    parser.add_argument("--grant", type=int, action="append", default=[], help="card number to grant, repeatable")
+    parser.add_argument("--cards", type=int, default=0, help="random cards to add to the synced card list")
+    parser.add_argument("--ping-interval", type=float, default=5, help="seconds between latency probes, 0 to disable")
+    parser.add_argument("--bench", type=float, default=0, help="seconds to flood each door with pings for")
+    parser.add_argument("--json-only", action="store_true", help="refuse the binary encoding")
+    parser.add_argument("--firmware", help="application image (.bin) to update doors to")
+    parser.add_argument("--base", action="append", default=[], help="image doors may be running, repeatable")
+    parser.add_argument("--http-port", type=int, default=8080, help="port to serve --firmware on")
+    parser.add_argument("--window", type=int, default=4, help="pings kept in flight during --bench")
+    parser.add_argument("--unlock", type=int, default=0, help="remote unlocks to send each door")
+    parser.add_argument("--unlock-interval", type=float, default=1, help="seconds between --unlock commands")
+    parser.add_argument("--unlock-ms", type=int, default=3000, help="how long each remote unlock lasts")
+    parser.add_argument(
+        "--invalidate-interval", type=float, default=0, help="seconds between cache invalidations, 0 to disable"
+    )
+    args = parser.parse_args()
+    args.firmware = Firmware(args.firmware, args.base) if args.firmware else None
+    args.card_list = args.grant + [random.randrange(1, 1 << 40) for _ in range(args.cards)]
+
+    context = None
+    if args.cert:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(args.cert, args.key)
+
+    async def serve():
+        server = await asyncio.start_server(lambda r, w: handle(args, r, w), args.host, args.port, ssl=context)
+        print(f"Listening on {'wss' if context else 'ws'}://{args.host}:{args.port}{WS_PATH}", flush=True)
+        if args.firmware:
+            server.firmware = await asyncio.start_server(
+                lambda r, w: serve_firmware(args.firmware, r, w), args.host, args.http_port
+            )
+            print(
+                f"Serving build {args.firmware.build} ({len(args.firmware.image)} bytes) on port {args.http_port}",
+                flush=True,
+            )
+        async with server:
+            await server.serve_forever()
+
+    try:
+        asyncio.run(serve())
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,289 @@
+#!/usr/bin/env python3
+"""Encodings of the messages between the portal and the doors.
+
+Two WebSocket subprotocols are spoken, picked during the upgrade:
+
+  interlock-json-1    text frames, one JSON object per message
+  interlock-binary-1  binary frames, a type byte followed by unsigned LEB128
+                      varints; booleans are 0 or 1
+
+Authentication and sync requests are always JSON text frames. The binary
+messages are:
+
+  0x01 ping          id
+  0x02 check_result  id, granted
+  0x03 sync          count, then count gaps between ascending card numbers
+  0x81 pong          id
+  0x82 check         id, card
+  0x83 log_access    count, then count triples of card, granted, UTC time
+                     (ms, 0 if unknown)
+  0x84 heartbeat     the HEARTBEAT_FIELDS below, RSSI_HISTORY negated RSSIs,
+                     a task count, then for each task its name length, the
+                     name's characters and its spare stack
+
+Run on its own it compares the two encodings for typical traffic:
+
+  tools/portal_wire.py --cards 5000 --events 1000
+"""
+
+import argparse
+import json
+import random
+import time
+
+PROTOCOL_JSON = "interlock-json-1"
+PROTOCOL_BINARY = "interlock-binary-1"
+
+PING = 0x01
+CHECK_RESULT = 0x02
+SYNC = 0x03
+PONG = 0x81
+CHECK = 0x82
+LOG_ACCESS = 0x83
+HEARTBEAT = 0x84
+
+# Fixed fields of a binary heartbeat, as (object, key) in the JSON form. RSSI
+# is sent negated, RTT is 0 until measured and HEARTBEAT_SIGNED are zigzag
+# encoded.
+HEARTBEAT_FIELDS = [
+    (None, "uptime"),
+    (None, "rtt_us"),
+    (None, "rssi"),
+    (None, "heap"),
+    (None, "heap_min"),
+    ("flash", "reads"),
+    ("flash", "read_bytes"),
+    ("flash", "writes"),
+    ("flash", "write_bytes"),
+    ("flash", "erases"),
+    ("flash", "errors"),
+    ("access", "decisions"),
+    ("access", "granted"),
+    ("access", "latency_total_us"),
+    ("access", "latency_last_us"),
+    ("access", "latency_max_us"),
+    ("wifi", "roams"),
+    ("wifi", "roam_last_ms"),
+    ("wifi", "roam_max_ms"),
+    ("cache", "hits"),
+    ("cache", "misses"),
+    ("cache", "saved_ms"),
+    ("wifi", "wakes"),
+    ("wifi", "wake_max_us"),
+    ("wifi", "current_ua"),
+    ("wifi", "ready_last_ms"),
+    ("wifi", "ready_max_ms"),
+    ("clock", "time"),
+    ("clock", "syncs"),
+    ("clock", "accuracy_us"),
+    ("clock", "offset_us"),
+    ("clock", "drift_ppb"),
+]
+HEARTBEAT_SIGNED = {("clock", "offset_us"), ("clock", "drift_ppb")}
+RSSI_HISTORY = 8
+
+
+class WireError(Exception):
+    pass
+
+
+# =============================================================================
+# Varints
+# =============================================================================
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def read_varints(data, offset=1):
+    """Decodes every varint in data from offset on."""
+    values = []
+    value = shift = 0
+    for byte in data[offset:]:
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            if value >> 64:
+                raise WireError("varint overflows 64 bits")
+            values.append(value)
+            value = shift = 0
+    if shift:
+        raise WireError("truncated varint")
+    return values
+
+
+# =============================================================================
+# Messages
+# =============================================================================
+
+
+def encode_json(message):
+    return json.dumps(message, separators=(",", ":")).encode()
+
+
+def encode_binary(message):
+    """Encodes a message dict as binary. Returns None for JSON only commands."""
+    command = message["command"]
+    if command == "ping":
+        return bytes([PING]) + varint(message["id"])
+    if command == "pong":
+        return bytes([PONG]) + varint(message["id"])
+    if command == "check_result":
+        return bytes([CHECK_RESULT]) + varint(message["id"]) + varint(int(bool(message["granted"])))
+    if command == "check":
+        return bytes([CHECK]) + varint(message["id"]) + varint(message["card"])
+    if command == "log_access":
+        return (
+            bytes([LOG_ACCESS])
+            + varint(1)
+            + varint(message["card"])
+            + varint(int(bool(message["granted"])))
+            + varint(message.get("time", 0))
+        )
+    if command == "sync":
+        cards = sorted(set(message["cards"]))
+        out = bytearray([SYNC]) + varint(len(cards))
+        previous = 0
+        for card in cards:
+            out += varint(card - previous)
+            previous = card
+        return bytes(out)
+    return None
+
+
+def decode_binary(data):
+    """Decodes a binary message into the same dicts the JSON encoding gives.
+
+    log_access can carry several events, so it decodes to a list of messages.
+    """
+    if not data:
+        raise WireError("empty message")
+    kind = data[0]
+    fields = read_varints(data)
+
+    def need(count):
+        if len(fields) != count:
+            raise WireError(f"type 0x{kind:02x} needs {count} fields, got {len(fields)}")
+
+    if kind in (PING, PONG):
+        need(1)
+        return {"command": "ping" if kind == PING else "pong", "id": fields[0]}
+    if kind == CHECK_RESULT:
+        need(2)
+        return {"command": "check_result", "id": fields[0], "granted": bool(fields[1])}
+    if kind == CHECK:
+        need(2)
+        return {"command": "check", "id": fields[0], "card": fields[1]}
+    if kind == LOG_ACCESS:
+        if not fields or len(fields) != 1 + 3 * fields[0]:
+            raise WireError("bad log_access count")
+        messages = []
+        for card, granted, at in zip(fields[1::3], fields[2::3], fields[3::3]):
+            message = {"command": "log_access", "card": card, "granted": bool(granted)}
+            if at:
+                message["time"] = at
+            messages.append(message)
+        return messages
+    if kind == HEARTBEAT:
+        return decode_heartbeat(fields)
+    if kind == SYNC:
+        if not fields or len(fields) != 1 + fields[0]:
+            raise WireError("bad sync count")
+        cards = []
+        card = 0
+        for gap in fields[1:]:
+            card += gap
+            cards.append(card)
+        return {"command": "sync", "cards": cards}
+    raise WireError(f"unknown type 0x{kind:02x}")
+
+
+def decode_heartbeat(fields):
+    count = len(HEARTBEAT_FIELDS) + RSSI_HISTORY
+    if len(fields) < count + 1:
+        raise WireError("short heartbeat")
+    message = {"command": "heartbeat", "flash": {}, "access": {}, "cache": {}, "clock": {}, "wifi": {}, "stacks": {}}
+    for (group, key), value in zip(HEARTBEAT_FIELDS, fields):
+        (message[group] if group else message)[key] = unzigzag(value) if (group, key) in HEARTBEAT_SIGNED else value
+    message["rssi"] = -message["rssi"]
+    message["wifi"]["rssi_history"] = [-value for value in fields[len(HEARTBEAT_FIELDS) : count]]
+
+    pos = count + 1
+    for _ in range(fields[count]):
+        if pos >= len(fields) or pos + fields[pos] + 1 >= len(fields):
+            raise WireError("truncated heartbeat task")
+        length = fields[pos]
+        name = bytes(fields[pos + 1 : pos + 1 + length]).decode("ascii")
+        message["stacks"][name] = fields[pos + 1 + length]
+        pos += length + 2
+    if pos != len(fields):
+        raise WireError("data after the heartbeat tasks")
+    return message
+
+
+# =============================================================================
+# Benchmark
+# =============================================================================
+
+
+def bench(args):
+    rng = random.Random(1)
+    cards = [rng.randrange(1, 1 << 40) for _ in range(args.cards)]
+    events = []
+    for i in range(args.events):
+        card = rng.choice(cards) if cards else rng.randrange(1, 1 << 40)
+        granted = rng.random() < 0.9
+        events += [
+            {"command": "check", "id": i, "card": card},
+            {"command": "check_result", "id": i, "granted": granted},
+            {"command": "log_access", "card": card, "granted": granted, "time": 1700000000000 + i * 1000},
+            {"command": "ping", "id": i},
+            {"command": "pong", "id": i},
+        ]
+    messages = [{"command": "sync", "cards": cards}] + events
+
+    def measure(name, encode, decode):
+        encoded = [encode(message) for message in messages]
+        start = time.perf_counter()
+        for _ in range(args.repeat):
+            for data in encoded:
+                decode(data)
+        elapsed = (time.perf_counter() - start) / args.repeat
+        sync_size = len(encoded[0])
+        event_size = sum(len(data) for data in encoded[1:])
+        per_event = event_size / len(events) if events else 0
+        print(
+            f"{name:7} sync {sync_size:8} bytes  events {event_size:8} bytes ({per_event:.1f} per message)  "
+            f"decode {elapsed * 1000:.2f} ms"
+        )
+        return sync_size + event_size
+
+    print(f"{args.cards} cards, {len(events)} event messages")
+    text = measure("json", encode_json, json.loads)
+    binary = measure("binary", encode_binary, decode_binary)
+    print(f"binary is {binary / text * 100:.0f}% of the JSON size")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--cards", type=int, default=5000, help="cards in the synced list")
+    parser.add_argument("--events", type=int, default=1000, help="checks, each with its result, log and a ping")
+    parser.add_argument("--repeat", type=int, default=5, help="decode passes to average over")
+    bench(parser.parse_args())
+
+
+if __name__ == "__main__":
+    main()